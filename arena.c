@@ -0,0 +1,92 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <stdalign.h>
+#include <stddef.h>
+
+/* size of the first block; later blocks double */
+#define ARENA_MIN_BLOCK  (64 * 1024)
+#define ARENA_ALIGN      alignof(max_align_t)
+
+struct arena_block {
+        struct arena_block *next; // previously filled block
+        size_t size;              // usable bytes in data
+        size_t used;              // bytes handed out from data
+        alignas(max_align_t) char data[];
+};
+
+void arena_init(struct arena *a) {
+        *a = (struct arena){.head = NULL};
+}
+
+void *arena_alloc(struct arena *a,
+                  size_t size) {
+        size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+        struct arena_block *blk = a->head;
+        if ((blk == NULL) || (blk->size - blk->used < size)) {
+                /* start a new block at least twice as big as the last */
+                size_t blksz = (blk == NULL) ? ARENA_MIN_BLOCK
+                                             : 2 * blk->size;
+                while (blksz < size) {
+                        blksz <<= 1;
+                }
+                struct arena_block *new = malloc(sizeof(*new) + blksz);
+                if (new == NULL) {
+                        return NULL;
+                }
+                new->next = blk;
+                new->size = blksz;
+                new->used = 0;
+                a->head = blk = new;
+        }
+        void *ptr = blk->data + blk->used;
+        blk->used += size;
+        a->num_allocs++;
+        return ptr;
+}
+
+void arena_reset(struct arena *a) {
+        struct arena_block *head = a->head;
+        if (head == NULL) {
+                return;
+        }
+        struct arena_block *blk = head->next;
+        while (blk != NULL) {
+                struct arena_block *next = blk->next;
+                free(blk);
+                blk = next;
+        }
+        head->next = NULL;
+        head->used = 0;
+        a->num_allocs = 0;
+}
+
+void arena_adopt(struct arena *dst,
+                 struct arena *src) {
+        if (src->head == NULL) {
+                return;
+        }
+        /* put src's blocks behind dst's current one so dst keeps filling
+         * the block it was using */
+        struct arena_block *tail = src->head;
+        while (tail->next != NULL) {
+                tail = tail->next;
+        }
+        if (dst->head == NULL) {
+                dst->head = src->head;
+        } else {
+                tail->next = dst->head->next;
+                dst->head->next = src->head;
+        }
+        dst->num_allocs += src->num_allocs;
+        arena_init(src);
+}
+
+void arena_free(struct arena *a) {
+        struct arena_block *blk = a->head;
+        while (blk != NULL) {
+                struct arena_block *next = blk->next;
+                free(blk);
+                blk = next;
+        }
+        arena_init(a);
+}
@@ -0,0 +1,25 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* bump allocator for everything that lives until the end of a run; blocks
+ * grow geometrically so there are only ever a handful of them */
+struct arena_block;
+struct arena {
+        struct arena_block *head; // block currently being allocated from
+        size_t num_allocs;        // number of arena_alloc calls
+};
+void arena_init(struct arena *a);
+/* returns NULL if out of memory; memory is suitably aligned for any type */
+void *arena_alloc(struct arena *a,
+                  size_t size);
+/* frees everything allocated so far but keeps the newest, biggest block, so
+ * an arena that is filled the same way again doesn't call malloc */
+void arena_reset(struct arena *a);
+/* moves all of src's blocks into dst; src is left empty */
+void arena_adopt(struct arena *dst,
+                 struct arena *src);
+void arena_free(struct arena *a);
+
+#endif /* !ARENA_H */
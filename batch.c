@@ -0,0 +1,81 @@
+#include "batch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* copies len characters of str into the arena as a string */
+static char *strndup_arena(struct arena *restrict arena,
+                           const char *restrict str,
+                           size_t len);
+
+int batch_read(struct batch_job **restrict jobs,
+               const char *restrict path,
+               struct arena *restrict arena) {
+        FILE *fp = fopen(path, "r");
+        if (fp == NULL) {
+                fprintf(stderr, "failed to open batch file %s\n", path);
+                return -1;
+        }
+
+        int num_jobs = 0;
+        int max_jobs = 0;
+        *jobs = NULL;
+        char *line = NULL;
+        size_t linecap = 0;
+        size_t len;
+        int lineno = 0;
+        while (getline(&line, &linecap, fp) >= 0) {
+                lineno++;
+                len = strcspn(line, "\r\n");
+                line[len] = '\0';
+                if ((len == 0) || (line[0] == '#')) {
+                        continue;
+                }
+
+                char *chosen = strchr(line, '\t');
+                if (chosen == NULL) {
+                        fprintf(stderr, "%s:%d: expected music-dir, chosen "
+                                "export and sourced export separated by "
+                                "tabs\n", path, lineno);
+                        num_jobs = -1;
+                        break;
+                }
+                char *sourced = strchr(chosen + 1, '\t');
+                if (sourced == NULL) {
+                        sourced = line + len;
+                }
+
+                /* make space if needed; the old list is left in the arena */
+                if (num_jobs >= max_jobs) {
+                        max_jobs = (max_jobs == 0) ? 16 : max_jobs << 1;
+                        struct batch_job *tmp = arena_alloc(arena, max_jobs
+                                                            * sizeof(*tmp));
+                        if (num_jobs > 0) {
+                                memcpy(tmp, *jobs, num_jobs * sizeof(*tmp));
+                        }
+                        *jobs = tmp;
+                }
+                (*jobs)[num_jobs] = (struct batch_job){
+                        .dirpath = strndup_arena(arena, line, chosen - line),
+                        .chosen = strndup_arena(arena, chosen + 1,
+                                                sourced - chosen - 1),
+                        .sourced = (*sourced == '\0') ? ""
+                                   : strndup_arena(arena, sourced + 1,
+                                                   line + len - sourced - 1)
+                };
+                num_jobs++;
+        }
+
+        free(line);
+        fclose(fp);
+        return num_jobs;
+}
+
+static char *strndup_arena(struct arena *restrict arena,
+                           const char *restrict str,
+                           size_t len) {
+        char *dup = arena_alloc(arena, len + 1);
+        memcpy(dup, str, len);
+        dup[len] = '\0';
+        return dup;
+}
@@ -0,0 +1,22 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "arena.h"
+
+/* a batch file lists several music directories, each with its own exports,
+ * so they can all be compared against a single parse of the roster */
+
+struct batch_job {
+        const char *dirpath;
+        const char *chosen;       // chosen export
+        const char *sourced;      // sourced export; "" if not given
+};
+/* reads the jobs in the batch file at path, one per line as music-dir,
+ * chosen export and sourced export separated by tabs; blank lines and lines
+ * starting with '#' are skipped. everything is allocated from the arena.
+ * returns the number of jobs, or -1 on error */
+int batch_read(struct batch_job **restrict jobs,
+               const char *restrict path,
+               struct arena *restrict arena);
+
+#endif /* !BATCH_H */
@@ -0,0 +1,607 @@
+#include "json-parse.h"
+#include "json-buf.h"
+#include "arena.h"
+#include "dir.h"
+#include "pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define PROG_NAME        "vip-bench"
+#define DEFAULT_VIP_PULL "./vip-pull"
+#define DEFAULT_OVERLAP  0.5
+#define DEFAULT_RUNS     3
+#define DEFAULT_SEED     1
+/* exports are passed to vip-pull as arguments, each of which the kernel
+ * caps at 128K, so only so many ids can be chosen */
+#define MAX_CHOSEN       12000
+#define BENCH_URL        "https://www.vipvgm.net/"
+#define BENCH_EXT        "m4a"
+#define USAGE \
+        "should have the form:\n" \
+        PROG_NAME" [options] [number of tracks]...\n" \
+        "options:\n" \
+        "  -o, --overlap=R       fraction of chosen tracks already in the\n" \
+        "                        directory (default 0.5)\n" \
+        "  -r, --runs=N          times to run each phase; the fastest " \
+        "counts\n" \
+        "                        (default 3)\n" \
+        "  -s, --seed=N          seed for the generated ids (default 1)\n" \
+        "  -w, --workdir=D       where to generate files (default " \
+        "$TMPDIR or\n" \
+        "                        /tmp)\n" \
+        "  -p, --vip-pull=F      binary to time end to end (default " \
+        DEFAULT_VIP_PULL ")\n" \
+        "  -t, --threads=N       threads to parse with (default one per " \
+        "cpu)\n" \
+        "results are printed as one JSON object per line\n"
+
+static const int default_sizes[] = {1000, 10000, 100000, 1000000};
+
+struct options {
+        double overlap;           // fraction of chosen files in the dir
+        int runs;                 // runs per phase
+        uint64_t seed;
+        const char *workdir;
+        const char *vip_pull;
+        int threads;              // pool threads; 0 for one per cpu
+        struct pool *pool;        // started once the options are parsed
+};
+static int parse_options(struct options *restrict opts,
+                         int argc,
+                         char **restrict argv);
+
+/* everything generated for one roster size */
+struct bench_set {
+        int num_tracks;           // tracks in the roster
+        int *ids;                 // ids in roster order
+        char *roster_path;
+        size_t roster_len;
+        char *dirpath;
+        char *chosen;             // export strings
+        char *sourced;
+        int num_chosen;
+        int num_present;          // chosen tracks with a file in dirpath
+        char **names;             // files created in dirpath
+        int num_names;
+};
+/* writes a roster, exports and a directory into workdir */
+static int gen_set(struct bench_set *restrict set,
+                   int num_tracks,
+                   const struct options *restrict opts,
+                   const char *restrict workdir);
+/* removes everything gen_set made */
+static void free_set(struct bench_set *set);
+/* writes the roster as vip serves it: minified, with escaped quotes in
+ * titles and filenames, and an s_file for some tracks */
+static int gen_roster(const struct bench_set *set);
+/* filename of the track with the given id, as it appears on disk */
+static int track_name(char *restrict buf,
+                      size_t size,
+                      int id,
+                      bool is_sourced);
+/* whether the track with the given id has a source file */
+static bool has_s_file(int id);
+
+/* phases; each prints one result line */
+static int bench_parse(const struct bench_set *restrict set,
+                       const struct options *restrict opts);
+static int bench_dir_read(const struct bench_set *restrict set,
+                          const struct options *restrict opts);
+static int bench_diff(const struct bench_set *restrict set,
+                      const struct options *restrict opts);
+static int bench_end_to_end(const struct bench_set *restrict set,
+                            const struct options *restrict opts);
+/* prints a result; bytes is left out if 0, items_name is what was counted */
+static void print_result(const char *restrict phase,
+                         const struct bench_set *restrict set,
+                         const struct options *restrict opts,
+                         double sec,
+                         size_t bytes,
+                         long items,
+                         const char *restrict items_name,
+                         long rss_kb);
+static double now(void);
+static long max_rss_kb(void);
+/* xorshift64*; the generated sets only need to be repeatable */
+static uint64_t next_rand(uint64_t *state);
+
+int main(int argc, char **argv) {
+        struct options opts;
+        int argind = parse_options(&opts, argc, argv);
+        if (argind < 0) {
+                fputs("error: invalid arguments\n"
+                      USAGE "\n",
+                      stderr);
+                return -1;
+        }
+
+        char workdir[4096];
+        snprintf(workdir, sizeof(workdir), "%s/" PROG_NAME ".XXXXXX",
+                 opts.workdir);
+        if (mkdtemp(workdir) == NULL) {
+                perror("error: failed to make work directory");
+                return -1;
+        }
+
+        struct pool pool;
+        pool_init(&pool, opts.threads);
+        opts.pool = &pool;
+
+        int num_sizes = argc - argind;
+        if (num_sizes == 0) {
+                num_sizes = sizeof(default_sizes) / sizeof(*default_sizes);
+        }
+        int err_code = 0;
+        for (int i = 0; (i < num_sizes) && (err_code == 0); i++) {
+                int num_tracks = (argind < argc) ? atoi(argv[argind + i])
+                                                 : default_sizes[i];
+                if (num_tracks < 2) {
+                        fprintf(stderr, "error: invalid number of tracks "
+                                "%s\n", argv[argind + i]);
+                        err_code = -1;
+                        break;
+                }
+
+                fprintf(stderr, "generating %d tracks...\n", num_tracks);
+                struct bench_set set;
+                if (gen_set(&set, num_tracks, &opts, workdir) < 0) {
+                        fputs("error: failed to generate files\n", stderr);
+                        free_set(&set);
+                        err_code = -1;
+                        break;
+                }
+                if ((bench_parse(&set, &opts) < 0)
+                    || (bench_dir_read(&set, &opts) < 0)
+                    || (bench_diff(&set, &opts) < 0)
+                    || (bench_end_to_end(&set, &opts) < 0)) {
+                        err_code = -1;
+                }
+                fflush(stdout);
+                free_set(&set);
+        }
+
+        pool_free(&pool);
+        rmdir(workdir);
+        return err_code;
+}
+
+static int parse_options(struct options *restrict opts,
+                         int argc,
+                         char **restrict argv) {
+        static const struct option longopts[] = {
+                {"overlap", required_argument, NULL, 'o'},
+                {"runs", required_argument, NULL, 'r'},
+                {"seed", required_argument, NULL, 's'},
+                {"workdir", required_argument, NULL, 'w'},
+                {"vip-pull", required_argument, NULL, 'p'},
+                {"threads", required_argument, NULL, 't'},
+                {NULL, 0, NULL, 0}
+        };
+        const char *tmpdir = getenv("TMPDIR");
+        *opts = (struct options){
+                .overlap = DEFAULT_OVERLAP,
+                .runs = DEFAULT_RUNS,
+                .seed = DEFAULT_SEED,
+                .workdir = ((tmpdir != NULL) && (*tmpdir != '\0'))
+                           ? tmpdir : "/tmp",
+                .vip_pull = DEFAULT_VIP_PULL,
+                .threads = 0,
+                .pool = NULL
+        };
+
+        int opt;
+        while ((opt = getopt_long(argc, argv, "o:r:s:w:p:t:", longopts,
+                                  NULL))
+               != -1) {
+                switch (opt) {
+                case 'o':
+                        opts->overlap = atof(optarg);
+                        if ((opts->overlap < 0) || (opts->overlap > 1)) {
+                                fprintf(stderr, "error: invalid overlap "
+                                        "%s\n", optarg);
+                                return -1;
+                        }
+                        break;
+                case 'r':
+                        opts->runs = atoi(optarg);
+                        if (opts->runs < 1) {
+                                fprintf(stderr, "error: invalid run count "
+                                        "%s\n", optarg);
+                                return -1;
+                        }
+                        break;
+                case 's':
+                        opts->seed = strtoull(optarg, NULL, 10);
+                        break;
+                case 'w':
+                        opts->workdir = optarg;
+                        break;
+                case 'p':
+                        opts->vip_pull = optarg;
+                        break;
+                case 't':
+                        opts->threads = atoi(optarg);
+                        if (opts->threads < 1) {
+                                fprintf(stderr, "error: invalid thread count "
+                                        "%s\n", optarg);
+                                return -1;
+                        }
+                        break;
+                default:
+                        return -1;
+                }
+        }
+        return optind;
+}
+
+static int gen_set(struct bench_set *restrict set,
+                   int num_tracks,
+                   const struct options *restrict opts,
+                   const char *restrict workdir) {
+        *set = (struct bench_set){.num_tracks = num_tracks};
+        size_t pathlen = strlen(workdir) + 32;
+        set->roster_path = malloc(pathlen);
+        set->dirpath = malloc(pathlen);
+        set->ids = malloc(num_tracks * sizeof(*set->ids));
+        if ((set->roster_path == NULL) || (set->dirpath == NULL)
+            || (set->ids == NULL)) {
+                return -1;
+        }
+        snprintf(set->roster_path, pathlen, "%s/roster-%d.json", workdir,
+                 num_tracks);
+        snprintf(set->dirpath, pathlen, "%s/dir-%d", workdir, num_tracks);
+
+        /* ids are in no particular order in the roster, like the real one,
+         * which is sorted by game */
+        uint64_t state = opts->seed * UINT64_C(0x9E3779B97F4A7C15) + 1;
+        for (int i = 0; i < num_tracks; i++) {
+                set->ids[i] = i + 1;
+        }
+        for (int i = num_tracks - 1; i > 0; i--) {
+                int j = next_rand(&state) % (i + 1);
+                int tmp = set->ids[i];
+                set->ids[i] = set->ids[j];
+                set->ids[j] = tmp;
+        }
+        struct stat st;
+        if ((gen_roster(set) < 0) || (stat(set->roster_path, &st) < 0)) {
+                return -1;
+        }
+        set->roster_len = st.st_size;
+
+        /* chosen tracks are spread evenly through the roster and include the
+         * last one, so the parse always runs to the end */
+        set->num_chosen = num_tracks / 2;
+        if (set->num_chosen > MAX_CHOSEN) {
+                set->num_chosen = MAX_CHOSEN;
+        }
+        const int stride = num_tracks / set->num_chosen;
+        set->chosen = malloc(set->num_chosen * 12 + 1);
+        set->sourced = malloc(set->num_chosen * 12 + 1);
+        set->names = malloc(set->num_chosen * sizeof(*set->names));
+        if ((set->chosen == NULL) || (set->sourced == NULL)
+            || (set->names == NULL) || (mkdir(set->dirpath, 0777) < 0)) {
+                return -1;
+        }
+        set->num_present = set->num_chosen * opts->overlap + 0.5;
+        char *chosen_end = set->chosen;
+        char *sourced_end = set->sourced;
+        *chosen_end = *sourced_end = '\0';
+        for (int i = 0; i < set->num_chosen; i++) {
+                int id = set->ids[num_tracks - 1 - i * stride];
+                chosen_end += sprintf(chosen_end, "%s%d",
+                                      (i == 0) ? "" : ",", id);
+                if (has_s_file(id)) {
+                        sourced_end += sprintf(sourced_end, "%s%d",
+                                               (sourced_end == set->sourced)
+                                               ? "" : ",", id);
+                }
+                if (i >= set->num_present) {
+                        continue;
+                }
+
+                /* the first chosen tracks are already downloaded */
+                char name[256];
+                int namelen = track_name(name, sizeof(name), id,
+                                         has_s_file(id));
+                size_t size = strlen(set->dirpath) + namelen + 2;
+                char *path = malloc(size);
+                if (path == NULL) {
+                        return -1;
+                }
+                snprintf(path, size, "%s/%s", set->dirpath, name);
+                int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+                if (fd < 0) {
+                        free(path);
+                        return -1;
+                }
+                close(fd);
+                set->names[set->num_names] = path;
+                set->num_names++;
+        }
+        return 0;
+}
+
+static void free_set(struct bench_set *set) {
+        for (int i = 0; i < set->num_names; i++) {
+                unlink(set->names[i]);
+                free(set->names[i]);
+        }
+        if (set->dirpath != NULL) {
+                rmdir(set->dirpath);
+        }
+        if (set->roster_path != NULL) {
+                unlink(set->roster_path);
+        }
+        free(set->names);
+        free(set->chosen);
+        free(set->sourced);
+        free(set->dirpath);
+        free(set->roster_path);
+        free(set->ids);
+}
+
+static int gen_roster(const struct bench_set *set) {
+        FILE *fp = fopen(set->roster_path, "w");
+        if (fp == NULL) {
+                return -1;
+        }
+        fputs("{\"url\":\"" BENCH_URL "\",\"ext\":\"" BENCH_EXT "\","
+              "\"tracks\":[", fp);
+        for (int i = 0; i < set->num_tracks; i++) {
+                const int id = set->ids[i];
+                const int game = id % 997;
+                fprintf(fp, "%s{\"id\":%d,\"game\":\"Game %d\","
+                        "\"title\":\"Track \\\"%d\\\"\","
+                        "\"comp\":\"Composer %d\","
+                        "\"file\":\"Game %d - Track \\\"%d\\\"\"",
+                        (i == 0) ? "" : ",", id, game, id, id % 389, game,
+                        id);
+                if (has_s_file(id)) {
+                        fprintf(fp, ",\"s_file\":\"Game %d - Track \\\"%d\\\""
+                                " (Source)\"", game, id);
+                }
+                fputc('}', fp);
+        }
+        fputs("]}", fp);
+        return (fclose(fp) == 0) ? 0 : -1;
+}
+
+static int track_name(char *restrict buf,
+                      size_t size,
+                      int id,
+                      bool is_sourced) {
+        return snprintf(buf, size, "Game %d - Track \"%d\"%s." BENCH_EXT,
+                        id % 997, id, is_sourced ? " (Source)" : "");
+}
+
+static bool has_s_file(int id) {
+        return (id % 3) == 0;
+}
+
+static int bench_parse(const struct bench_set *restrict set,
+                       const struct options *restrict opts) {
+        double best = -1;
+        size_t bytes = 0;
+        for (int run = 0; run < opts->runs; run++) {
+                int fd = open(set->roster_path, O_RDONLY);
+                struct json_buf jb;
+                if ((fd < 0)
+                    || (json_buf_open(&jb, fd, JSON_BUF_AUTO) < 0)) {
+                        fputs("error: failed to open roster\n", stderr);
+                        if (fd >= 0) {
+                                close(fd);
+                        }
+                        return -1;
+                }
+                struct arena arena;
+                arena_init(&arena);
+                struct track *tracks;
+                struct idset chosen;
+                init_tracks(&tracks, &chosen, set->chosen, set->sourced,
+                            opts->pool, &arena);
+
+                double start = now();
+                char *url;
+                char *ext;
+                int num_found = -1;
+                if (get_url_ext(&url, &ext, &arena, &jb) == 0) {
+                        num_found = get_all_tracks(tracks, &chosen, ext,
+                                                   NULL, NULL, opts->pool,
+                                                   &arena, &jb);
+                }
+                double sec = now() - start;
+
+                bytes = json_buf_offset(&jb);
+                arena_free(&arena);
+                json_buf_close(&jb);
+                close(fd);
+                if (num_found != set->num_chosen) {
+                        fprintf(stderr, "error: found %d of %d chosen "
+                                "tracks\n", num_found, set->num_chosen);
+                        return -1;
+                }
+                if ((best < 0) || (sec < best)) {
+                        best = sec;
+                }
+        }
+        print_result("parse", set, opts, best, bytes, set->num_tracks,
+                     "tracks", max_rss_kb());
+        return 0;
+}
+
+static int bench_dir_read(const struct bench_set *restrict set,
+                          const struct options *restrict opts) {
+        double best = -1;
+        int num_names = 0;
+        for (int run = 0; run < opts->runs; run++) {
+                struct dir_namelist dnl = {.dirpath = set->dirpath};
+                double start = now();
+                dir_read(&dnl);
+                double sec = now() - start;
+
+                num_names = dnl.num_names;
+                arena_free(&dnl.arena);
+                if ((best < 0) || (sec < best)) {
+                        best = sec;
+                }
+        }
+        print_result("dir_read", set, opts, best, 0, num_names, "entries",
+                     max_rss_kb());
+        return 0;
+}
+
+static int bench_diff(const struct bench_set *restrict set,
+                      const struct options *restrict opts) {
+        /* the filenames come from a parse, as they would in a real run */
+        int fd = open(set->roster_path, O_RDONLY);
+        struct json_buf jb;
+        if ((fd < 0) || (json_buf_open(&jb, fd, JSON_BUF_AUTO) < 0)) {
+                fputs("error: failed to open roster\n", stderr);
+                if (fd >= 0) {
+                        close(fd);
+                }
+                return -1;
+        }
+        struct arena arena;
+        arena_init(&arena);
+        struct track *tracks;
+        struct idset chosen;
+        init_tracks(&tracks, &chosen, set->chosen, set->sourced, opts->pool,
+                    &arena);
+        char *url;
+        char *ext;
+        int num_tracks = 0;
+        if (get_url_ext(&url, &ext, &arena, &jb) == 0) {
+                num_tracks = get_all_tracks(tracks, &chosen, ext, NULL,
+                                            NULL, opts->pool, &arena, &jb);
+        }
+        json_buf_close(&jb);
+        close(fd);
+
+        struct dir_namelist dnl = {.dirpath = set->dirpath};
+        dir_read(&dnl);
+        /* dir_missing compacts the list, so each run gets a fresh copy */
+        struct track *scratch = malloc(num_tracks * sizeof(*scratch));
+        double best = -1;
+        int num_missing = 0;
+        for (int run = 0; (run < opts->runs) && (scratch != NULL); run++) {
+                memcpy(scratch, tracks, num_tracks * sizeof(*scratch));
+                double start = now();
+                num_missing = dir_missing(&dnl, scratch, num_tracks);
+                double sec = now() - start;
+                if ((best < 0) || (sec < best)) {
+                        best = sec;
+                }
+        }
+        free(scratch);
+        arena_free(&dnl.arena);
+        arena_free(&arena);
+
+        if (num_missing != set->num_chosen - set->num_present) {
+                fprintf(stderr, "error: %d of %d chosen tracks missing, "
+                        "expected %d\n", num_missing, set->num_chosen,
+                        set->num_chosen - set->num_present);
+                return -1;
+        }
+        print_result("diff", set, opts, best, 0, num_tracks, "tracks",
+                     max_rss_kb());
+        return 0;
+}
+
+static int bench_end_to_end(const struct bench_set *restrict set,
+                            const struct options *restrict opts) {
+        double best = -1;
+        long rss = 0;
+        for (int run = 0; run < opts->runs; run++) {
+                double start = now();
+                pid_t pid = fork();
+                if (pid < 0) {
+                        perror("error: fork");
+                        return -1;
+                } else if (pid == 0) {
+                        /* only the exit status matters */
+                        int in = open(set->roster_path, O_RDONLY);
+                        int out = open("/dev/null", O_WRONLY);
+                        if ((in < 0) || (out < 0)
+                            || (dup2(in, STDIN_FILENO) < 0)
+                            || (dup2(out, STDOUT_FILENO) < 0)
+                            || (dup2(out, STDERR_FILENO) < 0)) {
+                                _exit(127);
+                        }
+                        execl(opts->vip_pull, opts->vip_pull, set->dirpath,
+                              set->chosen, set->sourced, (char *)NULL);
+                        _exit(127);
+                }
+
+                int status;
+                struct rusage usage;
+                if (wait4(pid, &status, 0, &usage) < 0) {
+                        perror("error: wait4");
+                        return -1;
+                }
+                double sec = now() - start;
+                if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+                        fprintf(stderr, "error: %s failed\n", opts->vip_pull);
+                        return -1;
+                }
+                if ((best < 0) || (sec < best)) {
+                        best = sec;
+                }
+                if (usage.ru_maxrss > rss) {
+                        rss = usage.ru_maxrss;
+                }
+        }
+        print_result("end_to_end", set, opts, best, set->roster_len,
+                     set->num_tracks, "tracks", rss);
+        return 0;
+}
+
+static void print_result(const char *restrict phase,
+                         const struct bench_set *restrict set,
+                         const struct options *restrict opts,
+                         double sec,
+                         size_t bytes,
+                         long items,
+                         const char *restrict items_name,
+                         long rss_kb) {
+        /* keep the rates finite for phases too quick for the clock */
+        const double rate_sec = (sec > 0) ? sec : 1e-9;
+        printf("{\"phase\":\"%s\",\"size\":%d,\"overlap\":%g,\"runs\":%d,"
+               "\"sec\":%.6f", phase, set->num_tracks, opts->overlap,
+               opts->runs, sec);
+        if (bytes > 0) {
+                printf(",\"bytes\":%zu,\"mb_per_s\":%.1f", bytes,
+                       bytes / rate_sec / 1e6);
+        }
+        printf(",\"%s\":%ld,\"%s_per_s\":%.0f,\"max_rss_kb\":%ld}\n",
+               items_name, items, items_name, items / rate_sec, rss_kb);
+}
+
+static double now(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long max_rss_kb(void) {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+}
+
+static uint64_t next_rand(uint64_t *state) {
+        *state ^= *state >> 12;
+        *state ^= *state << 25;
+        *state ^= *state >> 27;
+        return *state * UINT64_C(0x2545F4914F6CDD1D);
+}
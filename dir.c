@@ -0,0 +1,422 @@
+#include "dir.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+
+struct dir_walk;
+/* one reader of a recursive listing. it takes directories from the top of
+ * its own stack, so it stays deep in one part of the tree, and when that
+ * runs out it steals from the bottom of the others', where the biggest
+ * untouched subtrees are */
+struct dir_walker {
+        struct dir_walk *walk;
+        pthread_mutex_t lock;     // guards the stack
+        char **dirs;              // paths still to be read
+        int bottom;               // next one to be stolen
+        int top;                  // one past the next one to be popped
+        int max_dirs;
+        char *names;              // '\0'-ended basenames found so far
+        size_t names_len;
+        size_t names_cap;
+        struct arena arena;       // holds the paths; only the owner
+                                  // allocates from it
+        bool has_error;           // ran out of memory
+        struct pool_task task;
+};
+/* state shared by the readers of a recursive listing */
+struct dir_walk {
+        const char *root;
+        const struct dir_filter *filter;
+        struct dir_walker *walkers;
+        int num_walkers;
+        pthread_mutex_t lock;
+        pthread_cond_t has_work;  // a directory was queued, or none are left
+        int pending;              // directories queued or being read
+        unsigned long num_pushes; // directories queued so far, so an idle
+                                  // reader can tell it missed one
+};
+
+/* does the work of dir_read */
+static void dir_list(struct dir_namelist *dnl);
+/* lists dirpath and everything under it into dnl->names */
+static void dir_walk(struct dir_namelist *dnl);
+/* reads directories until there are none left anywhere */
+static void *dir_walk_thrd(void *dir_walker);
+/* lists one directory, queueing its subdirectories */
+static void dir_scan(struct dir_walker *restrict w,
+                     const char *restrict path);
+/* queues a directory on the walker's own stack */
+static int dir_push(struct dir_walker *restrict w,
+                    char *restrict path);
+/* takes the walker's newest directory, or steals another walker's oldest */
+static char *dir_take(struct dir_walker *w);
+static int dir_add_name(struct dir_walker *restrict w,
+                        const char *restrict name);
+static bool dir_match(const char *const *patterns,
+                      int num_patterns,
+                      const char *name);
+static int mystrcmp(const void *a, const void *b);
+
+void *dir_read(void *dir_namelist) {
+        struct dir_namelist *dnl = dir_namelist;
+        struct stats_clock start;
+        stats_clock_now(&start);
+        dir_list(dnl);
+        stats_clock_now(&dnl->elapsed);
+        dnl->elapsed.wall -= start.wall;
+        dnl->elapsed.cpu -= start.cpu;
+        return NULL;
+}
+
+static void dir_list(struct dir_namelist *dnl) {
+        dnl->namelist = NULL;
+        dnl->num_names = 0;
+        arena_init(&dnl->arena);
+
+        if (dnl->manifest_path != NULL) {
+                if (manifest_open(&dnl->manifest, dnl->manifest_path,
+                                  dnl->dirpath) >= 0) {
+                        dnl->num_names = dnl->manifest.names.num_names;
+                }
+                return;
+        }
+        if (dnl->is_recursive) {
+                dir_walk(dnl);
+                return;
+        }
+
+        DIR *dir = opendir(dnl->dirpath);
+        if (dir == NULL) {
+                return;
+        }
+        int max_names = 0;
+        struct dirent *ent;
+        while ((ent = readdir(dir)) != NULL) {
+                /* make space if needed; the old list is left in the arena */
+                if (dnl->num_names >= max_names) {
+                        max_names = (max_names == 0) ? 256 : max_names << 1;
+                        char **tmp = arena_alloc(&dnl->arena,
+                                                 max_names * sizeof(*tmp));
+                        if (dnl->num_names > 0) {
+                                memcpy(tmp, dnl->namelist,
+                                       dnl->num_names * sizeof(*tmp));
+                        }
+                        dnl->namelist = tmp;
+                }
+                size_t strsz = strlen(ent->d_name) + 1;
+                dnl->namelist[dnl->num_names] = arena_alloc(&dnl->arena,
+                                                            strsz);
+                memcpy(dnl->namelist[dnl->num_names], ent->d_name, strsz);
+                dnl->num_names++;
+        }
+        closedir(dir);
+        /* sort with the same comparison bsearch will use */
+        qsort(dnl->namelist, dnl->num_names, sizeof(*dnl->namelist),
+              mystrcmp);
+}
+
+void dir_free(struct dir_namelist *dnl) {
+        manifest_close(&dnl->manifest);
+        nameset_free(&dnl->names);
+}
+
+bool dir_has(const struct dir_namelist *dnl,
+                    const char *name) {
+        if (dnl->manifest_path != NULL) {
+                return manifest_has(&dnl->manifest, name);
+        }
+        if (dnl->is_recursive) {
+                return nameset_contains(&dnl->names, name);
+        }
+        return (bsearch(&name, dnl->namelist, dnl->num_names,
+                        sizeof(*dnl->namelist), mystrcmp) != NULL);
+}
+
+int dir_missing(const struct dir_namelist *restrict dnl,
+                struct track *restrict tracks,
+                int num_tracks) {
+        int num_missing = 0;
+        for (int i = 0; i < num_tracks; i++) {
+                if (!dir_has(dnl, tracks[i].filename)) {
+                        tracks[num_missing] = tracks[i];
+                        num_missing++;
+                }
+        }
+        return num_missing;
+}
+
+static void dir_walk(struct dir_namelist *dnl) {
+        nameset_init(&dnl->names);
+        const struct dir_filter no_filter = {.num_include = 0};
+        struct dir_walk walk = {
+                .root = dnl->dirpath,
+                .filter = (dnl->filter != NULL) ? dnl->filter : &no_filter,
+                .num_walkers = (dnl->pool != NULL) ? dnl->pool->num_threads
+                                                   : 1,
+                .pending = 1
+        };
+        /* whoever runs this reads too, so a pool without threads still
+         * works */
+        if (walk.num_walkers < 1) {
+                walk.num_walkers = 1;
+        }
+        walk.walkers = calloc(walk.num_walkers, sizeof(*walk.walkers));
+        if (walk.walkers == NULL) {
+                return;
+        }
+        pthread_mutex_init(&walk.lock, NULL);
+        pthread_cond_init(&walk.has_work, NULL);
+        for (int i = 0; i < walk.num_walkers; i++) {
+                walk.walkers[i].walk = &walk;
+                pthread_mutex_init(&walk.walkers[i].lock, NULL);
+                arena_init(&walk.walkers[i].arena);
+        }
+
+        bool has_error = (dir_push(&walk.walkers[0],
+                                   (char *)dnl->dirpath) < 0);
+        if (!has_error) {
+                for (int i = 1; i < walk.num_walkers; i++) {
+                        pool_submit(dnl->pool, &walk.walkers[i].task,
+                                    dir_walk_thrd, &walk.walkers[i]);
+                }
+                dir_walk_thrd(&walk.walkers[0]);
+                for (int i = 1; i < walk.num_walkers; i++) {
+                        pool_wait(dnl->pool, &walk.walkers[i].task);
+                }
+        }
+
+        /* one table for the existence checks; the same name in two
+         * directories is kept once */
+        for (int i = 0; i < walk.num_walkers; i++) {
+                struct dir_walker *w = &walk.walkers[i];
+                has_error = has_error || w->has_error;
+                for (size_t off = 0; !has_error && (off < w->names_len); ) {
+                        const size_t len = strlen(w->names + off);
+                        has_error = (nameset_add(&dnl->names, w->names + off,
+                                                 len) < 0);
+                        off += len + 1;
+                }
+                free(w->names);
+                free(w->dirs);
+                arena_free(&w->arena);
+                pthread_mutex_destroy(&w->lock);
+        }
+        pthread_cond_destroy(&walk.has_work);
+        pthread_mutex_destroy(&walk.lock);
+        free(walk.walkers);
+
+        /* a partial listing would have tracks downloaded again */
+        if (has_error) {
+                fprintf(stderr, "out of memory listing %s\n", dnl->dirpath);
+                nameset_free(&dnl->names);
+        }
+        dnl->num_names = dnl->names.num_names;
+}
+
+static void *dir_walk_thrd(void *dir_walker) {
+        struct dir_walker *w = dir_walker;
+        struct dir_walk *walk = w->walk;
+        while (true) {
+                pthread_mutex_lock(&walk->lock);
+                const unsigned long num_pushes = walk->num_pushes;
+                pthread_mutex_unlock(&walk->lock);
+
+                char *path = dir_take(w);
+                if (path == NULL) {
+                        /* sleep until something is queued after the stacks
+                         * were looked at, or everything has been read */
+                        pthread_mutex_lock(&walk->lock);
+                        while ((walk->pending > 0)
+                               && (walk->num_pushes == num_pushes)) {
+                                pthread_cond_wait(&walk->has_work,
+                                                  &walk->lock);
+                        }
+                        const bool is_done = (walk->pending == 0);
+                        pthread_mutex_unlock(&walk->lock);
+                        if (is_done) {
+                                break;
+                        }
+                        continue;
+                }
+                dir_scan(w, path);
+
+                pthread_mutex_lock(&walk->lock);
+                walk->pending--;
+                if (walk->pending == 0) {
+                        pthread_cond_broadcast(&walk->has_work);
+                }
+                pthread_mutex_unlock(&walk->lock);
+        }
+        return NULL;
+}
+
+static void dir_scan(struct dir_walker *restrict w,
+                     const char *restrict path) {
+        const struct dir_filter *filter = w->walk->filter;
+        /* the top level is listed like a flat listing, dots and all, so a
+         * directory that can be read is never empty */
+        const bool is_root = (path == w->walk->root);
+        DIR *dir = opendir(path);
+        if (dir == NULL) {
+                return;
+        }
+        const size_t pathlen = strlen(path);
+        struct dirent *ent;
+        while ((ent = readdir(dir)) != NULL) {
+                const char *name = ent->d_name;
+                if ((name[0] == '.') && ((name[1] == '\0')
+                                         || ((name[1] == '.')
+                                             && (name[2] == '\0')))) {
+                        if (is_root) {
+                                dir_add_name(w, name);
+                        }
+                        continue;
+                }
+                if (dir_match(filter->exclude, filter->num_exclude, name)) {
+                        continue;
+                }
+                /* symlinked directories aren't followed, so there are no
+                 * loops */
+                bool is_dir = (ent->d_type == DT_DIR);
+                if (ent->d_type == DT_UNKNOWN) {
+                        struct stat st;
+                        is_dir = (fstatat(dirfd(dir), name, &st,
+                                          AT_SYMLINK_NOFOLLOW) == 0)
+                                 && S_ISDIR(st.st_mode);
+                }
+                if (is_dir) {
+                        const size_t namesz = strlen(name) + 1;
+                        char *subpath = arena_alloc(&w->arena,
+                                                    pathlen + 1 + namesz);
+                        if (subpath == NULL) {
+                                w->has_error = true;
+                                continue;
+                        }
+                        memcpy(subpath, path, pathlen);
+                        subpath[pathlen] = '/';
+                        memcpy(subpath + pathlen + 1, name, namesz);
+                        dir_push(w, subpath);
+                        dir_add_name(w, name);
+                } else if ((filter->num_include == 0)
+                           || dir_match(filter->include, filter->num_include,
+                                        name)) {
+                        dir_add_name(w, name);
+                }
+        }
+        closedir(dir);
+}
+
+static int dir_push(struct dir_walker *restrict w,
+                    char *restrict path) {
+        pthread_mutex_lock(&w->lock);
+        /* slide what's left down before growing */
+        if (w->top == w->max_dirs) {
+                if (w->bottom > 0) {
+                        memmove(w->dirs, w->dirs + w->bottom,
+                                (w->top - w->bottom) * sizeof(*w->dirs));
+                        w->top -= w->bottom;
+                        w->bottom = 0;
+                } else {
+                        int max_dirs = (w->max_dirs == 0) ? 64
+                                                          : w->max_dirs << 1;
+                        char **tmp = realloc(w->dirs,
+                                             max_dirs * sizeof(*tmp));
+                        if (tmp == NULL) {
+                                w->has_error = true;
+                                pthread_mutex_unlock(&w->lock);
+                                return -1;
+                        }
+                        w->dirs = tmp;
+                        w->max_dirs = max_dirs;
+                }
+        }
+        w->dirs[w->top] = path;
+        w->top++;
+        pthread_mutex_unlock(&w->lock);
+
+        struct dir_walk *walk = w->walk;
+        pthread_mutex_lock(&walk->lock);
+        /* the root was counted before anyone started */
+        if (path != walk->root) {
+                walk->pending++;
+        }
+        walk->num_pushes++;
+        pthread_cond_signal(&walk->has_work);
+        pthread_mutex_unlock(&walk->lock);
+        return 0;
+}
+
+static char *dir_take(struct dir_walker *w) {
+        char *path = NULL;
+        pthread_mutex_lock(&w->lock);
+        if (w->top > w->bottom) {
+                w->top--;
+                path = w->dirs[w->top];
+        }
+        pthread_mutex_unlock(&w->lock);
+        if (path != NULL) {
+                return path;
+        }
+
+        /* start with the next walker along, so thieves spread out */
+        struct dir_walk *walk = w->walk;
+        const int self = w - walk->walkers;
+        for (int i = 1; (i < walk->num_walkers) && (path == NULL); i++) {
+                const int other = (self + i) % walk->num_walkers;
+                struct dir_walker *victim = &walk->walkers[other];
+                pthread_mutex_lock(&victim->lock);
+                if (victim->top > victim->bottom) {
+                        path = victim->dirs[victim->bottom];
+                        victim->bottom++;
+                }
+                pthread_mutex_unlock(&victim->lock);
+        }
+        return path;
+}
+
+static int dir_add_name(struct dir_walker *restrict w,
+                        const char *restrict name) {
+        const size_t namesz = strlen(name) + 1;
+        if (w->names_len + namesz > w->names_cap) {
+                size_t cap = (w->names_cap == 0) ? 4096 : w->names_cap;
+                while (w->names_len + namesz > cap) {
+                        cap <<= 1;
+                }
+                char *tmp = realloc(w->names, cap * sizeof(*tmp));
+                if (tmp == NULL) {
+                        w->has_error = true;
+                        return -1;
+                }
+                w->names = tmp;
+                w->names_cap = cap;
+        }
+        memcpy(w->names + w->names_len, name, namesz);
+        w->names_len += namesz;
+        return 0;
+}
+
+static bool dir_match(const char *const *patterns,
+                      int num_patterns,
+                      const char *name) {
+        for (int i = 0; i < num_patterns; i++) {
+                if (fnmatch(patterns[i], name, 0) == 0) {
+                        return true;
+                }
+        }
+        return false;
+}
+
+static int mystrcmp(const void *a, const void *b) {
+        int result = strcmp(*(char **)a, *(char **)b);
+        /*
+        printf("a: %s\n"
+               "b: %s\n"
+               "result: %d\n",
+               *(char **)a, *(char **)b, result);
+        */
+        return result;
+}
@@ -0,0 +1,52 @@
+#ifndef DIR_H
+#define DIR_H
+
+#include "json-parse.h"
+#include "arena.h"
+#include "manifest.h"
+#include "nameset.h"
+#include "pool.h"
+#include "stats.h"
+#include <stdbool.h>
+
+/* shell patterns that decide which names a recursive listing keeps */
+struct dir_filter {
+        const char *const *include; // files must match one of these, if
+        int num_include;            // any
+        const char *const *exclude; // files and directories matching any of
+        int num_exclude;          // these are skipped
+};
+/* names of the files already in the music directory */
+struct dir_namelist {
+        const char *dirpath;      // assigned prior to dir_read call
+        const char *manifest_path; // assigned prior; NULL if not used
+        bool is_recursive;        // assigned prior; also list every
+                                  // subdirectory, by basename
+        const struct dir_filter *filter; // assigned prior; NULL keeps
+                                         // every name
+        struct pool *pool;        // assigned prior; subdirectories are read
+                                  // on it, or serially if NULL
+        char **namelist;          // assigned by dir_read call
+        int num_names;            // assigned by dir_read call
+        struct arena arena;       // holds namelist; assigned by dir_read call
+        struct manifest manifest; // used instead of namelist if there's a
+                                  // manifest_path; assigned by dir_read call
+        struct nameset names;     // used instead of namelist if
+                                  // is_recursive; assigned by dir_read call
+        struct stats_clock elapsed; // time dir_read took; assigned by
+                                    // dir_read call
+};
+/* lists the directory, or loads its manifest; meant to be run on the pool */
+void *dir_read(void *dir_namelist);
+/* frees whatever dir_read kept outside of its arena */
+void dir_free(struct dir_namelist *dnl);
+/* checks whether name is in the directory */
+bool dir_has(const struct dir_namelist *dnl,
+             const char *name);
+/* moves the tracks whose files aren't in the directory to the front of the
+ * list, keeping their order; returns how many there are */
+int dir_missing(const struct dir_namelist *restrict dnl,
+                struct track *restrict tracks,
+                int num_tracks);
+
+#endif /* !DIR_H */
@@ -0,0 +1,640 @@
+#include "download.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <curl/curl.h>
+
+#define META_MAGIC       "VIPPART1"
+/* HEAD requests queued up per connection, so the next one goes out as soon
+ * as the last is answered (or alongside it, over http/2) */
+#define PROBE_QUEUE      8
+
+/* what the server said about a file, kept next to its partial download so
+ * the download can be resumed only if the file hasn't changed since */
+struct part_meta {
+        curl_off_t length;        // full length of the file, or -1
+        char etag[128];           // validator for If-Range, or ""
+        char modified[64];        // Last-Modified, used if there's no etag
+};
+/* one in-flight transfer; its easy handle is reused for later urls so the
+ * connection it used stays warm */
+struct transfer {
+        CURL *easy;
+        FILE *fp;                 // partial file being appended to
+        char *path;               // where the finished file goes
+        char *partpath;           // path DOWNLOAD_PART_SUFFIX
+        char *metapath;           // path DOWNLOAD_META_SUFFIX
+        struct curl_slist *headers; // If-Range, when resuming
+        struct download *dl;      // NULL when idle
+        curl_off_t resume_from;   // bytes already in the partial file
+        curl_off_t content_length; // from the current response, or -1
+        curl_off_t range_total;   // full length from Content-Range, or -1
+        bool has_body;            // set once the body starts arriving
+        struct part_meta meta;    // validators and length of the file
+        curl_off_t max_speed;     // bytes a second, or 0 for no limit
+};
+/* opens the partial file, resuming it if it can be, and starts dl on xfer;
+ * returns 1 if the partial file was already complete and no transfer was
+ * needed */
+static int xfer_start(struct transfer *restrict xfer,
+                      struct download *restrict dl,
+                      const char *restrict dirpath,
+                      CURLM *restrict multi);
+/* queues a HEAD request for dl's url on easy, which is already set up for
+ * one */
+static void probe_start(CURL *restrict easy,
+                        struct download *restrict dl,
+                        CURLM *restrict multi);
+/* closes the partial file and renames it into place if it's complete,
+ * keeping it to resume later if not; returns 0 if the download succeeded */
+static int xfer_finish(struct transfer *restrict xfer,
+                       CURLcode result);
+/* returns the size of a partial file that can be resumed, reading its
+ * validators into meta, or 0 if it can't be resumed */
+static off_t part_size(const char *restrict partpath,
+                       const char *restrict metapath,
+                       struct part_meta *restrict meta);
+/* renames a complete partial file of size bytes into place */
+static int part_done(struct transfer *restrict xfer,
+                     struct download *restrict dl,
+                     off_t size);
+/* curl callbacks; headers are collected into the transfer, and the body is
+ * appended to the partial file */
+static size_t xfer_header(char *buf,
+                          size_t size,
+                          size_t nitems,
+                          void *transfer);
+static size_t xfer_write(char *data,
+                         size_t size,
+                         size_t nmemb,
+                         void *transfer);
+/* reads or writes a part_meta file; returns -1 if it's missing or bad */
+static int meta_read(struct part_meta *restrict meta,
+                     const char *restrict path);
+static int meta_write(const struct part_meta *restrict meta,
+                      const char *restrict path);
+/* checks whether the name of a header (or meta line) is name, ignoring
+ * case */
+static bool header_is(const char *restrict buf,
+                      size_t namelen,
+                      const char *restrict name);
+/* copies a header value, without surrounding whitespace, into dst */
+static void header_copy(char *restrict dst,
+                        size_t size,
+                        const char *restrict val,
+                        size_t len);
+/* returns a new string of str followed by suffix */
+static char *str_concat(const char *restrict str,
+                        const char *restrict suffix);
+/* joins a directory and filename into a new string */
+static char *path_join(const char *restrict dirpath,
+                       const char *restrict name);
+
+int download_all(const char *restrict dirpath,
+                 struct download *restrict dls,
+                 int num_dls,
+                 int max_jobs,
+                 long long max_rate) {
+        if (num_dls == 0) {
+                return 0;
+        }
+        if (max_jobs < 1) {
+                max_jobs = 1;
+        }
+        if (max_jobs > num_dls) {
+                max_jobs = num_dls;
+        }
+        if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+                return -1;
+        }
+        CURLM *multi = curl_multi_init();
+        if (multi == NULL) {
+                curl_global_cleanup();
+                return -1;
+        }
+        /* transfers to the same host share a few connections rather than
+         * each doing its own handshake */
+        curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+                          (long)max_jobs);
+        curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+                          (long)max_jobs);
+        curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+        struct transfer *xfers = calloc(max_jobs, sizeof(*xfers));
+        int num_failed = 0;
+        int next_dl = 0;
+        int num_active = 0;
+        /* each transfer gets an equal share of the rate, so that together
+         * they stay under it */
+        curl_off_t max_speed = 0;
+        if (max_rate > 0) {
+                max_speed = max_rate / max_jobs;
+                if (max_speed < 1) {
+                        max_speed = 1;
+                }
+        }
+        /* start the first batch */
+        for (int i = 0; i < max_jobs; i++) {
+                xfers[i].easy = curl_easy_init();
+                xfers[i].max_speed = max_speed;
+                int ret;
+                while ((next_dl < num_dls)
+                       && ((ret = xfer_start(&xfers[i], &dls[next_dl],
+                                             dirpath, multi)) != 0)) {
+                        next_dl++;
+                        num_failed += (ret < 0);
+                }
+                if (xfers[i].dl != NULL) {
+                        next_dl++;
+                        num_active++;
+                }
+        }
+
+        while (num_active > 0) {
+                int still_running;
+                curl_multi_perform(multi, &still_running);
+
+                /* handle finished transfers and hand their handles the next
+                 * url */
+                CURLMsg *msg;
+                int msgs_left;
+                while ((msg = curl_multi_info_read(multi, &msgs_left))
+                       != NULL) {
+                        if (msg->msg != CURLMSG_DONE) {
+                                continue;
+                        }
+                        struct transfer *xfer;
+                        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE,
+                                          (char **)&xfer);
+                        CURLcode result = msg->data.result;
+                        curl_multi_remove_handle(multi, xfer->easy);
+                        if (xfer_finish(xfer, result) < 0) {
+                                num_failed++;
+                        }
+                        num_active--;
+
+                        int ret;
+                        while ((next_dl < num_dls)
+                               && ((ret = xfer_start(xfer, &dls[next_dl],
+                                                     dirpath, multi)) != 0)) {
+                                next_dl++;
+                                num_failed += (ret < 0);
+                        }
+                        if (xfer->dl != NULL) {
+                                next_dl++;
+                                num_active++;
+                        }
+                }
+
+                if (num_active > 0) {
+                        curl_multi_poll(multi, NULL, 0, 1000, NULL);
+                }
+        }
+
+        for (int i = 0; i < max_jobs; i++) {
+                curl_easy_cleanup(xfers[i].easy);
+        }
+        free(xfers);
+        curl_multi_cleanup(multi);
+        curl_global_cleanup();
+        return num_failed;
+}
+
+int download_probe(struct download *restrict dls,
+                   int num_dls,
+                   int max_conns) {
+        for (int i = 0; i < num_dls; i++) {
+                dls[i].size = -1;
+        }
+        if (num_dls == 0) {
+                return 0;
+        }
+        if (max_conns < 1) {
+                max_conns = 1;
+        }
+        int num_easys = max_conns * PROBE_QUEUE;
+        if (num_easys > num_dls) {
+                num_easys = num_dls;
+        }
+        if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+                return -1;
+        }
+        CURLM *multi = curl_multi_init();
+        CURL **easys = calloc(num_easys, sizeof(*easys));
+        if ((multi == NULL) || (easys == NULL)) {
+                curl_multi_cleanup(multi);
+                free(easys);
+                curl_global_cleanup();
+                return -1;
+        }
+        /* requests past max_conns wait for one of the open connections
+         * rather than making their own */
+        curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+                          (long)max_conns);
+        curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+                          (long)max_conns);
+        curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+        int num_unknown = num_dls;
+        int next_dl = 0;
+        int num_active = 0;
+        for (int i = 0; i < num_easys; i++) {
+                easys[i] = curl_easy_init();
+                if (easys[i] == NULL) {
+                        continue;
+                }
+                curl_easy_setopt(easys[i], CURLOPT_NOBODY, 1L);
+                curl_easy_setopt(easys[i], CURLOPT_FAILONERROR, 1L);
+                curl_easy_setopt(easys[i], CURLOPT_FOLLOWLOCATION, 1L);
+                curl_easy_setopt(easys[i], CURLOPT_NOSIGNAL, 1L);
+                probe_start(easys[i], &dls[next_dl], multi);
+                next_dl++;
+                num_active++;
+        }
+        if (num_active == 0) {
+                num_unknown = -1;
+        }
+
+        while (num_active > 0) {
+                int still_running;
+                curl_multi_perform(multi, &still_running);
+
+                CURLMsg *msg;
+                int msgs_left;
+                while ((msg = curl_multi_info_read(multi, &msgs_left))
+                       != NULL) {
+                        if (msg->msg != CURLMSG_DONE) {
+                                continue;
+                        }
+                        CURL *easy = msg->easy_handle;
+                        struct download *dl;
+                        curl_easy_getinfo(easy, CURLINFO_PRIVATE,
+                                          (char **)&dl);
+                        /* servers that don't say come out as -1 */
+                        curl_off_t size = -1;
+                        if (msg->data.result == CURLE_OK) {
+                                curl_easy_getinfo(
+                                        easy,
+                                        CURLINFO_CONTENT_LENGTH_DOWNLOAD_T,
+                                        &size);
+                        }
+                        dl->size = size;
+                        num_unknown -= (size >= 0);
+                        curl_multi_remove_handle(multi, easy);
+                        num_active--;
+
+                        if (next_dl < num_dls) {
+                                probe_start(easy, &dls[next_dl], multi);
+                                next_dl++;
+                                num_active++;
+                        }
+                }
+
+                if (num_active > 0) {
+                        curl_multi_poll(multi, NULL, 0, 1000, NULL);
+                }
+        }
+
+        for (int i = 0; i < num_easys; i++) {
+                curl_easy_cleanup(easys[i]);
+        }
+        free(easys);
+        curl_multi_cleanup(multi);
+        curl_global_cleanup();
+        return num_unknown;
+}
+
+static void probe_start(CURL *restrict easy,
+                        struct download *restrict dl,
+                        CURLM *restrict multi) {
+        curl_easy_setopt(easy, CURLOPT_URL, dl->url);
+        curl_easy_setopt(easy, CURLOPT_PRIVATE, dl);
+        curl_multi_add_handle(multi, easy);
+}
+
+static int xfer_start(struct transfer *restrict xfer,
+                      struct download *restrict dl,
+                      const char *restrict dirpath,
+                      CURLM *restrict multi) {
+        xfer->dl = NULL;
+        if (xfer->easy == NULL) {
+                return -1;
+        }
+        xfer->path = path_join(dirpath, dl->filename);
+        xfer->partpath = str_concat(xfer->path, DOWNLOAD_PART_SUFFIX);
+        xfer->metapath = str_concat(xfer->path, DOWNLOAD_META_SUFFIX);
+        xfer->headers = NULL;
+        xfer->resume_from = 0;
+        xfer->has_body = false;
+        xfer->meta = (struct part_meta){.length = -1};
+
+        /* pick up where an earlier run left off */
+        struct part_meta old;
+        const off_t part = part_size(xfer->partpath, xfer->metapath, &old);
+        if (part > 0) {
+                xfer->meta = old;
+                if (part == old.length) {
+                        /* it finished but was never renamed */
+                        int err_code = part_done(xfer, dl, part);
+                        free(xfer->path);
+                        free(xfer->partpath);
+                        free(xfer->metapath);
+                        return (err_code < 0) ? -1 : 1;
+                }
+                xfer->resume_from = part;
+        }
+
+        int fd = open(xfer->partpath, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC
+                      | ((xfer->resume_from > 0) ? 0 : O_TRUNC), 0666);
+        if ((fd < 0) || ((xfer->fp = fdopen(fd, "ab")) == NULL)) {
+                fprintf(stderr, "failed to create partial file for %s\n",
+                        dl->filename);
+                if (fd >= 0) {
+                        close(fd);
+                }
+                free(xfer->path);
+                free(xfer->partpath);
+                free(xfer->metapath);
+                return -1;
+        }
+
+        curl_easy_reset(xfer->easy);
+        curl_easy_setopt(xfer->easy, CURLOPT_URL, dl->url);
+        curl_easy_setopt(xfer->easy, CURLOPT_WRITEFUNCTION, xfer_write);
+        curl_easy_setopt(xfer->easy, CURLOPT_WRITEDATA, xfer);
+        curl_easy_setopt(xfer->easy, CURLOPT_HEADERFUNCTION, xfer_header);
+        curl_easy_setopt(xfer->easy, CURLOPT_HEADERDATA, xfer);
+        curl_easy_setopt(xfer->easy, CURLOPT_PRIVATE, xfer);
+        curl_easy_setopt(xfer->easy, CURLOPT_FAILONERROR, 1L);
+        curl_easy_setopt(xfer->easy, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(xfer->easy, CURLOPT_NOSIGNAL, 1L);
+        if (xfer->max_speed > 0) {
+                curl_easy_setopt(xfer->easy, CURLOPT_MAX_RECV_SPEED_LARGE,
+                                 xfer->max_speed);
+        }
+        if (xfer->resume_from > 0) {
+                /* a plain Range header rather than CURLOPT_RESUME_FROM,
+                 * which treats getting the whole file back as an error; with
+                 * If-Range, that's what a changed file gets */
+                char range[32];
+                snprintf(range, sizeof(range), "%lld-",
+                         (long long)xfer->resume_from);
+                curl_easy_setopt(xfer->easy, CURLOPT_RANGE, range);
+                char if_range[sizeof(old.etag) + sizeof(old.modified) + 16];
+                snprintf(if_range, sizeof(if_range), "If-Range: %s",
+                         (old.etag[0] != '\0') ? old.etag : old.modified);
+                xfer->headers = curl_slist_append(NULL, if_range);
+                curl_easy_setopt(xfer->easy, CURLOPT_HTTPHEADER,
+                                 xfer->headers);
+                fprintf(stderr, "resuming: %s from byte %lld\n",
+                        dl->filename, (long long)xfer->resume_from);
+        }
+        xfer->dl = dl;
+        curl_multi_add_handle(multi, xfer->easy);
+        return 0;
+}
+
+long long download_resumable(const char *restrict dirpath,
+                             const char *restrict filename) {
+        char *path = path_join(dirpath, filename);
+        char *partpath = str_concat(path, DOWNLOAD_PART_SUFFIX);
+        char *metapath = str_concat(path, DOWNLOAD_META_SUFFIX);
+        struct part_meta meta;
+        const off_t part = part_size(partpath, metapath, &meta);
+        free(path);
+        free(partpath);
+        free(metapath);
+        return part;
+}
+
+static off_t part_size(const char *restrict partpath,
+                       const char *restrict metapath,
+                       struct part_meta *restrict meta) {
+        /* only if the server can be asked whether the file is still the
+         * same one */
+        struct stat st;
+        if ((stat(partpath, &st) == 0) && (st.st_size > 0)
+            && (meta_read(meta, metapath) == 0)
+            && ((meta->etag[0] != '\0') || (meta->modified[0] != '\0'))) {
+                return st.st_size;
+        }
+        return 0;
+}
+
+static int xfer_finish(struct transfer *restrict xfer,
+                       CURLcode result) {
+        struct download *dl = xfer->dl;
+        xfer->dl = NULL;
+        if ((fclose(xfer->fp) != 0) && (result == CURLE_OK)) {
+                result = CURLE_WRITE_ERROR;
+        }
+        curl_slist_free_all(xfer->headers);
+        xfer->headers = NULL;
+
+        /* a file is only renamed into place once it is complete */
+        struct stat st;
+        const off_t size = (stat(xfer->partpath, &st) == 0) ? st.st_size : 0;
+        if ((result == CURLE_OK) && (xfer->meta.length >= 0)
+            && (size != xfer->meta.length)) {
+                result = CURLE_PARTIAL_FILE;
+        }
+        int err_code = 0;
+        if (result == CURLE_OK) {
+                err_code = part_done(xfer, dl, size);
+        } else {
+                fprintf(stderr, "failed to download %s: %s\n", dl->url,
+                        curl_easy_strerror(result));
+                err_code = -1;
+                /* keep what arrived for next time, unless the server
+                 * refused the request outright */
+                if ((size > 0) && (result != CURLE_HTTP_RETURNED_ERROR)
+                    && (xfer->has_body || (xfer->resume_from > 0))) {
+                        fprintf(stderr, "kept %lld bytes of %s to resume\n",
+                                (long long)size, dl->filename);
+                } else {
+                        unlink(xfer->partpath);
+                        unlink(xfer->metapath);
+                }
+        }
+        free(xfer->path);
+        free(xfer->partpath);
+        free(xfer->metapath);
+        return err_code;
+}
+
+static int part_done(struct transfer *restrict xfer,
+                     struct download *restrict dl,
+                     off_t size) {
+        if (rename(xfer->partpath, xfer->path) < 0) {
+                perror(xfer->path);
+                return -1;
+        }
+        unlink(xfer->metapath);
+        dl->is_done = true;
+        dl->length = size;
+        fprintf(stderr, "downloaded: %s\n", dl->filename);
+        return 0;
+}
+
+static size_t xfer_header(char *buf,
+                          size_t size,
+                          size_t nitems,
+                          void *transfer) {
+        struct transfer *xfer = transfer;
+        const size_t len = size * nitems;
+        if ((len >= 5) && (strncmp(buf, "HTTP/", 5) == 0)) {
+                /* a new response, e.g. after a redirect */
+                xfer->content_length = -1;
+                xfer->range_total = -1;
+                return len;
+        }
+        const char *colon = memchr(buf, ':', len);
+        if (colon == NULL) {
+                return len;
+        }
+        const size_t namelen = colon - buf;
+        const char *val = colon + 1;
+        const size_t vallen = buf + len - val;
+        /* every header line ends in a newline, so strtoll stops in time */
+        if (header_is(buf, namelen, "ETag")) {
+                header_copy(xfer->meta.etag, sizeof(xfer->meta.etag), val,
+                            vallen);
+        } else if (header_is(buf, namelen, "Last-Modified")) {
+                header_copy(xfer->meta.modified, sizeof(xfer->meta.modified),
+                            val, vallen);
+        } else if (header_is(buf, namelen, "Content-Length")) {
+                xfer->content_length = strtoll(val, NULL, 10);
+        } else if (header_is(buf, namelen, "Content-Range")) {
+                /* bytes first-last/total */
+                const char *slash = memchr(val, '/', vallen);
+                if ((slash != NULL) && (slash[1] != '*')) {
+                        xfer->range_total = strtoll(slash + 1, NULL, 10);
+                }
+        }
+        return len;
+}
+
+static size_t xfer_write(char *data,
+                         size_t size,
+                         size_t nmemb,
+                         void *transfer) {
+        struct transfer *xfer = transfer;
+        if (!xfer->has_body) {
+                xfer->has_body = true;
+                long code = 0;
+                curl_easy_getinfo(xfer->easy, CURLINFO_RESPONSE_CODE, &code);
+                if (code == 206) {
+                        xfer->meta.length = xfer->range_total;
+                } else {
+                        /* the whole file: either it changed since the
+                         * partial download or ranges aren't supported */
+                        xfer->meta.length = xfer->content_length;
+                        if (xfer->resume_from > 0) {
+                                fflush(xfer->fp);
+                                if (ftruncate(fileno(xfer->fp), 0) < 0) {
+                                        return 0;
+                                }
+                                xfer->resume_from = 0;
+                        }
+                }
+                /* from here on an interrupted download can be resumed */
+                meta_write(&xfer->meta, xfer->metapath);
+        }
+        if (fwrite(data, size, nmemb, xfer->fp) != nmemb) {
+                return 0;
+        }
+        return size * nmemb;
+}
+
+static int meta_read(struct part_meta *restrict meta,
+                     const char *restrict path) {
+        FILE *fp = fopen(path, "r");
+        if (fp == NULL) {
+                return -1;
+        }
+        *meta = (struct part_meta){.length = -1};
+        char line[256];
+        bool is_valid = (fgets(line, sizeof(line), fp) != NULL)
+                        && (strcmp(line, META_MAGIC "\n") == 0);
+        while (is_valid && (fgets(line, sizeof(line), fp) != NULL)) {
+                const char *val = strchr(line, ' ');
+                if (val == NULL) {
+                        continue;
+                }
+                const size_t namelen = val - line;
+                val++;
+                if (header_is(line, namelen, "length")) {
+                        meta->length = strtoll(val, NULL, 10);
+                } else if (header_is(line, namelen, "etag")) {
+                        header_copy(meta->etag, sizeof(meta->etag), val,
+                                    strlen(val));
+                } else if (header_is(line, namelen, "modified")) {
+                        header_copy(meta->modified, sizeof(meta->modified),
+                                    val, strlen(val));
+                }
+        }
+        fclose(fp);
+        return is_valid ? 0 : -1;
+}
+
+static int meta_write(const struct part_meta *restrict meta,
+                      const char *restrict path) {
+        FILE *fp = fopen(path, "w");
+        if (fp == NULL) {
+                return -1;
+        }
+        fprintf(fp, META_MAGIC "\nlength %lld\netag %s\nmodified %s\n",
+                (long long)meta->length, meta->etag, meta->modified);
+        return (fclose(fp) == 0) ? 0 : -1;
+}
+
+static bool header_is(const char *restrict buf,
+                      size_t namelen,
+                      const char *restrict name) {
+        return (strlen(name) == namelen)
+               && (strncasecmp(buf, name, namelen) == 0);
+}
+
+static void header_copy(char *restrict dst,
+                        size_t size,
+                        const char *restrict val,
+                        size_t len) {
+        while ((len > 0) && isspace((unsigned char)*val)) {
+                val++;
+                len--;
+        }
+        while ((len > 0) && isspace((unsigned char)val[len - 1])) {
+                len--;
+        }
+        if (len >= size) {
+                len = size - 1;
+        }
+        memcpy(dst, val, len);
+        dst[len] = '\0';
+}
+
+static char *str_concat(const char *restrict str,
+                        const char *restrict suffix) {
+        size_t len = strlen(str);
+        size_t suffixlen = strlen(suffix);
+        char *cat = malloc((len + suffixlen + 1) * sizeof(*cat));
+        memcpy(cat, str, len);
+        memcpy(cat + len, suffix, suffixlen + 1);
+        return cat;
+}
+
+static char *path_join(const char *restrict dirpath,
+                       const char *restrict name) {
+        size_t dirlen = strlen(dirpath);
+        size_t namelen = strlen(name);
+        char *path = malloc((dirlen + namelen + 2) * sizeof(*path));
+        memcpy(path, dirpath, dirlen);
+        path[dirlen] = '/';
+        memcpy(path + dirlen + 1, name, namelen + 1);
+        return path;
+}
@@ -0,0 +1,45 @@
+#ifndef DOWNLOAD_H
+#define DOWNLOAD_H
+
+#include <stdbool.h>
+
+/* built-in replacement for running one curl per url: transfers run
+ * concurrently over a shared pool of connections, each into a partial file
+ * in the target directory that is renamed into place only once complete.
+ * a partial file is kept when a download is interrupted, along with the
+ * file's length and ETag, and picked up again with a Range request */
+
+/* suffixes added to a filename for its partial download and the metadata
+ * needed to resume it */
+#define DOWNLOAD_PART_SUFFIX ".part"
+#define DOWNLOAD_META_SUFFIX ".part.meta"
+
+struct download {
+        const char *url;          // url to fetch, already escaped
+        const char *filename;     // name to save it as in the directory
+        bool is_done;             // set once the file has been renamed
+        long long length;         // size of the file once it's done
+        long long size;           // length the server gave download_probe,
+                                  // or -1 if it didn't say
+};
+/* downloads every url into dirpath with up to max_jobs transfers at once,
+ * taking them in order, and together at no more than max_rate bytes a second
+ * if max_rate > 0; returns the number of downloads that failed, or -1 if
+ * none could start */
+int download_all(const char *restrict dirpath,
+                 struct download *restrict dls,
+                 int num_dls,
+                 int max_jobs,
+                 long long max_rate);
+/* asks for the size of every url with HEAD requests, queued up on at most
+ * max_conns connections that are kept open between them; returns the number
+ * of downloads whose size is still unknown, or -1 if none could be asked */
+int download_probe(struct download *restrict dls,
+                   int num_dls,
+                   int max_conns);
+/* returns how many bytes of filename's partial download in dirpath
+ * download_all would resume from, or 0 if there's none it can resume */
+long long download_resumable(const char *restrict dirpath,
+                             const char *restrict filename);
+
+#endif /* !DOWNLOAD_H */
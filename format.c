@@ -0,0 +1,83 @@
+#include "format.h"
+#include "download.h"
+#include <string.h>
+
+/* format names, in enum url_format order */
+static const char *const format_names[] = {"urls", "curl", "aria2", "null"};
+
+/* writes str with '\\' and '"' escaped, as inside a quoted curl config
+ * value */
+static void put_curl_chars(FILE *restrict fp,
+                           const char *restrict str);
+
+int format_parse(enum url_format *restrict format,
+                 const char *restrict name) {
+        const int num_formats = sizeof(format_names) / sizeof(*format_names);
+        for (int i = 0; i < num_formats; i++) {
+                if (strcmp(name, format_names[i]) == 0) {
+                        *format = i;
+                        return 0;
+                }
+        }
+        return -1;
+}
+
+void format_track(FILE *restrict fp,
+                  enum url_format format,
+                  const char *restrict download_url,
+                  const char *restrict dirpath,
+                  const struct vippull_result *restrict result) {
+        /* a directory given with a trailing slash shouldn't get another */
+        const size_t dirlen = strlen(dirpath);
+        const char *sep = ((dirlen > 0) && (dirpath[dirlen - 1] == '/'))
+                          ? "" : "/";
+        switch (format) {
+        case FORMAT_URLS:
+                fputs(download_url, fp);
+                fputs(result->path, fp);
+                putc('\n', fp);
+                break;
+        case FORMAT_NULL:
+                /* the path first, so each pair can follow curl's -o */
+                fprintf(fp, "%s%s%s", dirpath, sep, result->filename);
+                putc('\0', fp);
+                fputs(result->url, fp);
+                putc('\0', fp);
+                break;
+        case FORMAT_CURL:
+                fprintf(fp, "url = \"%s\"\noutput = \"", result->url);
+                put_curl_chars(fp, dirpath);
+                fputs(sep, fp);
+                put_curl_chars(fp, result->filename);
+                fputs("\"\n", fp);
+                break;
+        case FORMAT_ARIA2:
+                /* options go on indented lines after their url */
+                fprintf(fp, "%s\n  dir=%s\n  out=%s\n", result->url, dirpath,
+                        result->filename);
+                break;
+        }
+        format_note_partial(dirpath, result->filename);
+}
+
+void format_note_partial(const char *restrict dirpath,
+                         const char *restrict filename) {
+        const long long part = download_resumable(dirpath, filename);
+        if (part > 0) {
+                const size_t dirlen = strlen(dirpath);
+                fprintf(stderr, "resumable: %s%s%s from byte %lld\n",
+                        dirpath,
+                        ((dirlen > 0) && (dirpath[dirlen - 1] == '/'))
+                        ? "" : "/", filename, part);
+        }
+}
+
+static void put_curl_chars(FILE *restrict fp,
+                           const char *restrict str) {
+        for (; *str != '\0'; str++) {
+                if ((*str == '\\') || (*str == '"')) {
+                        putc('\\', fp);
+                }
+                putc(*str, fp);
+        }
+}
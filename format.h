@@ -0,0 +1,36 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include "vippull.h"
+#include <stdio.h>
+
+/* ways of writing out the urls of missing tracks, so that one downloader
+ * process can fetch all of them over reused connections instead of one
+ * curl per url */
+
+enum url_format {
+        FORMAT_URLS = 0,          // one url per line
+        FORMAT_CURL,              // url/output pairs for curl --config
+        FORMAT_ARIA2,             // an aria2c --input-file with dir and out
+        FORMAT_NULL               // '\0'-ended path and url pairs, for
+                                  // xargs -0 -n 2 curl -o
+};
+/* looks up a format by its name; returns -1 if there's no such format */
+int format_parse(enum url_format *restrict format,
+                 const char *restrict name);
+/* writes the url of a missing track that belongs in dirpath; urls are
+ * written as they are for FORMAT_URLS, and escaped for downloaders that are
+ * told where to save them */
+void format_track(FILE *restrict fp,
+                  enum url_format format,
+                  const char *restrict download_url,
+                  const char *restrict dirpath,
+                  const struct vippull_result *restrict result);
+/* says on stderr when a missing track has a partial download in dirpath
+ * that vip-pull -d would resume; it's still written out as missing, since
+ * the downloaders the formats are for can't resume vip-pull's partial
+ * files. format_track does this itself */
+void format_note_partial(const char *restrict dirpath,
+                         const char *restrict filename);
+
+#endif /* !FORMAT_H */
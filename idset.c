@@ -0,0 +1,130 @@
+#include "idset.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* a bitmap and slot table are used when they take no more than this many
+ * entries per id (plus a little slack for small sets) */
+#define DENSE_RATIO      16
+#define DENSE_SLACK      4096
+
+static void build_dense(struct idset *restrict set,
+                        const int *restrict ids,
+                        int num_ids,
+                        struct arena *restrict arena);
+static void build_sparse(struct idset *restrict set,
+                         const int *restrict ids,
+                         int num_ids,
+                         struct arena *restrict arena);
+static int intcmp(const void *a, const void *b);
+
+void idset_build(struct idset *restrict set,
+                 const int *restrict ids,
+                 int num_ids,
+                 struct arena *restrict arena) {
+        *set = (struct idset){
+                .ids = NULL,
+                .num_ids = 0,
+                .is_dense = true,
+                .range = 0
+        };
+        if (num_ids == 0) {
+                return;
+        }
+
+        int min_id = ids[0];
+        int max_id = ids[0];
+        for (int i = 1; i < num_ids; i++) {
+                min_id = (ids[i] < min_id) ? ids[i] : min_id;
+                max_id = (ids[i] > max_id) ? ids[i] : max_id;
+        }
+        const uint64_t range = (uint64_t)((int64_t)max_id - min_id) + 1;
+        if (range <= (uint64_t)num_ids * DENSE_RATIO + DENSE_SLACK) {
+                set->base = min_id;
+                set->range = range;
+                build_dense(set, ids, num_ids, arena);
+        } else {
+                set->is_dense = false;
+                build_sparse(set, ids, num_ids, arena);
+        }
+}
+
+static void build_dense(struct idset *restrict set,
+                        const int *restrict ids,
+                        int num_ids,
+                        struct arena *restrict arena) {
+        const uint32_t num_words = (set->range + 63) / 64;
+        set->bits = arena_alloc(arena, num_words * sizeof(*set->bits));
+        memset(set->bits, 0, num_words * sizeof(*set->bits));
+        for (int i = 0; i < num_ids; i++) {
+                uint32_t off = (uint32_t)ids[i] - (uint32_t)set->base;
+                set->bits[off >> 6] |= UINT64_C(1) << (off & 63);
+        }
+
+        /* walking the bitmap gives the ids sorted and without duplicates,
+         * no qsort needed */
+        set->slots = arena_alloc(arena, set->range * sizeof(*set->slots));
+        memset(set->slots, 0xff, set->range * sizeof(*set->slots));
+        set->ids = arena_alloc(arena, num_ids * sizeof(*set->ids));
+        for (uint32_t w = 0; w < num_words; w++) {
+                for (uint64_t word = set->bits[w]; word != 0;
+                     word &= word - 1) {
+                        uint32_t off = w * 64 + __builtin_ctzll(word);
+                        set->slots[off] = set->num_ids;
+                        set->ids[set->num_ids] = set->base + off;
+                        set->num_ids++;
+                }
+        }
+}
+
+static void build_sparse(struct idset *restrict set,
+                         const int *restrict ids,
+                         int num_ids,
+                         struct arena *restrict arena) {
+        set->ids = arena_alloc(arena, num_ids * sizeof(*set->ids));
+        memcpy(set->ids, ids, num_ids * sizeof(*set->ids));
+        qsort(set->ids, num_ids, sizeof(*set->ids), intcmp);
+        for (int i = 0; i < num_ids; i++) {
+                if ((set->num_ids == 0)
+                    || (set->ids[i] != set->ids[set->num_ids - 1])) {
+                        set->ids[set->num_ids] = set->ids[i];
+                        set->num_ids++;
+                }
+        }
+
+        /* keep the table at most half full */
+        uint32_t num_buckets = 16;
+        set->shift = 32 - 4;
+        while (num_buckets < 2 * (uint32_t)set->num_ids) {
+                num_buckets <<= 1;
+                set->shift--;
+        }
+        set->mask = num_buckets - 1;
+        set->buckets = arena_alloc(arena,
+                                   num_buckets * sizeof(*set->buckets));
+        for (uint32_t i = 0; i < num_buckets; i++) {
+                set->buckets[i].slot = -1;
+        }
+        for (int slot = 0; slot < set->num_ids; slot++) {
+                int id = set->ids[slot];
+                uint32_t i = idset_bucket(set, id);
+                while (set->buckets[i].slot >= 0) {
+                        i = (i + 1) & set->mask;
+                }
+                set->buckets[i] = (struct idset_bucket){
+                        .id = id,
+                        .slot = slot
+                };
+        }
+}
+
+static int intcmp(const void *a, const void *b) {
+        const int *av = a;
+        const int *bv = b;
+        if (*av > *bv) {
+                return 1;
+        } else if (*av < *bv) {
+                return -1;
+        } else {
+                return 0;
+        }
+}
@@ -0,0 +1,66 @@
+#ifndef IDSET_H
+#define IDSET_H
+
+#include "arena.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/* set of track ids where every id also has a slot, its position in the
+ * sorted list of ids; vip ids are small and dense, so usually this is a
+ * bitmap plus an id -> slot table, with a hash table for when they aren't */
+
+struct idset_bucket {
+        int32_t id;
+        int32_t slot;             // -1 if the bucket is empty
+};
+struct idset {
+        int *ids;                 // sorted, no duplicates; slot i is ids[i]
+        int num_ids;
+        bool is_dense;
+        /* dense */
+        int base;                 // smallest id
+        uint32_t range;           // largest id - base + 1
+        uint64_t *bits;           // bit (id - base) is set if id is there
+        int32_t *slots;           // slot of id - base, or -1
+        /* sparse */
+        struct idset_bucket *buckets;
+        uint32_t mask;            // number of buckets - 1
+        uint32_t shift;           // 32 - log2(number of buckets)
+};
+/* builds the set from ids in any order, with duplicates; everything is
+ * allocated from the arena */
+void idset_build(struct idset *restrict set,
+                 const int *restrict ids,
+                 int num_ids,
+                 struct arena *restrict arena);
+/* first bucket to look for id in; the top bits of the product are the ones
+ * every bit of id goes into, so ids that differ only high up, e.g.
+ * multiples of 64, still spread out */
+static inline uint32_t idset_bucket(const struct idset *set,
+                                    int id) {
+        return ((uint32_t)id * UINT32_C(0x9E3779B1)) >> set->shift;
+}
+/* returns the slot of id, or -1 if it isn't in the set */
+static inline int idset_slot(const struct idset *set,
+                             int id) {
+        if (set->is_dense) {
+                uint32_t off = (uint32_t)id - (uint32_t)set->base;
+                return (off < set->range) ? set->slots[off] : -1;
+        }
+        uint32_t i = idset_bucket(set, id);
+        while ((set->buckets[i].slot >= 0) && (set->buckets[i].id != id)) {
+                i = (i + 1) & set->mask;
+        }
+        return set->buckets[i].slot;
+}
+static inline bool idset_contains(const struct idset *set,
+                                  int id) {
+        if (set->is_dense) {
+                uint32_t off = (uint32_t)id - (uint32_t)set->base;
+                return (off < set->range)
+                       && ((set->bits[off >> 6] >> (off & 63)) & 1);
+        }
+        return (idset_slot(set, id) >= 0);
+}
+
+#endif /* !IDSET_H */
@@ -0,0 +1,374 @@
+#define _GNU_SOURCE
+#include "json-buf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+/* compressed input and the inflater reading it */
+struct json_inflate {
+        z_stream strm;
+        unsigned char *in;        // block read from fd, if not mapped
+        const unsigned char *map; // compressed file, if mapped
+        size_t maplen;
+        size_t mapoff;            // how much of map has been given to strm
+        bool is_ended;            // strm reached the end of a gzip member
+};
+
+/* looks at the first bytes of the input to tell whether it's compressed */
+static enum json_buf_codec sniff(const unsigned char *data,
+                                 size_t len);
+/* sets up inflating; the compressed input is either the mapped file (or
+ * memory) or whatever is read from fd after the len bytes already read into
+ * data */
+static int inflate_start(struct json_buf *restrict jb,
+                         const unsigned char *restrict map,
+                         size_t maplen,
+                         size_t mapoff);
+/* inflates into the free space at the end of the window; returns the
+ * number of new bytes, 0 at the end of the input */
+static size_t inflate_more(struct json_buf *jb);
+/* gives the inflater its next block of input; returns 0 if there is none */
+static size_t inflate_read(struct json_buf *jb);
+
+int json_buf_open(struct json_buf *jb,
+                  int fd,
+                  enum json_buf_codec codec) {
+        *jb = (struct json_buf){
+                .fd = fd,
+                .pin = JSON_BUF_NOPIN,
+                .codec = codec
+        };
+
+        /* regular files can be mapped and read without copying */
+        struct stat st;
+        if ((fstat(fd, &st) == 0) && S_ISREG(st.st_mode) && (st.st_size > 0)) {
+                void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+                                 fd, 0);
+                if (map != MAP_FAILED) {
+                        madvise(map, st.st_size, MADV_SEQUENTIAL);
+                        /* start wherever the descriptor was left */
+                        size_t pos = 0;
+                        off_t off = lseek(fd, 0, SEEK_CUR);
+                        if ((off > 0) && (off <= st.st_size)) {
+                                pos = off;
+                        }
+                        if (jb->codec == JSON_BUF_AUTO) {
+                                jb->codec = sniff((unsigned char *)map + pos,
+                                                  st.st_size - pos);
+                        }
+                        if (jb->codec != JSON_BUF_PLAIN) {
+                                return inflate_start(jb, map, st.st_size,
+                                                     pos);
+                        }
+                        jb->data = map;
+                        jb->len = st.st_size;
+                        jb->pos = pos;
+                        jb->is_mapped = true;
+                        jb->eof = true;
+                        return 0;
+                }
+        }
+
+        /* otherwise read blocks into a window */
+        jb->cap = JSON_BUF_BLOCK;
+        jb->data = malloc(jb->cap * sizeof(*jb->data));
+        if (jb->data == NULL) {
+                return -1;
+        }
+        return 0;
+}
+
+int json_buf_open_mem(struct json_buf *restrict jb,
+                      const void *restrict data,
+                      size_t len,
+                      enum json_buf_codec codec) {
+        *jb = (struct json_buf){
+                .fd = -1,
+                .pin = JSON_BUF_NOPIN,
+                .codec = codec,
+                .is_borrowed = true
+        };
+        /* works just like a mapped file, without the mapping */
+        if (jb->codec == JSON_BUF_AUTO) {
+                jb->codec = sniff(data, len);
+        }
+        if (jb->codec != JSON_BUF_PLAIN) {
+                return inflate_start(jb, data, len, 0);
+        }
+        jb->data = (char *)data;
+        jb->len = len;
+        jb->is_mapped = true;
+        jb->eof = true;
+        return 0;
+}
+
+void json_buf_close(struct json_buf *jb) {
+        if (!jb->is_mapped) {
+                free(jb->data);
+        } else if (!jb->is_borrowed) {
+                munmap(jb->data, jb->len);
+        }
+        jb->data = NULL;
+        if (jb->z != NULL) {
+                inflateEnd(&jb->z->strm);
+                if ((jb->z->map != NULL) && !jb->is_borrowed) {
+                        munmap((void *)jb->z->map, jb->z->maplen);
+                }
+                free(jb->z->in);
+                free(jb->z);
+                jb->z = NULL;
+        }
+}
+
+size_t json_buf_refill(struct json_buf *jb,
+                       size_t *keep) {
+        if (jb->eof) {
+                return 0;
+        }
+
+        /* drop everything before keep from the front of the window */
+        const size_t shift = (jb->pin < *keep) ? jb->pin : *keep;
+        if (shift > 0) {
+                memmove(jb->data, jb->data + shift, jb->len - shift);
+                jb->len -= shift;
+                jb->pos -= shift;
+                jb->consumed += shift;
+                *keep -= shift;
+                if (jb->pin != JSON_BUF_NOPIN) {
+                        jb->pin -= shift;
+                }
+        }
+        /* a single token may outgrow the window */
+        if (jb->len == jb->cap) {
+                char *tmp = realloc(jb->data, 2 * jb->cap * sizeof(*tmp));
+                if (tmp == NULL) {
+                        return 0;
+                }
+                jb->data = tmp;
+                jb->cap *= 2;
+        }
+        if (jb->z != NULL) {
+                return inflate_more(jb);
+        }
+
+        /* the first bytes decide how the rest is read */
+        const bool is_first = (jb->consumed == 0) && (jb->len == 0);
+        ssize_t n;
+        size_t total = 0;
+        do {
+                while (n = read(jb->fd, jb->data + jb->len,
+                                jb->cap - jb->len),
+                       (n < 0) && (errno == EINTR));
+                if (n > 0) {
+                        jb->len += n;
+                        total += n;
+                }
+        /* one byte isn't enough to tell whether it's compressed */
+        } while ((n > 0) && is_first && (jb->codec != JSON_BUF_PLAIN)
+                 && (jb->len < 2));
+        if (total == 0) {
+                jb->eof = true;
+                return 0;
+        }
+
+        /* nothing has been consumed yet, so everything in the window is
+         * raw input */
+        if (is_first && (jb->codec == JSON_BUF_AUTO)) {
+                jb->codec = sniff((unsigned char *)jb->data, jb->len);
+        }
+        if (is_first && (jb->codec != JSON_BUF_PLAIN)) {
+                if (inflate_start(jb, NULL, 0, 0) < 0) {
+                        jb->eof = true;
+                        jb->has_error = true;
+                        return 0;
+                }
+                return inflate_more(jb);
+        }
+        return total;
+}
+
+size_t json_buf_drain(struct json_buf *jb) {
+        size_t drained = jb->len - jb->pos;
+        jb->pos = jb->len;
+        /* nobody is writing into a mapped file */
+        if (jb->eof || ((jb->z != NULL) && (jb->z->map != NULL))) {
+                jb->eof = true;
+                return drained;
+        }
+
+        /* let the kernel move pipe contents straight into /dev/null */
+        int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        if (devnull >= 0) {
+                ssize_t n;
+                while (n = splice(jb->fd, NULL, devnull, NULL,
+                                  JSON_BUF_BLOCK, SPLICE_F_MOVE),
+                       (n > 0) || ((n < 0) && (errno == EINTR))) {
+                        drained += (n > 0) ? n : 0;
+                }
+                close(devnull);
+                if (n == 0) {
+                        jb->eof = true;
+                        return drained;
+                }
+        }
+        /* not a pipe; read it through the buffer instead */
+        size_t keep = jb->pos;
+        size_t n;
+        while (n = json_buf_refill(jb, &keep), n > 0) {
+                drained += n;
+                jb->pos = keep = jb->len;
+        }
+        return drained;
+}
+
+int json_buf_slurp(struct json_buf *jb) {
+        /* keeping everything from the start of the buffer makes every
+         * refill append */
+        size_t keep = 0;
+        while (json_buf_refill(jb, &keep) > 0);
+        return (jb->eof && !jb->has_error) ? 0 : -1;
+}
+
+static enum json_buf_codec sniff(const unsigned char *data,
+                                 size_t len) {
+        if (len < 2) {
+                return JSON_BUF_PLAIN;
+        }
+        /* json can't start with any of these */
+        if ((data[0] == 0x1f) && (data[1] == 0x8b)) {
+                return JSON_BUF_GZIP;
+        }
+        if (((data[0] & 0x0f) == Z_DEFLATED) && ((data[0] >> 4) <= 7)
+            && ((((unsigned)data[0] << 8) | data[1]) % 31 == 0)) {
+                return JSON_BUF_GZIP;
+        }
+        return JSON_BUF_PLAIN;
+}
+
+static int inflate_start(struct json_buf *restrict jb,
+                         const unsigned char *restrict map,
+                         size_t maplen,
+                         size_t mapoff) {
+        struct json_inflate *z = calloc(1, sizeof(*z));
+        if (z == NULL) {
+                return -1;
+        }
+        z->map = map;
+        z->maplen = maplen;
+        z->mapoff = mapoff;
+        if (map == NULL) {
+                z->in = malloc(JSON_BUF_BLOCK * sizeof(*z->in));
+        }
+        /* the window bits pick the header: 32 means gzip or zlib, negative
+         * means none; a zlib header on "deflate" data is allowed for,
+         * since http servers send either */
+        int window_bits = 15 + 32;
+        if (jb->codec == JSON_BUF_DEFLATE) {
+                const unsigned char *head = (map != NULL)
+                                            ? map + mapoff
+                                            : (unsigned char *)jb->data;
+                const size_t headlen = (map != NULL) ? maplen - mapoff
+                                                     : jb->len;
+                if (sniff(head, headlen) == JSON_BUF_PLAIN) {
+                        window_bits = -15;
+                }
+        }
+        if (((map == NULL) && (z->in == NULL))
+            || (inflateInit2(&z->strm, window_bits) != Z_OK)) {
+                free(z->in);
+                free(z);
+                if ((map != NULL) && !jb->is_borrowed) {
+                        munmap((void *)map, maplen);
+                }
+                return -1;
+        }
+        jb->z = z;
+
+        if (map != NULL) {
+                /* the mapping now belongs to the inflater; the window holds
+                 * the output */
+                jb->cap = JSON_BUF_BLOCK;
+                jb->data = malloc(jb->cap * sizeof(*jb->data));
+                if (jb->data == NULL) {
+                        return -1;
+                }
+        } else if (jb->len > 0) {
+                /* what's been read so far is the start of the compressed
+                 * input */
+                memcpy(z->in, jb->data, jb->len);
+                z->strm.next_in = z->in;
+                z->strm.avail_in = jb->len;
+                jb->len = 0;
+        }
+        return 0;
+}
+
+static size_t inflate_more(struct json_buf *jb) {
+        struct json_inflate *z = jb->z;
+        const size_t avail = jb->cap - jb->len;
+        z->strm.next_out = (unsigned char *)jb->data + jb->len;
+        z->strm.avail_out = avail;
+        while (z->strm.avail_out == avail) {
+                if (z->strm.avail_in == 0) {
+                        if (inflate_read(jb) == 0) {
+                                if (!z->is_ended) {
+                                        fputs("compressed input ends early\n",
+                                              stderr);
+                                        jb->has_error = true;
+                                }
+                                jb->eof = true;
+                                return 0;
+                        }
+                        /* gzip files can have several members in a row */
+                        if (z->is_ended) {
+                                inflateReset(&z->strm);
+                                z->is_ended = false;
+                        }
+                }
+                int ret = inflate(&z->strm, Z_NO_FLUSH);
+                if (ret == Z_STREAM_END) {
+                        z->is_ended = true;
+                        if (z->strm.avail_in > 0) {
+                                inflateReset(&z->strm);
+                                z->is_ended = false;
+                        }
+                } else if ((ret != Z_OK) && (ret != Z_BUF_ERROR)) {
+                        fprintf(stderr, "failed to decompress input: %s\n",
+                                (z->strm.msg != NULL) ? z->strm.msg
+                                                      : "corrupt data");
+                        jb->has_error = true;
+                        jb->eof = true;
+                        break;
+                }
+        }
+        const size_t n = avail - z->strm.avail_out;
+        jb->len += n;
+        return n;
+}
+
+static size_t inflate_read(struct json_buf *jb) {
+        struct json_inflate *z = jb->z;
+        if (z->map != NULL) {
+                size_t n = z->maplen - z->mapoff;
+                n = (n < JSON_BUF_BLOCK) ? n : JSON_BUF_BLOCK;
+                z->strm.next_in = (unsigned char *)z->map + z->mapoff;
+                z->strm.avail_in = n;
+                z->mapoff += n;
+                return n;
+        }
+        ssize_t n;
+        while (n = read(jb->fd, z->in, JSON_BUF_BLOCK),
+               (n < 0) && (errno == EINTR));
+        if (n <= 0) {
+                return 0;
+        }
+        z->strm.next_in = z->in;
+        z->strm.avail_in = n;
+        return n;
+}
@@ -0,0 +1,73 @@
+#ifndef JSON_BUF_H
+#define JSON_BUF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* size of each read when the input isn't a regular file */
+#define JSON_BUF_BLOCK   (1 << 20)
+/* value of pin when nothing is pinned */
+#define JSON_BUF_NOPIN   SIZE_MAX
+
+/* how the input is encoded */
+enum json_buf_codec {
+        JSON_BUF_AUTO = 0,        // compressed if it starts like gzip or zlib
+        JSON_BUF_PLAIN,
+        JSON_BUF_GZIP,            // gzip or zlib
+        JSON_BUF_DEFLATE          // raw deflate, or zlib
+};
+struct json_inflate;
+
+/* input buffer for the JSON parser; regular files are mmap'd whole, anything
+ * else (pipes, sockets) is read in large blocks into a sliding window.
+ * compressed input is inflated block by block into the window */
+struct json_buf {
+        char *data;               // start of buffered input
+        size_t len;               // number of valid bytes in data
+        size_t pos;               // read cursor into data
+        size_t cap;               // allocated size of data (0 if mapped)
+        size_t consumed;          // bytes discarded from the front of data
+        size_t pin;               // offset that refills must keep
+        size_t num_fields;        // fields parsed out of the input
+        size_t num_tracks;        // track objects parsed out of the input
+        enum json_buf_codec codec; // JSON_BUF_AUTO until the input is seen
+        struct json_inflate *z;   // decompression state, if compressed
+        int fd;                   // -1 if reading from memory
+        bool is_mapped;
+        bool is_borrowed;         // the input is the caller's memory
+        bool eof;
+        bool has_error;           // compressed input was corrupt
+};
+int json_buf_open(struct json_buf *jb,
+                  int fd,
+                  enum json_buf_codec codec);
+/* reads from len bytes at data instead of a file; data must stay valid
+ * until json_buf_close */
+int json_buf_open_mem(struct json_buf *restrict jb,
+                      const void *restrict data,
+                      size_t len,
+                      enum json_buf_codec codec);
+void json_buf_close(struct json_buf *jb);
+/* reads more input, discarding everything before *keep (or the pin, if it
+ * comes first); *keep, the pin and the cursor are moved along with the data,
+ * so pointers into the buffer are invalidated. returns the number of new
+ * bytes, 0 on EOF */
+size_t json_buf_refill(struct json_buf *jb,
+                       size_t *keep);
+/* reads the rest of the input into the buffer; returns -1 if it won't fit
+ * or couldn't be decompressed */
+int json_buf_slurp(struct json_buf *jb);
+/* reads and throws away the rest of the input so that whatever is writing
+ * into a pipe doesn't get SIGPIPE; returns the number of bytes discarded */
+size_t json_buf_drain(struct json_buf *jb);
+/* true once the cursor has reached the end of all input */
+static inline bool json_buf_at_end(const struct json_buf *jb) {
+        return jb->eof && (jb->pos >= jb->len);
+}
+/* offset of the cursor from the start of the input */
+static inline size_t json_buf_offset(const struct json_buf *jb) {
+        return jb->consumed + jb->pos;
+}
+
+#endif /* !JSON_BUF_H */
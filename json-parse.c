@@ -1,407 +1,917 @@
 #include "json-parse.h"
+#include "json-scan.h"
+#include "roster.h"
+#include "pool.h"
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
-#include <pthread.h>
-
-static int intcmp(const void *a, const void *b);
-static int trackcmp(const void *a, const void *b);
-
+#include <fcntl.h>
+#include <unistd.h>
+
+/* ids below this are deduplicated while exports are scanned */
+#define EXPORT_DEDUP_MAX (1u << 24)
+/* buffered rosters are only split if every chunk gets at least this much;
+ * smaller ones parse faster than the chunks can be handed out */
+#define PARSE_CHUNK_MIN  (1 << 20)
+/* chunks per pool thread, so a slow chunk doesn't hold up the rest */
+#define PARSE_CHUNKS_PER_THREAD 4
+
+/* a track's fields, as offsets from the start of its object in the input
+ * buffer; the object stays pinned in the buffer after get_track returns */
 struct track_source {
-        struct track track;
-        char *s_filename;
+        int id;
+        bool has_file;
+        bool has_s_file;
+        size_t file_off;
+        size_t file_len;
+        size_t s_file_off;
+        size_t s_file_len;
 };
 static int get_track(struct track_source *trackptr,
-                     FILE *json_file);
+                     struct json_buf *jb);
+/* a track found in the roster, with its fields still escaped in the input
+ * buffer */
+struct found_track {
+        int id;
+        const char *file;         // NULL if the track has none
+        size_t file_len;
+        const char *s_file;       // NULL if the track has none
+        size_t s_file_len;
+};
+/* turns the offsets of a pinned track object into pointers */
+static void found_track(struct found_track *restrict found,
+                        const struct track_source *restrict track,
+                        const char *restrict obj);
+/* sets a chosen track's filename from where it was found in the roster */
+static void set_filename(struct track *restrict trackptr,
+                         const struct found_track *restrict found,
+                         const char *restrict file_ext,
+                         struct arena *restrict arena);
+/* copies a track's fields into the roster */
+static void add_track(struct roster *restrict roster,
+                      const struct found_track *restrict found);
+
+/* a piece of a fully buffered roster, starting at a track object, parsed
+ * on the pool into its own list of tracks */
+struct parse_chunk {
+        struct json_buf jb;       // view of just this chunk
+        const struct idset *chosen; // tracks to keep, or NULL for all
+        struct found_track *tracks; // malloc'd
+        int num_tracks;
+        int max_tracks;
+        bool is_whole;            // the chunk ended between track objects
+        bool is_cut_short;        // ran out of memory before the end
+        struct pool_task task;
+};
+/* splits the rest of the input at track boundaries and parses the pieces
+ * on the pool, consuming the input; returns the number of chunks, or 0 if
+ * the input should be parsed in order instead: it isn't all buffered, is
+ * too small, a split turned out to be inside a string, or a chunk ran out
+ * of memory */
+static int parse_chunks(struct parse_chunk **restrict chunks,
+                        const struct idset *restrict chosen,
+                        struct pool *restrict pool,
+                        struct json_buf *restrict jb);
+static void *thrd_parse_chunk(void *parse_chunk);
+/* finds the first '{' at or after str that follows a '}' and a ',', i.e.
+ * looks like the start of a track object; returns end if there is none */
+static const char *find_split(const char *str,
+                              const char *end);
+static void free_chunks(struct parse_chunk *chunks,
+                        int num_chunks);
 
 /* turns the 'export chosen' and 'export sourced' strings into an array of
- * numbers */
+ * numbers; a string starting with '@' names a file to read the export from */
 struct parse_export_args {
         const char *export_str;
         int *ids;
         int num_ids;
+        bool failed;              // set if the export couldn't be read
 };
 static void *thrd_parse_export_str(void *args);
-/* checks the number of '\' characters preceeds a character and determines if
- * that character is escaped or not */
-static bool is_escaped(const char *str,
-                       size_t ind2check);
-/* skips past whitespace in file */
-static int fgetws(FILE *fp);
-/* unescapes escaped \\ and \" characters */
-static void unesc(char *str);
-
-/* works like getdelim, but persists past escaped (with a '\' before)
- * characters */
-ssize_t getdelime(char **restrict lineptr,
-                  size_t *restrict n,
-                  int delim,
-                  FILE *restrict stream) {
-        ssize_t len = 0;
-
-        char *lineptr2 = NULL;
-        size_t n2 = 0;
-
-        ssize_t len2;
-        while (len2 = getdelim(&lineptr2, &n2, delim, stream), len2 > 0) {
-                /* if not enough space for new string + null term, realloc */
-                if (len + len2 >= *n) {
-                        *n += n2;
-                        *lineptr = realloc(*lineptr, *n * sizeof(**lineptr));
-                }
-                /* copy contents + null term of lineptr2's string */
-                memcpy(*lineptr + len, lineptr2, len2 + 1);
-                len += len2;
-
-                /* if the found delimiter has not been escaped, break;
-                 * if len2 is only 1 character, it must be the delimiter */
-                if (!is_escaped(lineptr2, len2 - 1)) {
-                        break;
-                }
-        }
-        /* if an error returned not due to EOF, return an error */
-        if ((len2 < 0) && (!feof(stream))) {
-                len = -1;
-        }
-
-        free(lineptr2);
-        return len;
-}
+/* scans comma and/or whitespace separated ids out of str, stopping at
+ * anything else, into a malloc'd array; repeats of small ids are dropped
+ * as they are seen. returns the number of ids, or -1 if out of memory */
+static int parse_ids(int **restrict ids,
+                     const char *restrict str,
+                     size_t len);
+/* copies str while unescaping escaped \\ and \" characters; returns the
+ * number of characters written */
+static size_t unesc(char *restrict dst,
+                    const char *restrict str,
+                    size_t len);
+
+/* buffer helpers; 'mark' is the earliest offset that must survive a refill
+ * (NULL if nothing before the cursor is needed) and is moved with the data */
+/* makes sure at least one byte is available at the cursor */
+static bool jb_avail(struct json_buf *jb,
+                     size_t *mark);
+/* returns the next character and advances past it, or EOF */
+static int jb_getc(struct json_buf *jb,
+                   size_t *mark);
+/* skips past whitespace */
+static int jb_skipws(struct json_buf *jb,
+                     size_t *mark);
+/* advances the cursor past the next occurrence of ch */
+static int jb_skipto(struct json_buf *jb,
+                     size_t *mark,
+                     int ch);
+/* advances the cursor past the closing '"' of the string it's inside of */
+static int jb_skipstr(struct json_buf *jb,
+                      size_t *mark);
+/* copies a slice into the arena with escapes removed and, if ext isn't NULL,
+ * '.' and ext appended */
+static char *slice_dup(struct arena *restrict arena,
+                       const char *restrict str,
+                       size_t len,
+                       const char *restrict ext);
+/* tells which of the keys in enum json_key an escaped key is; none of them
+ * have characters that would be escaped */
+static enum json_key key_name(const char *key,
+                              size_t len);
+/* works like atoi on an escaped slice */
+static int slice_atoi(const char *str,
+                      size_t len);
 
 int next_field(struct json_field *restrict field,
-               FILE *restrict json_file) {
-        *field = (struct json_field){.key = NULL, .val = NULL};
-        size_t keyn = 0; // allocated size for key
-        ssize_t keylen; // string length of key
-        size_t valn = 0; // allocated size for val
-        ssize_t vallen; // string length of key
+               struct json_buf *restrict jb) {
+        /* everything is kept relative to the start of the key, since a
+         * refill can move the data */
+        size_t mark;
+        size_t keylen; // string length of key
+        size_t valoff; // offset of val from key
+        size_t vallen; // string length of val
 
         bool field_not_found = true;
         while (field_not_found) {
                 /* KEY */
                 /* consume all characters leading up to first \" */
-                while (fgetc(json_file) != '"') {
-                        if (feof(json_file)) {
-                                goto fail;
-                        }
+                if (jb_skipto(jb, NULL, '"') < 0) {
+                        return -1;
                 }
                 /* get key */
-                keylen = getdelime(&field->key, &keyn, '"', json_file);
-                if (keylen <= 0) {
-                        goto fail;
+                mark = jb->pos;
+                if (jb_skipstr(jb, &mark) < 0) {
+                        return -1;
                 }
+                keylen = jb->pos - 1 - mark;
+                field->name = key_name(jb->data + mark, keylen);
                 /* get rid of possible whitespace */
-                fgetws(json_file);
+                jb_skipws(jb, &mark);
                 /* check for colon indicating key-val pair */
-                if (fgetc(json_file) != ':') {
+                if (jb_getc(jb, &mark) != ':') {
                         field_not_found = true;
                         continue;
                 }
-                /* remove delimiter from string */
-                field->key[keylen - 1] = '\0';
-                keylen--;
 
                 /* VAL */
                 /* remove possible whitespace */
-                fgetws(json_file);
+                jb_skipws(jb, &mark);
                 /* check what type of value we're looking at */
-                char ch;
-                ch = fgetc(json_file);
+                int ch = jb_getc(jb, &mark);
                 if ((ch == '{') || (ch == '[')) { // skip objects/arrays
                         field_not_found = true;
                 } else if (ch == '"') { // value is string
+                        valoff = jb->pos - mark;
                         /* get string up to \" */
-                        vallen = getdelime(&field->val, &valn, '"', json_file);
-                        /* fail if EOF reached */
-                        if (vallen <= 0) {
-                                goto fail;
+                        if (jb_skipstr(jb, &mark) < 0) {
+                                return -1;
                         }
-                        /* remove delimiter */
-                        field->val[vallen - 1] = '\0';
-                        vallen--;
+                        vallen = jb->pos - 1 - mark - valoff;
+                        field->is_num = false;
                         field_not_found = false;
+                } else if (ch == EOF) {
+                        return -1;
                 } else { // value is number
-                        /* there might already be a string in val */
-                        vallen = 0;
-                        /* make some space */
-                        if (valn == 0) {
-                                valn = 2;
-                                field->val = malloc(valn
-                                                    * sizeof(*field->val));
+                        valoff = jb->pos - 1 - mark;
+                        /* take in the digits, converting them on the way
+                         * since the only number looked at is the id */
+                        const bool is_neg = (ch == '-');
+                        int num = isdigit(ch) ? ch - '0' : 0;
+                        while (jb_avail(jb, &mark)
+                               && isdigit((unsigned char)jb->data[jb->pos])) {
+                                num = num * 10 + (jb->data[jb->pos] - '0');
+                                jb->pos++;
                         }
-                        /* fill string with digits */
-                        do {
-                                field->val[vallen] = ch;
-                                vallen++;
-                                /* expand string if necessary (including
-                                 * null term) */
-                                if (vallen + 1 > valn) {
-                                        valn <<= 1;
-                                        size_t tmp = sizeof(*field->val);
-                                        field->val = realloc(field->val,
-                                                             valn * tmp);
-                                }
-                        } while (ch = fgetc(json_file), isdigit(ch));
-                        /* add null term */
-                        field->val[vallen] = '\0';
+                        /* and the rest of a fraction, exponent, true, false
+                         * or null, so a '}' right after it isn't missed */
+                        while (jb_avail(jb, &mark)
+                               && (isalnum((unsigned char)jb->data[jb->pos])
+                                   || (jb->data[jb->pos] == '.')
+                                   || (jb->data[jb->pos] == '+')
+                                   || (jb->data[jb->pos] == '-'))) {
+                                jb->pos++;
+                        }
+                        vallen = jb->pos - mark - valoff;
+                        field->is_num = true;
+                        field->num = is_neg ? -num : num;
                         field_not_found = false;
-                        ungetc(ch, json_file);
                 }
         }
 
-        /* remove escape characters from strings */
-        unesc(field->key);
-        unesc(field->val);
+        field->key = jb->data + mark;
+        field->keylen = keylen;
+        field->val = jb->data + mark + valoff;
+        field->vallen = vallen;
+        jb->num_fields++;
         return 0;
-
-fail:
-        free(field->key);
-        free(field->val);
-        return -1;
 }
 
 int get_url_ext(char **restrict download_url,
                 char **restrict file_ext,
-                FILE *restrict json_file) {
+                struct arena *restrict arena,
+                struct json_buf *restrict jb) {
         struct json_field field;
         *download_url = NULL;
         *file_ext = NULL;
         while ((*download_url == NULL) || (*file_ext == NULL)) {
                 /* get next json field */
-                if (next_field(&field, json_file) < 0) {
-                        free(*download_url);
-                        free(*file_ext);
+                if (next_field(&field, jb) < 0) {
                         return -1;
                 }
 
                 /* check field's key */
-                if (strcmp(field.key, "url") == 0) { // url found
-                        *download_url = field.val;
-                } else if (strcmp(field.key, "ext") == 0) { // ext found
-                        *file_ext = field.val;
-                } else {
-                        free(field.val);
+                if (field.name == JSON_KEY_URL) { // url found
+                        *download_url = slice_dup(arena, field.val,
+                                                  field.vallen, NULL);
+                } else if (field.name == JSON_KEY_EXT) {
+                        *file_ext = slice_dup(arena, field.val, field.vallen,
+                                              NULL);
                 }
-                free(field.key);
         }
 
         return 0;
 }
 
-int get_all_tracks(struct track **restrict tracks,
-                   const char *restrict export_chosen_str,
-                   const char *restrict export_sourced_str,
-                   FILE *restrict json_file) {
+int init_tracks(struct track **restrict tracks,
+                struct idset *restrict chosen,
+                const char *restrict export_chosen_str,
+                const char *restrict export_sourced_str,
+                struct pool *restrict pool,
+                struct arena *restrict arena) {
         /* parse both export strings */
-        pthread_t thrd_chosen;
         struct parse_export_args chosen_args = {
                 .export_str = export_chosen_str
         };
         struct parse_export_args sourced_args = {
                 .export_str = export_sourced_str
         };
-        pthread_create(&thrd_chosen, NULL, thrd_parse_export_str,
-                       &chosen_args);
-        thrd_parse_export_str(&sourced_args);
-        pthread_join(thrd_chosen, NULL);
+        if (pool != NULL) {
+                struct pool_task task;
+                pool_submit(pool, &task, thrd_parse_export_str,
+                            &chosen_args);
+                thrd_parse_export_str(&sourced_args);
+                pool_wait(pool, &task);
+        } else {
+                thrd_parse_export_str(&chosen_args);
+                thrd_parse_export_str(&sourced_args);
+        }
+        if (chosen_args.failed || sourced_args.failed) {
+                const char *str = chosen_args.failed ? export_chosen_str
+                                                     : export_sourced_str;
+                if (str[0] == '@') {
+                        fprintf(stderr, "failed to read export file %s\n",
+                                str + 1);
+                } else {
+                        fputs("failed to read export\n", stderr);
+                }
+                free(chosen_args.ids);
+                free(sourced_args.ids);
+                return -1;
+        }
+
+        /* the sets sort and drop duplicates, so tracks[i] goes with slot i */
+        struct idset sourced;
+        idset_build(chosen, chosen_args.ids, chosen_args.num_ids, arena);
+        idset_build(&sourced, sourced_args.ids, sourced_args.num_ids, arena);
+        free(chosen_args.ids);
+        free(sourced_args.ids);
 
         /* initialize chosen tracks */
-        int num_tracks = chosen_args.num_ids;
-        *tracks = malloc(num_tracks * sizeof(**tracks));
+        int num_tracks = chosen->num_ids;
+        *tracks = arena_alloc(arena, num_tracks * sizeof(**tracks));
         for (int i = 0; i < num_tracks; i++) {
                 (*tracks)[i].filename = NULL;
-                (*tracks)[i].id = chosen_args.ids[i];
+                (*tracks)[i].id = chosen->ids[i];
                 /* if the ID is found in the sourced export string,
                  * flag the track as sourced */
-                (*tracks)[i].is_sourced = (bsearch(&(*tracks)[i].id,
-                                                   sourced_args.ids,
-                                                   sourced_args.num_ids,
-                                                   sizeof(*sourced_args.ids),
-                                                   intcmp) != NULL);
+                (*tracks)[i].is_sourced = idset_contains(&sourced,
+                                                         chosen->ids[i]);
         }
+        return num_tracks;
+}
 
-        /* get all tracks */
-        while (!feof(json_file)) {
+int get_all_tracks(struct track *restrict tracks,
+                   const struct idset *restrict chosen,
+                   const char *restrict file_ext,
+                   void (*on_track)(const struct track *track,
+                                    void *arg),
+                   void *arg,
+                   struct pool *restrict pool,
+                   struct arena *restrict arena,
+                   struct json_buf *restrict jb) {
+        const int num_tracks = chosen->num_ids;
+        int num_unresolved = num_tracks;
+        bool *is_resolved = calloc(num_tracks, sizeof(*is_resolved));
+
+        /* chunks are merged in order and with the same early stop as below,
+         * so they give the same result as reading the roster in order;
+         * tracks can't be passed on as they're found though */
+        struct parse_chunk *chunks = NULL;
+        const int num_chunks = (on_track == NULL)
+                               ? parse_chunks(&chunks, chosen, pool, jb)
+                               : 0;
+        for (int i = 0; (i < num_chunks) && (num_unresolved > 0); i++) {
+                for (int j = 0; (j < chunks[i].num_tracks)
+                                && (num_unresolved > 0); j++) {
+                        const struct found_track *found = &chunks[i].tracks[j];
+                        int slot = idset_slot(chosen, found->id);
+                        if (is_resolved[slot]) {
+                                continue;
+                        }
+                        set_filename(&tracks[slot], found, file_ext, arena);
+                        if (tracks[slot].filename != NULL) {
+                                is_resolved[slot] = true;
+                                num_unresolved--;
+                        }
+                }
+        }
+        free_chunks(chunks, num_chunks);
+
+        /* get all tracks, stopping as soon as every chosen track has a
+         * filename; an entry without the file a track needs doesn't count,
+         * and once it has one, later entries for it are skipped */
+        while ((num_unresolved > 0) && !json_buf_at_end(jb)) {
                 struct track_source track;
-                if (get_track(&track, json_file) < 0) {
+                if (get_track(&track, jb) < 0) {
                         continue;
                 }
-                /* try to find track in track list */
-                struct track *trackptr;
-                trackptr = bsearch(&track.track, *tracks, num_tracks,
-                                   sizeof(**tracks), trackcmp);
-                if (trackptr == NULL) { // if not in list, ignore
-                        free(track.track.filename);
-                        free(track.s_filename);
-                } else { // else add the filename
-                        if (trackptr->is_sourced) {
-                                trackptr->filename = track.s_filename;
-                                free(track.track.filename);
-                        } else {
-                                trackptr->filename = track.track.filename;
-                                free(track.s_filename);
+                /* if in list, copy out the filename with its extension;
+                 * otherwise nothing gets copied out of the buffer at all */
+                int slot = idset_slot(chosen, track.id);
+                if ((slot >= 0) && !is_resolved[slot]) {
+                        struct track *trackptr = &tracks[slot];
+                        struct found_track found;
+                        found_track(&found, &track, jb->data + jb->pin);
+                        set_filename(trackptr, &found, file_ext, arena);
+                        if (trackptr->filename != NULL) {
+                                is_resolved[slot] = true;
+                                num_unresolved--;
+                                if (on_track != NULL) {
+                                        on_track(trackptr, arg);
+                                }
                         }
                 }
+                jb->pin = JSON_BUF_NOPIN;
         }
 
         int real_num_tracks = 0;
         for (int i = 0; i < num_tracks; i++) {
-                if ((*tracks)[i].filename != NULL) {
-                        (*tracks)[real_num_tracks] = (*tracks)[i];
+                if (tracks[i].filename != NULL) {
+                        tracks[real_num_tracks] = tracks[i];
                         real_num_tracks++;
                 }
         }
 
-        free(chosen_args.ids);
-        free(sourced_args.ids);
+        free(is_resolved);
         return real_num_tracks;
 }
 
-static bool is_escaped(const char *str,
-                       size_t ind2check) {
-        // keep track of how many backslashes preceed the character in question
-        size_t backslash_count = 0;
-        /* count backslashes until there isn't one or the beginning of the
-         * string has been reached */
-        for (size_t i = ind2check; i > 0; i--) {
-                if (str[i - 1] == '\\') {
-                        backslash_count++;
-                } else {
+int get_roster(struct roster *restrict roster,
+               struct pool *restrict pool,
+               struct arena *restrict arena,
+               struct json_buf *restrict jb) {
+        roster_reset(roster);
+        char *download_url;
+        char *file_ext;
+        if (get_url_ext(&download_url, &file_ext, arena, jb) < 0) {
+                return -1;
+        }
+        uint32_t url;
+        uint32_t ext;
+        strcpy(roster_stralloc(roster, strlen(download_url) + 1, &url),
+               download_url);
+        strcpy(roster_stralloc(roster, strlen(file_ext) + 1, &ext),
+               file_ext);
+
+        struct parse_chunk *chunks = NULL;
+        const int num_chunks = parse_chunks(&chunks, NULL, pool, jb);
+        for (int i = 0; i < num_chunks; i++) {
+                for (int j = 0; j < chunks[i].num_tracks; j++) {
+                        add_track(roster, &chunks[i].tracks[j]);
+                }
+        }
+        free_chunks(chunks, num_chunks);
+
+        while (!json_buf_at_end(jb)) {
+                struct track_source track;
+                if (get_track(&track, jb) < 0) {
+                        continue;
+                }
+                struct found_track found;
+                found_track(&found, &track, jb->data + jb->pin);
+                add_track(roster, &found);
+                jb->pin = JSON_BUF_NOPIN;
+        }
+
+        roster_finish(roster, url, ext);
+        /* a corrupt compressed roster just looks like a short one */
+        return jb->has_error ? -1 : 0;
+}
+
+static void found_track(struct found_track *restrict found,
+                        const struct track_source *restrict track,
+                        const char *restrict obj) {
+        found->id = track->id;
+        found->file = track->has_file ? obj + track->file_off : NULL;
+        found->file_len = track->file_len;
+        found->s_file = track->has_s_file ? obj + track->s_file_off : NULL;
+        found->s_file_len = track->s_file_len;
+}
+
+static void set_filename(struct track *restrict trackptr,
+                         const struct found_track *restrict found,
+                         const char *restrict file_ext,
+                         struct arena *restrict arena) {
+        if (!trackptr->is_sourced) {
+                trackptr->filename = (found->file == NULL) ? NULL
+                        : slice_dup(arena, found->file, found->file_len,
+                                    file_ext);
+        } else {
+                trackptr->filename = (found->s_file == NULL) ? NULL
+                        : slice_dup(arena, found->s_file, found->s_file_len,
+                                    file_ext);
+        }
+}
+
+static void add_track(struct roster *restrict roster,
+                      const struct found_track *restrict found) {
+        /* unescaping never makes a string longer, so the escaped length is
+         * enough room */
+        uint32_t file = ROSTER_NONE;
+        uint32_t s_file = ROSTER_NONE;
+        if (found->file != NULL) {
+                char *dst = roster_stralloc(roster, found->file_len + 1,
+                                            &file);
+                dst[unesc(dst, found->file, found->file_len)] = '\0';
+        }
+        if (found->s_file != NULL) {
+                char *dst = roster_stralloc(roster, found->s_file_len + 1,
+                                            &s_file);
+                dst[unesc(dst, found->s_file, found->s_file_len)] = '\0';
+        }
+        roster_add(roster, found->id, file, s_file);
+}
+
+static int parse_chunks(struct parse_chunk **restrict chunks,
+                        const struct idset *restrict chosen,
+                        struct pool *restrict pool,
+                        struct json_buf *restrict jb) {
+        /* the chunks point into the buffer, so it has to be all there */
+        *chunks = NULL;
+        if ((pool == NULL) || (pool->num_threads < 2) || !jb->eof) {
+                return 0;
+        }
+        const size_t len = jb->len - jb->pos;
+        size_t max_chunks = (size_t)pool->num_threads
+                            * PARSE_CHUNKS_PER_THREAD;
+        if (len / PARSE_CHUNK_MIN < max_chunks) {
+                max_chunks = len / PARSE_CHUNK_MIN;
+        }
+        if (max_chunks < 2) {
+                return 0;
+        }
+        struct parse_chunk *c = calloc(max_chunks, sizeof(*c));
+        if (c == NULL) {
+                return 0;
+        }
+
+        const char *const base = jb->data + jb->pos;
+        const char *const end = jb->data + jb->len;
+        const char *start = base;
+        int num_chunks = 0;
+        while (start < end) {
+                /* splits land evenly apart, then move up to the next track
+                 * object; the last chunk takes whatever is left */
+                const char *split = end;
+                if ((size_t)num_chunks + 1 < max_chunks) {
+                        const char *goal = base + len / max_chunks
+                                                  * (num_chunks + 1);
+                        split = find_split((goal > start) ? goal : start + 1,
+                                           end);
+                }
+                c[num_chunks].jb = (struct json_buf){
+                        .data = (char *)start,
+                        .len = split - start,
+                        .pin = JSON_BUF_NOPIN,
+                        .codec = JSON_BUF_PLAIN,
+                        .fd = -1,
+                        .eof = true
+                };
+                c[num_chunks].chosen = chosen;
+                pool_submit(pool, &c[num_chunks].task, thrd_parse_chunk,
+                            &c[num_chunks]);
+                num_chunks++;
+                start = split;
+        }
+        bool is_split_ok = true;
+        size_t num_fields = 0;
+        size_t num_tracks = 0;
+        for (int i = 0; i < num_chunks; i++) {
+                pool_wait(pool, &c[i].task);
+                num_fields += c[i].jb.num_fields;
+                num_tracks += c[i].jb.num_tracks;
+                /* a split inside a string leaves the chunk before it in
+                 * the middle of a track */
+                is_split_ok &= c[i].is_whole || (i == num_chunks - 1);
+                is_split_ok &= !c[i].is_cut_short;
+        }
+        if (!is_split_ok) {
+                free_chunks(c, num_chunks);
+                return 0;
+        }
+        jb->num_fields += num_fields;
+        jb->num_tracks += num_tracks;
+        jb->pos = jb->len;
+        *chunks = c;
+        return num_chunks;
+}
+
+static void *thrd_parse_chunk(void *parse_chunk) {
+        struct parse_chunk *chunk = parse_chunk;
+        struct json_buf *jb = &chunk->jb;
+        size_t last_end = 0;
+        while (!json_buf_at_end(jb)) {
+                struct track_source track;
+                if (get_track(&track, jb) < 0) {
+                        continue;
+                }
+                last_end = jb->pos;
+                if ((chunk->chosen != NULL)
+                    && !idset_contains(chunk->chosen, track.id)) {
+                        jb->pin = JSON_BUF_NOPIN;
+                        continue;
+                }
+                if (chunk->num_tracks == chunk->max_tracks) {
+                        int max_tracks = (chunk->max_tracks == 0)
+                                         ? 256 : 2 * chunk->max_tracks;
+                        struct found_track *tmp
+                                = realloc(chunk->tracks,
+                                          max_tracks * sizeof(*tmp));
+                        if (tmp == NULL) {
+                                chunk->is_cut_short = true;
+                                break;
+                        }
+                        chunk->tracks = tmp;
+                        chunk->max_tracks = max_tracks;
+                }
+                found_track(&chunk->tracks[chunk->num_tracks], &track,
+                            jb->data + jb->pin);
+                chunk->num_tracks++;
+                jb->pin = JSON_BUF_NOPIN;
+        }
+        chunk->is_whole = json_buf_at_end(jb)
+                          && (memchr(jb->data + last_end, '{',
+                                     jb->len - last_end) == NULL);
+        return NULL;
+}
+
+static const char *find_split(const char *str,
+                              const char *end) {
+        while (str < end) {
+                str += json_scan_find(str, end - str, '}');
+                if (str == end) {
                         break;
                 }
+                const char *p = str + 1;
+                while ((p < end) && isspace((unsigned char)*p)) {
+                        p++;
+                }
+                if ((p < end) && (*p == ',')) {
+                        p++;
+                        while ((p < end) && isspace((unsigned char)*p)) {
+                                p++;
+                        }
+                        if ((p < end) && (*p == '{')) {
+                                return p;
+                        }
+                }
+                str++;
         }
-        /* if there's an odd number of backslashes before the character in
-         * question, then the character has been escaped */
-        return (backslash_count % 2);
+        return end;
 }
 
-static int fgetws(FILE *fp) {
-        int num_ws = 0;
-        char ch;
-        while (ch = fgetc(fp), isspace(ch)) {
-                num_ws++;
+static void free_chunks(struct parse_chunk *chunks,
+                        int num_chunks) {
+        for (int i = 0; i < num_chunks; i++) {
+                free(chunks[i].tracks);
         }
-        ungetc(ch, fp);
-        return num_ws;
+        free(chunks);
 }
 
-static void unesc(char *str) {
-        size_t num_esc = 0;
-        while (*str != '\0') {
-                if (*str == '\\') {
-                        num_esc++;
+static size_t unesc(char *restrict dst,
+                    const char *restrict str,
+                    size_t len) {
+        const char *const dst_start = dst;
+        for (const char *end = str + len; str < end; str++) {
+                if ((*str == '\\') && (str + 1 < end)) {
                         str++;
                 }
-                str[-num_esc] = *str;
-                str++;
+                *dst++ = *str;
         }
-        str[-num_esc] = *str;
+        return dst - dst_start;
 }
 
 static void *thrd_parse_export_str(void *args) {
         struct parse_export_args *argsv = args;
-        /* set up array of ids */
-        int max_ids = 1;
+        argsv->ids = NULL;
         argsv->num_ids = 0;
-        argsv->ids = malloc(max_ids * sizeof(*argsv->ids));
-
-        int scan_ret; // holds the return of sscanf
-        int bytes_read; // holds number of bytes read
-        /* keep looping until no more ids to read */
-        while (scan_ret = sscanf(argsv->export_str,
-                                 " %d%n",
-                                 (argsv->ids) + argsv->num_ids,
-                                 &bytes_read),
-               scan_ret > 0) {
-                /* advance string past what was read */
-                argsv->export_str += bytes_read;
-                if (*argsv->export_str == ',') {
-                        argsv->export_str++;
-                }
-                argsv->num_ids++;
-                /* make space if needed */
-                if (argsv->num_ids >= max_ids) {
-                        max_ids <<= 1;
-                        argsv->ids = realloc(argsv->ids,
-                                             max_ids * sizeof(*argsv->ids));
-                }
-        }
-        qsort(argsv->ids, argsv->num_ids, sizeof(*argsv->ids), intcmp);
+        argsv->failed = false;
+        if (argsv->export_str[0] != '@') {
+                argsv->num_ids = parse_ids(&argsv->ids, argsv->export_str,
+                                           strlen(argsv->export_str));
+                argsv->failed = (argsv->num_ids < 0);
+                return NULL;
+        }
 
+        /* read the export from a file (or /dev/fd/N) instead, through the
+         * same buffer as the roster so regular files are just mapped */
+        int fd = open(argsv->export_str + 1, O_RDONLY | O_CLOEXEC);
+        struct json_buf jb;
+        if ((fd < 0) || (json_buf_open(&jb, fd, JSON_BUF_PLAIN) < 0)) {
+                argsv->failed = true;
+                if (fd >= 0) {
+                        close(fd);
+                }
+                return NULL;
+        }
+        if (json_buf_slurp(&jb) < 0) {
+                argsv->failed = true;
+        } else {
+                argsv->num_ids = parse_ids(&argsv->ids, jb.data + jb.pos,
+                                           jb.len - jb.pos);
+                argsv->failed = (argsv->num_ids < 0);
+        }
+        json_buf_close(&jb);
+        close(fd);
         return NULL;
 }
 
-static int intcmp(const void *a, const void *b) {
-        const int *av = a;
-        const int *bv = b;
-        if (*av > *bv) {
-                return 1;
-        } else if (*av < *bv) {
+static int parse_ids(int **restrict ids,
+                     const char *restrict str,
+                     size_t len) {
+        /* every id takes at least a digit and a separator, so this is
+         * enough room for all of them */
+        *ids = malloc((len / 2 + 1) * sizeof(**ids));
+        if (*ids == NULL) {
                 return -1;
-        } else {
-                return 0;
         }
+        /* bitmap of the ids seen so far; it grows with the largest id */
+        uint64_t *seen = NULL;
+        size_t num_seen_words = 0;
+
+        int num_ids = 0;
+        const char *end = str + len;
+        while (str < end) {
+                /* separators */
+                if ((*str == ',') || isspace((unsigned char)*str)) {
+                        str++;
+                        continue;
+                }
+                bool is_neg = (*str == '-');
+                if ((is_neg || (*str == '+')) && (str + 1 < end)) {
+                        str++;
+                }
+                if ((*str < '0') || (*str > '9')) {
+                        break;
+                }
+                unsigned num = 0;
+                while ((str < end) && (*str >= '0') && (*str <= '9')) {
+                        num = num * 10 + (*str - '0');
+                        str++;
+                }
+                const int id = is_neg ? -(int)num : (int)num;
+
+                /* huge or negative ids are left for idset_build to dedup */
+                if (!is_neg && (num < EXPORT_DEDUP_MAX)) {
+                        const size_t word = num / 64;
+                        if (word >= num_seen_words) {
+                                size_t new_words = (num_seen_words == 0)
+                                                   ? 64 : num_seen_words;
+                                while (new_words <= word) {
+                                        new_words <<= 1;
+                                }
+                                uint64_t *tmp = realloc(seen, new_words
+                                                        * sizeof(*tmp));
+                                if (tmp == NULL) {
+                                        /* a short list would quietly
+                                         * leave tracks out */
+                                        free(seen);
+                                        free(*ids);
+                                        *ids = NULL;
+                                        return -1;
+                                }
+                                memset(tmp + num_seen_words, 0,
+                                       (new_words - num_seen_words)
+                                       * sizeof(*tmp));
+                                seen = tmp;
+                                num_seen_words = new_words;
+                        }
+                        const uint64_t bit = UINT64_C(1) << (num % 64);
+                        if (seen[word] & bit) {
+                                continue;
+                        }
+                        seen[word] |= bit;
+                }
+                (*ids)[num_ids] = id;
+                num_ids++;
+        }
+
+        free(seen);
+        return num_ids;
 }
 
+
 static int get_track(struct track_source *trackptr,
-                     FILE *json_file) {
+                     struct json_buf *jb) {
         /* move up to first { for track */
-        while (fgetc(json_file) != '{') {
-                if (feof(json_file)) {
-                        return -1;
-                }
+        if (jb_skipto(jb, NULL, '{') < 0) {
+                return -1;
         }
-        /* undo the last fgetc so as to not mess up the upcoming loop */
-        ungetc('{', json_file);
+        /* undo the last skip so as to not mess up the upcoming loop */
+        jb->pos--;
+        /* keep the whole object around so its fields can be copied later */
+        jb->pin = jb->pos;
 
         struct track_source track = {
-                .track = {
-                        .filename = NULL,
-                        .id = -1
-                },
-                .s_filename = NULL
+                .id = -1,
+                .has_file = false,
+                .has_s_file = false
         };
         /* get track info */
         /* not every track has a source version; looking for '}' indicates the
          * end of the track object whether or not it has a source version */
-        while (fgetws(json_file), fgetc(json_file) != '}') {
+        while (jb_skipws(jb, NULL), jb_getc(jb, NULL) != '}') {
                 struct json_field field;
-                if (next_field(&field, json_file) < 0) {
-                        free(track.track.filename);
-                        free(track.s_filename);
+                if (next_field(&field, jb) < 0) {
+                        jb->pin = JSON_BUF_NOPIN;
                         return -1;
                 }
-                if (strcmp(field.key, "file") == 0) {
-                        if (track.track.filename != NULL) {
-                                free(track.track.filename);
-                        }
-                        track.track.filename = field.val;
-                } else if (strcmp(field.key, "s_file") == 0) {
-                        if (track.s_filename != NULL) {
-                                free(track.s_filename);
-                        }
-                        track.s_filename = field.val;
-                } else if (strcmp(field.key, "id") == 0) {
-                        track.track.id = atoi(field.val);
-                        free(field.val);
-                } else {
-                        free(field.val);
+                const size_t off = field.val - (jb->data + jb->pin);
+                switch (field.name) {
+                case JSON_KEY_FILE:
+                        track.has_file = true;
+                        track.file_off = off;
+                        track.file_len = field.vallen;
+                        break;
+                case JSON_KEY_S_FILE:
+                        track.has_s_file = true;
+                        track.s_file_off = off;
+                        track.s_file_len = field.vallen;
+                        break;
+                case JSON_KEY_ID:
+                        /* an id in quotes still counts */
+                        track.id = field.is_num
+                                   ? field.num
+                                   : slice_atoi(field.val, field.vallen);
+                        break;
+                default:
+                        break;
                 }
-                free(field.key);
         }
 
         *trackptr = track;
+        jb->num_tracks++;
         return 0;
 }
 
-static int trackcmp(const void *a, const void *b) {
-        const struct track *av = a;
-        const struct track *bv = b;
-        if (av->id > bv->id) {
-                return 1;
-        } else if (av->id < bv->id) {
-                return -1;
+
+static bool jb_avail(struct json_buf *jb,
+                     size_t *mark) {
+        size_t keep = jb->pos;
+        if (mark == NULL) {
+                mark = &keep;
+        }
+        while (jb->pos >= jb->len) {
+                if (json_buf_refill(jb, mark) == 0) {
+                        return false;
+                }
+        }
+        return true;
+}
+
+static int jb_getc(struct json_buf *jb,
+                   size_t *mark) {
+        if (!jb_avail(jb, mark)) {
+                return EOF;
+        }
+        return (unsigned char)jb->data[jb->pos++];
+}
+
+static int jb_skipws(struct json_buf *jb,
+                     size_t *mark) {
+        int num_ws = 0;
+        while (jb_avail(jb, mark)
+               && isspace((unsigned char)jb->data[jb->pos])) {
+                jb->pos++;
+                num_ws++;
+        }
+        return num_ws;
+}
+
+static int jb_skipto(struct json_buf *jb,
+                     size_t *mark,
+                     int ch) {
+        while (jb_avail(jb, mark)) {
+                jb->pos += json_scan_find(jb->data + jb->pos,
+                                          jb->len - jb->pos, ch);
+                if (jb->pos < jb->len) {
+                        jb->pos++;
+                        return 0;
+                }
+        }
+        return -1;
+}
+
+static int jb_skipstr(struct json_buf *jb,
+                      size_t *mark) {
+        /* whether the next byte is escaped carries over between refills */
+        uint64_t carry = 0;
+        bool has_esc = false;
+        while (jb_avail(jb, mark)) {
+                jb->pos += json_scan_strend(jb->data + jb->pos,
+                                            jb->len - jb->pos,
+                                            &carry, &has_esc);
+                if (jb->pos < jb->len) {
+                        jb->pos++;
+                        return 0;
+                }
+        }
+        return -1;
+}
+
+static char *slice_dup(struct arena *restrict arena,
+                       const char *restrict str,
+                       size_t len,
+                       const char *restrict ext) {
+        const size_t extlen = (ext == NULL) ? 0 : strlen(ext) + 1;
+        char *dup = arena_alloc(arena, (len + extlen + 1) * sizeof(*dup));
+        size_t duplen = unesc(dup, str, len);
+        if (ext != NULL) {
+                dup[duplen] = '.';
+                memcpy(dup + duplen + 1, ext, extlen);
         } else {
-                return 0;
+                dup[duplen] = '\0';
+        }
+        return dup;
+}
+
+static enum json_key key_name(const char *key,
+                              size_t len) {
+        switch (len) {
+        case 2:
+                if ((key[0] == 'i') && (key[1] == 'd')) {
+                        return JSON_KEY_ID;
+                }
+                break;
+        case 3:
+                if ((key[0] == 'u') && (memcmp(key, "url", 3) == 0)) {
+                        return JSON_KEY_URL;
+                }
+                if ((key[0] == 'e') && (memcmp(key, "ext", 3) == 0)) {
+                        return JSON_KEY_EXT;
+                }
+                break;
+        case 4:
+                if ((key[0] == 'f') && (memcmp(key, "file", 4) == 0)) {
+                        return JSON_KEY_FILE;
+                }
+                break;
+        case 6:
+                if ((key[0] == 's') && (memcmp(key, "s_file", 6) == 0)) {
+                        return JSON_KEY_S_FILE;
+                }
+                break;
+        }
+        return JSON_KEY_OTHER;
+}
+
+static int slice_atoi(const char *str,
+                      size_t len) {
+        const char *end = str + len;
+        while ((str < end) && isspace((unsigned char)*str)) {
+                str++;
+        }
+        bool is_neg = false;
+        if ((str < end) && ((*str == '-') || (*str == '+'))) {
+                is_neg = (*str == '-');
+                str++;
+        }
+        int num = 0;
+        while ((str < end) && isdigit((unsigned char)*str)) {
+                num = num * 10 + (*str - '0');
+                str++;
         }
+        return is_neg ? -num : num;
 }
@@ -1,33 +1,79 @@
 #ifndef JSON_PARSE_H
 #define JSON_PARSE_H
 
-#include <stdio.h>
+#include "json-buf.h"
+#include "arena.h"
+#include "idset.h"
+#include "pool.h"
 #include <stdbool.h>
 
-/* works like getdelim, but persists past escaped (with a '\' before)
- * characters */
-ssize_t getdelime(char **restrict lineptr,
-                  size_t *restrict n,
-                  int delim,
-                  FILE *restrict stream);
-
+/* the keys the parser looks for; next_field tells them apart by length and
+ * first byte instead of comparing each one in turn */
+enum json_key {
+        JSON_KEY_OTHER = 0,
+        JSON_KEY_URL,
+        JSON_KEY_EXT,
+        JSON_KEY_ID,
+        JSON_KEY_FILE,
+        JSON_KEY_S_FILE
+};
+/* key and value are slices into the input buffer, still escaped and not
+ * null-terminated; they stay valid until the next call that reads input */
 struct json_field {
-        char *key;
-        char *val;
+        const char *key;
+        size_t keylen;
+        enum json_key name;       // which key this is
+        const char *val;
+        size_t vallen;
+        bool is_num;              // the value is a number, not a string
+        int num;                  // the value, if it's a number
 };
 int next_field(struct json_field *restrict field,
-               FILE *restrict json_file);
+               struct json_buf *restrict jb);
+/* url and ext are allocated from the arena */
 int get_url_ext(char **restrict download_url,
                 char **restrict file_ext,
-                FILE *restrict json_file);
+                struct arena *restrict arena,
+                struct json_buf *restrict jb);
 struct track {
         char *filename;
         int id;
         bool is_sourced;
 };
-int get_all_tracks(struct track **restrict tracks,
-                   const char *restrict export_chosen_str,
-                   const char *restrict export_sourced_str,
-                   FILE *restrict json_file);
+/* sets up the chosen tracks, sorted by id, from the export strings, along
+ * with the set of chosen ids; tracks[i] is the track in slot i of the set.
+ * an export string of the form "@path" is read from the file at path.
+ * the track list and set are allocated from the arena; returns -1 if an
+ * export file can't be read. the two exports are read at the same time if
+ * there's a pool */
+int init_tracks(struct track **restrict tracks,
+                struct idset *restrict chosen,
+                const char *restrict export_chosen_str,
+                const char *restrict export_sourced_str,
+                struct pool *restrict pool,
+                struct arena *restrict arena);
+/* fills in the filenames of tracks from the roster and drops the ones it
+ * doesn't have; filenames, with file_ext already appended, are allocated
+ * from the arena. if on_track isn't NULL it is called with arg as soon as
+ * each track's filename is found, while the rest of the roster is unread.
+ * otherwise, a roster that is already all in the buffer (e.g. a mapped
+ * file) is split into chunks that are parsed on the pool, if there is one */
+int get_all_tracks(struct track *restrict tracks,
+                   const struct idset *restrict chosen,
+                   const char *restrict file_ext,
+                   void (*on_track)(const struct track *track,
+                                    void *arg),
+                   void *arg,
+                   struct pool *restrict pool,
+                   struct arena *restrict arena,
+                   struct json_buf *restrict jb);
+/* parses the url, ext and every track in the roster, in chunks on the pool
+ * like get_all_tracks; roster must have been set up with roster_init, and
+ * whatever it held is replaced, reusing its buffers */
+struct roster;
+int get_roster(struct roster *restrict roster,
+               struct pool *restrict pool,
+               struct arena *restrict arena,
+               struct json_buf *restrict jb);
 
 #endif /* !JSON_PARSE_H */
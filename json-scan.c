@@ -0,0 +1,238 @@
+#include "json-scan.h"
+#include <string.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#endif
+
+#define BLOCK    64
+
+/* each implementation turns 64 bytes into bitmasks, bit i for str[i] */
+struct scan_impl {
+        const char *name;
+        /* mask of bytes equal to ch */
+        uint64_t (*find_block)(const char *str,
+                               char ch);
+        /* masks of '"' and '\' */
+        void (*str_block)(const char *str,
+                          uint64_t *quote,
+                          uint64_t *bslash);
+};
+static const struct scan_impl *impl;
+static pthread_once_t impl_once = PTHREAD_ONCE_INIT;
+static void impl_pick(void);
+
+/* works out which bytes are escaped by an odd-length run of backslashes
+ * without looking back past the block; 'carry' holds whether the first byte
+ * of the block is escaped and is set for the first byte of the next one */
+static uint64_t escaped_mask(uint64_t bslash,
+                             uint64_t *carry);
+
+static uint64_t scalar_find_block(const char *str,
+                                  char ch);
+static void scalar_str_block(const char *str,
+                             uint64_t *quote,
+                             uint64_t *bslash);
+static const struct scan_impl scalar_impl = {
+        .name = "scalar",
+        .find_block = scalar_find_block,
+        .str_block = scalar_str_block
+};
+#ifdef HAVE_X86_SIMD
+static uint64_t sse2_find_block(const char *str,
+                                char ch);
+static void sse2_str_block(const char *str,
+                           uint64_t *quote,
+                           uint64_t *bslash);
+static const struct scan_impl sse2_impl = {
+        .name = "sse2",
+        .find_block = sse2_find_block,
+        .str_block = sse2_str_block
+};
+static uint64_t avx2_find_block(const char *str,
+                                char ch);
+static void avx2_str_block(const char *str,
+                           uint64_t *quote,
+                           uint64_t *bslash);
+static const struct scan_impl avx2_impl = {
+        .name = "avx2",
+        .find_block = avx2_find_block,
+        .str_block = avx2_str_block
+};
+#endif
+
+size_t json_scan_find(const char *str,
+                      size_t len,
+                      int ch) {
+        pthread_once(&impl_once, impl_pick);
+        size_t i = 0;
+        for (; i + BLOCK <= len; i += BLOCK) {
+                uint64_t match = impl->find_block(str + i, ch);
+                if (match != 0) {
+                        return i + __builtin_ctzll(match);
+                }
+        }
+        /* the tail is short enough to do one byte at a time */
+        const char *found = memchr(str + i, ch, len - i);
+        return (found == NULL) ? len : (size_t)(found - str);
+}
+
+size_t json_scan_strend(const char *str,
+                        size_t len,
+                        uint64_t *carry,
+                        bool *has_esc) {
+        pthread_once(&impl_once, impl_pick);
+        size_t i = 0;
+        while (i < len) {
+                uint64_t quote, bslash;
+                size_t n = len - i;
+                if (n >= BLOCK) {
+                        impl->str_block(str + i, &quote, &bslash);
+                        n = BLOCK;
+                } else {
+                        /* pad the tail out to a full block; the padding
+                         * matches nothing */
+                        char tail[BLOCK] = {0};
+                        memcpy(tail, str + i, n);
+                        impl->str_block(tail, &quote, &bslash);
+                }
+
+                const uint64_t escaped = escaped_mask(bslash, carry);
+                quote &= ~escaped;
+                if (n < BLOCK) {
+                        /* the carry has to come from the byte after the
+                         * tail, not from the end of the padding */
+                        quote &= (UINT64_C(1) << n) - 1;
+                        *carry = (escaped >> n) & 1;
+                }
+                if (quote != 0) {
+                        const unsigned end = __builtin_ctzll(quote);
+                        const uint64_t before = (UINT64_C(1) << end) - 1;
+                        *has_esc |= ((bslash & before) != 0);
+                        *carry = 0;
+                        return i + end;
+                }
+                *has_esc |= (bslash != 0);
+                i += n;
+        }
+        return len;
+}
+
+const char *json_scan_impl(void) {
+        pthread_once(&impl_once, impl_pick);
+        return impl->name;
+}
+
+static void impl_pick(void) {
+        impl = &scalar_impl;
+#ifdef HAVE_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+                impl = &avx2_impl;
+        } else if (__builtin_cpu_supports("sse2")) {
+                impl = &sse2_impl;
+        }
+#endif
+}
+
+static uint64_t escaped_mask(uint64_t bslash,
+                             uint64_t *carry) {
+        const uint64_t even_bits = UINT64_C(0x5555555555555555);
+        /* a backslash that is itself escaped doesn't start a run */
+        bslash &= ~*carry;
+        const uint64_t follows_escape = (bslash << 1) | *carry;
+        /* runs starting on odd bits; adding them to the backslashes carries
+         * each run's start bit to the byte just past the run */
+        const uint64_t odd_starts = bslash & ~even_bits & ~follows_escape;
+        uint64_t even_starts;
+        *carry = __builtin_add_overflow(odd_starts, bslash, &even_starts);
+        /* a run ending on an odd/even bit escapes the next byte depending
+         * on where it started */
+        const uint64_t invert = even_starts << 1;
+        return (even_bits ^ invert) & follows_escape;
+}
+
+static uint64_t scalar_find_block(const char *str,
+                                  char ch) {
+        uint64_t match = 0;
+        for (int i = 0; i < BLOCK; i++) {
+                match |= (uint64_t)(str[i] == ch) << i;
+        }
+        return match;
+}
+
+static void scalar_str_block(const char *str,
+                             uint64_t *quote,
+                             uint64_t *bslash) {
+        *quote = 0;
+        *bslash = 0;
+        for (int i = 0; i < BLOCK; i++) {
+                *quote |= (uint64_t)(str[i] == '"') << i;
+                *bslash |= (uint64_t)(str[i] == '\\') << i;
+        }
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2")))
+static uint64_t sse2_find_block(const char *str,
+                                char ch) {
+        const __m128i target = _mm_set1_epi8(ch);
+        uint64_t match = 0;
+        for (int i = 0; i < BLOCK; i += 16) {
+                __m128i v = _mm_loadu_si128((const __m128i *)(str + i));
+                uint64_t m = (uint16_t)_mm_movemask_epi8(
+                                _mm_cmpeq_epi8(v, target));
+                match |= m << i;
+        }
+        return match;
+}
+
+__attribute__((target("sse2")))
+static void sse2_str_block(const char *str,
+                           uint64_t *quote,
+                           uint64_t *bslash) {
+        const __m128i q = _mm_set1_epi8('"');
+        const __m128i b = _mm_set1_epi8('\\');
+        *quote = 0;
+        *bslash = 0;
+        for (int i = 0; i < BLOCK; i += 16) {
+                __m128i v = _mm_loadu_si128((const __m128i *)(str + i));
+                uint64_t mq = (uint16_t)_mm_movemask_epi8(
+                                _mm_cmpeq_epi8(v, q));
+                uint64_t mb = (uint16_t)_mm_movemask_epi8(
+                                _mm_cmpeq_epi8(v, b));
+                *quote |= mq << i;
+                *bslash |= mb << i;
+        }
+}
+
+__attribute__((target("avx2")))
+static uint64_t avx2_find_block(const char *str,
+                                char ch) {
+        const __m256i target = _mm256_set1_epi8(ch);
+        __m256i lo = _mm256_loadu_si256((const __m256i *)str);
+        __m256i hi = _mm256_loadu_si256((const __m256i *)(str + 32));
+        uint64_t mlo = (uint32_t)_mm256_movemask_epi8(
+                        _mm256_cmpeq_epi8(lo, target));
+        uint64_t mhi = (uint32_t)_mm256_movemask_epi8(
+                        _mm256_cmpeq_epi8(hi, target));
+        return mlo | (mhi << 32);
+}
+
+__attribute__((target("avx2")))
+static void avx2_str_block(const char *str,
+                           uint64_t *quote,
+                           uint64_t *bslash) {
+        const __m256i q = _mm256_set1_epi8('"');
+        const __m256i b = _mm256_set1_epi8('\\');
+        __m256i lo = _mm256_loadu_si256((const __m256i *)str);
+        __m256i hi = _mm256_loadu_si256((const __m256i *)(str + 32));
+        *quote = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, q))
+                 | ((uint64_t)(uint32_t)_mm256_movemask_epi8(
+                                 _mm256_cmpeq_epi8(hi, q)) << 32);
+        *bslash = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, b))
+                  | ((uint64_t)(uint32_t)_mm256_movemask_epi8(
+                                  _mm256_cmpeq_epi8(hi, b)) << 32);
+}
+#endif
@@ -0,0 +1,26 @@
+#ifndef JSON_SCAN_H
+#define JSON_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* vectorized scanning of roster text 64 bytes at a time; the widest of
+ * AVX2/SSE2/scalar supported by the cpu is picked on first use */
+
+/* returns the offset of the first 'ch' in str, or len if there is none */
+size_t json_scan_find(const char *str,
+                      size_t len,
+                      int ch);
+/* returns the offset of the first unescaped '"' in str, or len if there is
+ * none; 'carry' is 1 if str[0] is escaped by a backslash from a previous
+ * call and is updated for the byte after str[len - 1]. 'has_esc' is set if a
+ * backslash was seen before the returned offset */
+size_t json_scan_strend(const char *str,
+                        size_t len,
+                        uint64_t *carry,
+                        bool *has_esc);
+/* name of the implementation in use */
+const char *json_scan_impl(void);
+
+#endif /* !JSON_SCAN_H */
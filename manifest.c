@@ -0,0 +1,260 @@
+#define _GNU_SOURCE
+#include "manifest.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define MANIFEST_MAGIC   "VIPMAN1\n"
+/* size of each getdents64 read; big reads mean fewer round trips to slow
+ * storage */
+#define DIRENT_BUF       (256 * 1024)
+
+/* the manifest file is this header followed by the slots and pool */
+struct manifest_header {
+        char magic[8];
+        struct manifest_stamp stamp;
+        uint32_t num_slots;
+        uint32_t num_names;
+        uint64_t pool_len;
+};
+/* what getdents64 fills its buffer with */
+struct linux_dirent64 {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[];
+};
+
+static int get_stamp(struct manifest_stamp *restrict stamp,
+                     const char *restrict dirpath);
+/* reads the manifest file; fails if it is missing or damaged */
+static int load(struct manifest *manifest);
+/* writes the manifest file as it is */
+static int write_out(const struct manifest *manifest);
+/* adds every name in the directory to set, in whatever order the filesystem
+ * returns them */
+static int scan_dir(struct nameset *restrict set,
+                    const char *restrict dirpath);
+
+int manifest_open(struct manifest *restrict manifest,
+                  const char *restrict path,
+                  const char *restrict dirpath) {
+        *manifest = (struct manifest){
+                .path = path,
+                .dirpath = dirpath,
+                .is_dirty = false,
+                .is_current = false,
+                .map = NULL
+        };
+        nameset_init(&manifest->names);
+
+        /* stamp before listing so changes made during the listing make
+         * the manifest stale next time */
+        struct manifest_stamp now;
+        if (get_stamp(&now, dirpath) < 0) {
+                return -1;
+        }
+        if (load(manifest) == 0) {
+                if (memcmp(&manifest->stamp, &now, sizeof(now)) == 0) {
+                        return 0;
+                }
+                manifest_close(manifest);
+                manifest->path = path;
+                manifest->dirpath = dirpath;
+        }
+
+        if (scan_dir(&manifest->names, dirpath) < 0) {
+                nameset_free(&manifest->names);
+                return -1;
+        }
+        manifest->stamp = now;
+        if (write_out(manifest) < 0) {
+                fprintf(stderr, "failed to write manifest %s\n", path);
+        }
+        return 1;
+}
+
+bool manifest_check(struct manifest *manifest) {
+        struct manifest_stamp now;
+        manifest->is_current = (get_stamp(&now, manifest->dirpath) == 0)
+                               && (memcmp(&now, &manifest->stamp,
+                                          sizeof(now)) == 0);
+        return manifest->is_current;
+}
+
+int manifest_add(struct manifest *restrict manifest,
+                 const char *restrict name) {
+        int ret = nameset_add(&manifest->names, name, strlen(name));
+        if (ret > 0) {
+                manifest->is_dirty = true;
+        }
+        return (ret < 0) ? -1 : 0;
+}
+
+int manifest_save(struct manifest *manifest) {
+        if (!manifest->is_dirty) {
+                return 0;
+        }
+        /* a change someone else made would be folded into the new stamp
+         * and never picked up, so in that case no stamp matches */
+        if (!manifest->is_current) {
+                memset(&manifest->stamp, 0, sizeof(manifest->stamp));
+        } else if (get_stamp(&manifest->stamp, manifest->dirpath) < 0) {
+                return -1;
+        }
+        if (write_out(manifest) < 0) {
+                return -1;
+        }
+        manifest->is_dirty = false;
+        return 0;
+}
+
+void manifest_close(struct manifest *manifest) {
+        nameset_free(&manifest->names);
+        if (manifest->map != NULL) {
+                munmap(manifest->map, manifest->maplen);
+        }
+        *manifest = (struct manifest){.map = NULL};
+}
+
+static int get_stamp(struct manifest_stamp *restrict stamp,
+                     const char *restrict dirpath) {
+        struct stat st;
+        if (stat(dirpath, &st) < 0) {
+                return -1;
+        }
+        /* zero everything so stamps can be compared with memcmp */
+        memset(stamp, 0, sizeof(*stamp));
+        stamp->dev = st.st_dev;
+        stamp->ino = st.st_ino;
+        stamp->mtime_sec = st.st_mtim.tv_sec;
+        stamp->mtime_nsec = st.st_mtim.tv_nsec;
+        stamp->ctime_sec = st.st_ctim.tv_sec;
+        stamp->ctime_nsec = st.st_ctim.tv_nsec;
+        return 0;
+}
+
+static int load(struct manifest *manifest) {
+        int fd = open(manifest->path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+                return -1;
+        }
+        struct stat st;
+        if ((fstat(fd, &st) < 0)
+            || ((size_t)st.st_size < sizeof(struct manifest_header))) {
+                close(fd);
+                return -1;
+        }
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+                return -1;
+        }
+
+        /* make sure the file is whole before trusting anything in it */
+        const struct manifest_header *hdr = map;
+        const size_t slotsz = (size_t)hdr->num_slots
+                              * sizeof(struct nameset_slot);
+        if ((memcmp(hdr->magic, MANIFEST_MAGIC, sizeof(hdr->magic)) != 0)
+            || (hdr->num_slots == 0)
+            || ((hdr->num_slots & (hdr->num_slots - 1)) != 0)
+            || (hdr->num_names >= hdr->num_slots)
+            || (sizeof(*hdr) + slotsz + hdr->pool_len != (size_t)st.st_size)
+            || ((hdr->pool_len > 0)
+                && (((const char *)map)[st.st_size - 1] != '\0'))) {
+                munmap(map, st.st_size);
+                return -1;
+        }
+        /* lookups rely on there being an empty slot to stop at, so the
+         * count in the header has to be the real one */
+        const struct nameset_slot *slots = (const void *)(hdr + 1);
+        uint32_t num_used = 0;
+        for (uint32_t i = 0; i < hdr->num_slots; i++) {
+                if (slots[i].off == NAMESET_EMPTY) {
+                        continue;
+                }
+                if (slots[i].off >= hdr->pool_len) {
+                        munmap(map, st.st_size);
+                        return -1;
+                }
+                num_used++;
+        }
+        if (num_used != hdr->num_names) {
+                munmap(map, st.st_size);
+                return -1;
+        }
+
+        manifest->map = map;
+        manifest->maplen = st.st_size;
+        manifest->stamp = hdr->stamp;
+        nameset_view(&manifest->names, slots, hdr->num_slots, hdr->num_names,
+                     (const char *)slots + slotsz, hdr->pool_len);
+        return 0;
+}
+
+static int write_out(const struct manifest *manifest) {
+        const struct nameset *names = &manifest->names;
+        struct manifest_header hdr = {
+                .magic = MANIFEST_MAGIC,
+                .stamp = manifest->stamp,
+                .num_slots = names->num_slots,
+                .num_names = names->num_names,
+                .pool_len = names->pool_len
+        };
+
+        /* write next to the old manifest and swap it in, so a reader never
+         * sees half of one */
+        size_t pathlen = strlen(manifest->path);
+        char *tmppath = malloc(pathlen + sizeof(".tmp"));
+        memcpy(tmppath, manifest->path, pathlen);
+        memcpy(tmppath + pathlen, ".tmp", sizeof(".tmp"));
+        FILE *fp = fopen(tmppath, "wb");
+        if (fp == NULL) {
+                free(tmppath);
+                return -1;
+        }
+        fwrite(&hdr, sizeof(hdr), 1, fp);
+        fwrite(names->slots, sizeof(*names->slots), names->num_slots, fp);
+        fwrite(names->pool, sizeof(*names->pool), names->pool_len, fp);
+        int err_code = 0;
+        if ((fclose(fp) != 0) || (rename(tmppath, manifest->path) < 0)) {
+                unlink(tmppath);
+                err_code = -1;
+        }
+        free(tmppath);
+        return err_code;
+}
+
+static int scan_dir(struct nameset *restrict set,
+                    const char *restrict dirpath) {
+        int fd = open(dirpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+                return -1;
+        }
+        char *buf = malloc(DIRENT_BUF);
+        long nread;
+        while (nread = syscall(SYS_getdents64, fd, buf, DIRENT_BUF),
+               nread > 0) {
+                for (long off = 0; off < nread; ) {
+                        struct linux_dirent64 *ent = (void *)(buf + off);
+                        if (nameset_add(set, ent->d_name,
+                                        strlen(ent->d_name)) < 0) {
+                                nread = -1;
+                                break;
+                        }
+                        off += ent->d_reclen;
+                }
+                if (nread < 0) {
+                        break;
+                }
+        }
+        free(buf);
+        close(fd);
+        return (nread < 0) ? -1 : 0;
+}
@@ -0,0 +1,56 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include "nameset.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/* on-disk record of the names in the music directory, so huge or remote
+ * directories only have to be listed again when they have changed */
+
+/* identifies a particular state of the directory */
+struct manifest_stamp {
+        uint64_t dev;
+        uint64_t ino;
+        int64_t mtime_sec;
+        int64_t mtime_nsec;
+        int64_t ctime_sec;
+        int64_t ctime_nsec;
+};
+struct manifest {
+        const char *path;         // manifest file
+        const char *dirpath;      // directory it describes
+        struct manifest_stamp stamp;
+        struct nameset names;
+        bool is_dirty;            // names changed since loading or saving
+        bool is_current;          // the directory was still as stamped at
+                                  // the last manifest_check
+        void *map;                // manifest file, if loaded from one
+        size_t maplen;
+};
+/* loads the manifest at path, listing dirpath again only if it changed since
+ * the manifest was written; a rescanned manifest is saved right away.
+ * returns 1 if the directory was rescanned, 0 if not, -1 on error */
+int manifest_open(struct manifest *restrict manifest,
+                  const char *restrict path,
+                  const char *restrict dirpath);
+/* checks that the directory hasn't changed since the manifest was stamped;
+ * called right before the caller starts putting files in it, so that
+ * manifest_save knows those are the only changes. returns whether it is
+ * unchanged */
+bool manifest_check(struct manifest *manifest);
+/* records a file the caller has just put in the directory */
+int manifest_add(struct manifest *restrict manifest,
+                 const char *restrict name);
+/* writes the manifest back if anything was added. it's stamped with the
+ * directory's current state if manifest_check found nothing else had
+ * changed it; otherwise it's marked stale, so the directory is listed again
+ * next time */
+int manifest_save(struct manifest *manifest);
+void manifest_close(struct manifest *manifest);
+static inline bool manifest_has(const struct manifest *restrict manifest,
+                                const char *restrict name) {
+        return nameset_contains(&manifest->names, name);
+}
+
+#endif /* !MANIFEST_H */
@@ -0,0 +1,180 @@
+#include "nameset.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_SLOTS        1024
+
+/* finds the slot name is in, or the empty slot it would go in */
+static struct nameset_slot *find_slot(const struct nameset *restrict set,
+                                      const char *restrict name,
+                                      size_t len,
+                                      uint32_t hash);
+/* makes the table big enough for one more name, and owned so it can be
+ * written to */
+static int make_room(struct nameset *set);
+
+void nameset_init(struct nameset *set) {
+        *set = (struct nameset){.slots = NULL};
+}
+
+void nameset_view(struct nameset *restrict set,
+                  const struct nameset_slot *restrict slots,
+                  uint32_t num_slots,
+                  uint32_t num_names,
+                  const char *restrict pool,
+                  size_t pool_len) {
+        *set = (struct nameset){
+                .slots = (struct nameset_slot *)slots,
+                .num_slots = num_slots,
+                .num_names = num_names,
+                .pool = (char *)pool,
+                .pool_len = pool_len,
+                .pool_cap = 0
+        };
+}
+
+void nameset_free(struct nameset *set) {
+        if (set->pool_cap != 0) {
+                free(set->slots);
+                free(set->pool);
+        }
+        nameset_init(set);
+}
+
+void nameset_reset(struct nameset *set) {
+        if (set->pool_cap == 0) {
+                nameset_init(set);
+                return;
+        }
+        for (uint32_t i = 0; i < set->num_slots; i++) {
+                set->slots[i].off = NAMESET_EMPTY;
+        }
+        set->num_names = 0;
+        set->pool_len = 0;
+}
+
+int nameset_add(struct nameset *restrict set,
+                const char *restrict name,
+                size_t len) {
+        const uint32_t hash = nameset_hash(name, len);
+        if ((set->num_slots > 0)
+            && (find_slot(set, name, len, hash)->off != NAMESET_EMPTY)) {
+                return 0;
+        }
+        if (make_room(set) < 0) {
+                return -1;
+        }
+        /* make space in the pool if needed */
+        if (set->pool_len + len + 1 > set->pool_cap) {
+                size_t cap = set->pool_cap;
+                while (set->pool_len + len + 1 > cap) {
+                        cap <<= 1;
+                }
+                char *tmp = realloc(set->pool, cap * sizeof(*tmp));
+                if (tmp == NULL) {
+                        return -1;
+                }
+                set->pool = tmp;
+                set->pool_cap = cap;
+        }
+
+        struct nameset_slot *slot = find_slot(set, name, len, hash);
+        slot->hash = hash;
+        slot->off = set->pool_len;
+        memcpy(set->pool + set->pool_len, name, len);
+        set->pool[set->pool_len + len] = '\0';
+        set->pool_len += len + 1;
+        set->num_names++;
+        return 1;
+}
+
+bool nameset_contains(const struct nameset *restrict set,
+                      const char *restrict name) {
+        if (set->num_slots == 0) {
+                return false;
+        }
+        size_t len = strlen(name);
+        return (find_slot(set, name, len, nameset_hash(name, len))->off
+                != NAMESET_EMPTY);
+}
+
+uint32_t nameset_hash(const char *name,
+                      size_t len) {
+        /* FNV-1a; names are short enough that it doesn't matter much */
+        uint32_t hash = UINT32_C(2166136261);
+        for (size_t i = 0; i < len; i++) {
+                hash ^= (unsigned char)name[i];
+                hash *= UINT32_C(16777619);
+        }
+        return hash;
+}
+
+static struct nameset_slot *find_slot(const struct nameset *restrict set,
+                                      const char *restrict name,
+                                      size_t len,
+                                      uint32_t hash) {
+        const uint32_t mask = set->num_slots - 1;
+        for (uint32_t i = hash & mask; ; i = (i + 1) & mask) {
+                struct nameset_slot *slot = &set->slots[i];
+                if (slot->off == NAMESET_EMPTY) {
+                        return slot;
+                }
+                if ((slot->hash == hash)
+                    && (strncmp(set->pool + slot->off, name, len) == 0)
+                    && (set->pool[slot->off + len] == '\0')) {
+                        return slot;
+                }
+        }
+}
+
+static int make_room(struct nameset *set) {
+        /* keep the table at most 3/4 full */
+        uint32_t num_slots = (set->num_slots == 0) ? MIN_SLOTS
+                                                   : set->num_slots;
+        while ((set->num_names + 1) * 4 > num_slots * 3) {
+                num_slots <<= 1;
+        }
+        if ((num_slots == set->num_slots) && (set->pool_cap != 0)) {
+                return 0;
+        }
+
+        struct nameset_slot *slots = malloc(num_slots * sizeof(*slots));
+        if (slots == NULL) {
+                return -1;
+        }
+        for (uint32_t i = 0; i < num_slots; i++) {
+                slots[i].off = NAMESET_EMPTY;
+        }
+        /* rehash everything into the new table */
+        const uint32_t mask = num_slots - 1;
+        for (uint32_t i = 0; i < set->num_slots; i++) {
+                if (set->slots[i].off == NAMESET_EMPTY) {
+                        continue;
+                }
+                uint32_t j = set->slots[i].hash & mask;
+                while (slots[j].off != NAMESET_EMPTY) {
+                        j = (j + 1) & mask;
+                }
+                slots[j] = set->slots[i];
+        }
+
+        /* a viewed pool gets copied so it can grow */
+        if (set->pool_cap == 0) {
+                size_t cap = (set->pool_len < 4096) ? 4096 : set->pool_len;
+                char *pool = malloc(cap * sizeof(*pool));
+                if (pool == NULL) {
+                        free(slots);
+                        return -1;
+                }
+                if (set->pool_len > 0) {
+                        memcpy(pool, set->pool, set->pool_len);
+                }
+                set->pool = pool;
+                set->pool_cap = cap;
+        } else {
+                free(set->slots);
+        }
+        set->slots = slots;
+        set->num_slots = num_slots;
+        return 0;
+}
@@ -0,0 +1,48 @@
+#ifndef NAMESET_H
+#define NAMESET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* open-addressed hash set of filenames; the table and the string pool are
+ * flat arrays so they can be written to disk and mapped back as-is */
+
+/* offset of an empty slot */
+#define NAMESET_EMPTY    UINT32_MAX
+
+struct nameset_slot {
+        uint32_t hash;
+        uint32_t off;             // offset into pool, or NAMESET_EMPTY
+};
+struct nameset {
+        struct nameset_slot *slots;
+        uint32_t num_slots;       // always a power of 2
+        uint32_t num_names;
+        char *pool;               // null-terminated names
+        size_t pool_len;
+        size_t pool_cap;          // 0 if slots and pool aren't owned
+};
+void nameset_init(struct nameset *set);
+/* sets up a read-only view of a table that lives elsewhere, e.g. in a mapped
+ * file; it is copied the first time a name is added */
+void nameset_view(struct nameset *restrict set,
+                  const struct nameset_slot *restrict slots,
+                  uint32_t num_slots,
+                  uint32_t num_names,
+                  const char *restrict pool,
+                  size_t pool_len);
+void nameset_free(struct nameset *set);
+/* empties the set but keeps its table and pool for the next names */
+void nameset_reset(struct nameset *set);
+/* returns 1 if the name was added, 0 if it was already there, -1 if out of
+ * memory */
+int nameset_add(struct nameset *restrict set,
+                const char *restrict name,
+                size_t len);
+bool nameset_contains(const struct nameset *restrict set,
+                      const char *restrict name);
+uint32_t nameset_hash(const char *name,
+                      size_t len);
+
+#endif /* !NAMESET_H */
@@ -0,0 +1,130 @@
+#include "pool.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+/* takes the first task off the queue; the lock must be held */
+static struct pool_task *pool_pop(struct pool *pool);
+/* runs a task and marks it done; called without the lock held */
+static void pool_run(struct pool *restrict pool,
+                     struct pool_task *restrict task);
+static void *pool_worker(void *pool_ptr);
+
+void pool_init(struct pool *pool,
+               int num_threads) {
+        if (num_threads < 1) {
+                long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                num_threads = (num_cpus > 0) ? num_cpus : 1;
+        }
+        pthread_mutex_init(&pool->lock, NULL);
+        pthread_cond_init(&pool->has_work, NULL);
+        pthread_cond_init(&pool->has_done, NULL);
+        pool->head = NULL;
+        pool->tail = NULL;
+        pool->is_ending = false;
+        pool->num_threads = 0;
+        pool->thrds = malloc(num_threads * sizeof(*pool->thrds));
+        if (pool->thrds == NULL) {
+                return;
+        }
+        /* tasks still run, in whoever waits for them, if no thread can be
+         * started */
+        for (int i = 0; i < num_threads; i++) {
+                if (pthread_create(&pool->thrds[pool->num_threads], NULL,
+                                   pool_worker, pool) == 0) {
+                        pool->num_threads++;
+                }
+        }
+}
+
+void pool_submit(struct pool *restrict pool,
+                 struct pool_task *restrict task,
+                 void *(*fn)(void *),
+                 void *restrict arg) {
+        task->fn = fn;
+        task->arg = arg;
+        task->next = NULL;
+        task->is_done = false;
+        pthread_mutex_lock(&pool->lock);
+        if (pool->tail != NULL) {
+                pool->tail->next = task;
+        } else {
+                pool->head = task;
+        }
+        pool->tail = task;
+        pthread_cond_signal(&pool->has_work);
+        pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_wait(struct pool *restrict pool,
+               struct pool_task *restrict task) {
+        pthread_mutex_lock(&pool->lock);
+        while (!task->is_done) {
+                struct pool_task *next = pool_pop(pool);
+                if (next != NULL) {
+                        pthread_mutex_unlock(&pool->lock);
+                        pool_run(pool, next);
+                        pthread_mutex_lock(&pool->lock);
+                } else {
+                        pthread_cond_wait(&pool->has_done, &pool->lock);
+                }
+        }
+        pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_free(struct pool *pool) {
+        pthread_mutex_lock(&pool->lock);
+        pool->is_ending = true;
+        pthread_cond_broadcast(&pool->has_work);
+        pthread_mutex_unlock(&pool->lock);
+        for (int i = 0; i < pool->num_threads; i++) {
+                pthread_join(pool->thrds[i], NULL);
+        }
+        /* nothing is left to pick up tasks nobody waited for */
+        struct pool_task *task;
+        while ((task = pool_pop(pool)) != NULL) {
+                pool_run(pool, task);
+        }
+        free(pool->thrds);
+        pthread_cond_destroy(&pool->has_done);
+        pthread_cond_destroy(&pool->has_work);
+        pthread_mutex_destroy(&pool->lock);
+}
+
+static struct pool_task *pool_pop(struct pool *pool) {
+        struct pool_task *task = pool->head;
+        if (task != NULL) {
+                pool->head = task->next;
+                if (pool->head == NULL) {
+                        pool->tail = NULL;
+                }
+        }
+        return task;
+}
+
+static void pool_run(struct pool *restrict pool,
+                     struct pool_task *restrict task) {
+        task->fn(task->arg);
+        pthread_mutex_lock(&pool->lock);
+        task->is_done = true;
+        pthread_cond_broadcast(&pool->has_done);
+        pthread_mutex_unlock(&pool->lock);
+}
+
+static void *pool_worker(void *pool_ptr) {
+        struct pool *pool = pool_ptr;
+        pthread_mutex_lock(&pool->lock);
+        while (true) {
+                struct pool_task *task = pool_pop(pool);
+                if (task != NULL) {
+                        pthread_mutex_unlock(&pool->lock);
+                        pool_run(pool, task);
+                        pthread_mutex_lock(&pool->lock);
+                } else if (pool->is_ending) {
+                        break;
+                } else {
+                        pthread_cond_wait(&pool->has_work, &pool->lock);
+                }
+        }
+        pthread_mutex_unlock(&pool->lock);
+        return NULL;
+}
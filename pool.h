@@ -0,0 +1,42 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+
+/* fixed set of worker threads that run tasks in the order they're queued.
+ * a thread waiting for a task runs queued tasks itself in the meantime, so
+ * waiting never deadlocks, even with no workers at all */
+
+struct pool_task {
+        void *(*fn)(void *);      // called with arg; the result is ignored
+        void *arg;
+        struct pool_task *next;   // next in the queue
+        bool is_done;
+};
+struct pool {
+        pthread_t *thrds;
+        int num_threads;          // workers actually started
+        pthread_mutex_t lock;
+        pthread_cond_t has_work;  // a task was queued, or the pool is ending
+        pthread_cond_t has_done;  // a task finished
+        struct pool_task *head;   // queue of tasks not yet started
+        struct pool_task *tail;
+        bool is_ending;
+};
+/* starts num_threads workers, or one per online cpu if num_threads < 1 */
+void pool_init(struct pool *pool,
+               int num_threads);
+/* queues fn(arg); task is caller-owned and must live until pool_wait
+ * returns for it */
+void pool_submit(struct pool *restrict pool,
+                 struct pool_task *restrict task,
+                 void *(*fn)(void *),
+                 void *restrict arg);
+/* returns once task has run */
+void pool_wait(struct pool *restrict pool,
+               struct pool_task *restrict task);
+/* runs whatever is still queued, then stops the workers */
+void pool_free(struct pool *pool);
+
+#endif /* !POOL_H */
@@ -4,14 +4,28 @@ TARGET_DIR=$1
 CHOSEN_EXPORT=$2
 SOURCE_EXPORT=$3
 
-VIPURL='https://www.vipvgm.net/'
+VIPURL=${VIPURL:-'https://www.vipvgm.net/'}
 VIP='roster.min.json'
+# the roster is asked for gzipped and passed on as it is; vip-pull inflates
+# it while parsing, so only the compressed bytes go through the pipe
+GZIP_HEADER='Accept-Encoding: gzip'
 
-for URL in $(curl --silent "$VIPURL$VIP" \
-             | ./vip-pull $TARGET_DIR "$CHOSEN_EXPORT" "$SOURCE_EXPORT")
+# with VIP_JOBS set, vip-pull downloads the tracks itself, VIP_JOBS at a time
+if [ -n "$VIP_JOBS" ]; then
+        curl --silent -H "$GZIP_HEADER" "$VIPURL$VIP" \
+        | ./vip-pull -d -j "$VIP_JOBS" "$TARGET_DIR" \
+                     "$CHOSEN_EXPORT" "$SOURCE_EXPORT"
+        exit
+fi
+
+# urls are printed as soon as they're found, so downloads start while the
+# roster is still being fetched
+curl --silent -H "$GZIP_HEADER" "$VIPURL$VIP" \
+| ./vip-pull -s "$TARGET_DIR" "$CHOSEN_EXPORT" "$SOURCE_EXPORT" \
+| while IFS= read -r URL
 do
         echo
         echo "downloading: $URL"
-        curl --output-dir "$TARGET_DIR" -O "$URL"
+        curl --output-dir "$TARGET_DIR" -O "$URL" < /dev/null
 done
 echo
@@ -0,0 +1,414 @@
+#include "roster.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define INDEX_MAGIC      "VIPIDX1\n"
+
+/* the index file is this header followed by the entries and strtab */
+struct index_header {
+        char magic[8];
+        uint64_t roster_hash;
+        uint64_t roster_len;
+        uint32_t num_entries;
+        uint32_t url;
+        uint32_t ext;
+        uint32_t strtab_len;
+};
+
+/* orders entries by id, then by where they were in the roster */
+static int entrycmp(const void *a, const void *b);
+/* offset of the first string the entry added; strings are stored in the
+ * order the entries are added, so this is its place in the roster */
+static uint32_t entry_order(const struct roster_entry *entry);
+static int idcmp(const void *a, const void *b);
+/* prints a labelled, comma-separated list of ids */
+static void print_ids(FILE *restrict out,
+                      const char *restrict label,
+                      const int *restrict ids,
+                      int num_ids);
+
+void roster_init(struct roster *roster) {
+        *roster = (struct roster){.entries = NULL};
+}
+
+void roster_free(struct roster *roster) {
+        if (roster->map != NULL) {
+                munmap(roster->map, roster->maplen);
+        }
+        free(roster->entries_buf);
+        free(roster->strtab_buf);
+        roster_init(roster);
+}
+
+void roster_reset(struct roster *roster) {
+        if (roster->map != NULL) {
+                munmap(roster->map, roster->maplen);
+        }
+        *roster = (struct roster){
+                .entries_buf = roster->entries_buf,
+                .max_entries = roster->max_entries,
+                .strtab_buf = roster->strtab_buf,
+                .strtab_cap = roster->strtab_cap
+        };
+}
+
+/* 64-bit xxHash */
+#define PRIME1   UINT64_C(0x9E3779B185EBCA87)
+#define PRIME2   UINT64_C(0xC2B2AE3D27D4EB4F)
+#define PRIME3   UINT64_C(0x165667B19E3779F9)
+#define PRIME4   UINT64_C(0x85EBCA77C2B2AE63)
+#define PRIME5   UINT64_C(0x27D4EB2F165667C5)
+static inline uint64_t rotl64(uint64_t x, int r) {
+        return (x << r) | (x >> (64 - r));
+}
+static inline uint64_t read64(const unsigned char *p) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+}
+static inline uint64_t hash_round(uint64_t acc, uint64_t input) {
+        return rotl64(acc + input * PRIME2, 31) * PRIME1;
+}
+static inline uint64_t hash_merge(uint64_t acc, uint64_t val) {
+        return (acc ^ hash_round(0, val)) * PRIME1 + PRIME4;
+}
+
+uint64_t roster_hash(const void *data,
+                     size_t len) {
+        const unsigned char *p = data;
+        const unsigned char *const end = p + len;
+        uint64_t h;
+        if (len >= 32) {
+                /* four independent lanes so the multiplies overlap */
+                uint64_t v1 = PRIME1 + PRIME2;
+                uint64_t v2 = PRIME2;
+                uint64_t v3 = 0;
+                uint64_t v4 = -PRIME1;
+                for (; p + 32 <= end; p += 32) {
+                        v1 = hash_round(v1, read64(p));
+                        v2 = hash_round(v2, read64(p + 8));
+                        v3 = hash_round(v3, read64(p + 16));
+                        v4 = hash_round(v4, read64(p + 24));
+                }
+                h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12)
+                    + rotl64(v4, 18);
+                h = hash_merge(h, v1);
+                h = hash_merge(h, v2);
+                h = hash_merge(h, v3);
+                h = hash_merge(h, v4);
+        } else {
+                h = PRIME5;
+        }
+        h += len;
+        for (; p + 8 <= end; p += 8) {
+                h ^= hash_round(0, read64(p));
+                h = rotl64(h, 27) * PRIME1 + PRIME4;
+        }
+        if (p + 4 <= end) {
+                uint32_t v;
+                memcpy(&v, p, sizeof(v));
+                h ^= v * PRIME1;
+                h = rotl64(h, 23) * PRIME2 + PRIME3;
+                p += 4;
+        }
+        for (; p < end; p++) {
+                h ^= *p * PRIME5;
+                h = rotl64(h, 11) * PRIME1;
+        }
+        h ^= h >> 33;
+        h *= PRIME2;
+        h ^= h >> 29;
+        h *= PRIME3;
+        h ^= h >> 32;
+        return h;
+}
+
+char *roster_stralloc(struct roster *restrict roster,
+                      size_t size,
+                      uint32_t *restrict off) {
+        /* make space if needed */
+        if (roster->strtab_len + size > roster->strtab_cap) {
+                size_t cap = (roster->strtab_cap == 0) ? 4096
+                                                       : roster->strtab_cap;
+                while (roster->strtab_len + size > cap) {
+                        cap <<= 1;
+                }
+                roster->strtab_buf = realloc(roster->strtab_buf,
+                                             cap * sizeof(*roster->strtab_buf));
+                roster->strtab_cap = cap;
+        }
+        *off = roster->strtab_len;
+        roster->strtab_len += size;
+        return roster->strtab_buf + *off;
+}
+
+void roster_add(struct roster *roster,
+                int id,
+                uint32_t file,
+                uint32_t s_file) {
+        /* make space if needed */
+        if (roster->num_entries >= roster->max_entries) {
+                roster->max_entries = (roster->max_entries == 0)
+                                      ? 1024 : roster->max_entries << 1;
+                roster->entries_buf = realloc(roster->entries_buf,
+                                              roster->max_entries
+                                              * sizeof(*roster->entries_buf));
+        }
+        roster->entries_buf[roster->num_entries] = (struct roster_entry){
+                .id = id,
+                .file = file,
+                .s_file = s_file
+        };
+        roster->num_entries++;
+}
+
+void roster_finish(struct roster *roster,
+                   uint32_t url,
+                   uint32_t ext) {
+        qsort(roster->entries_buf, roster->num_entries,
+              sizeof(*roster->entries_buf), entrycmp);
+        /* if an id shows up twice, each filename comes from the first entry
+         * in the roster that has it, same as when parsing for the chosen
+         * tracks alone */
+        int num_uniq = 0;
+        for (int i = 0; i < roster->num_entries; i++) {
+                const struct roster_entry *e = &roster->entries_buf[i];
+                if ((num_uniq == 0)
+                    || (e->id != roster->entries_buf[num_uniq - 1].id)) {
+                        roster->entries_buf[num_uniq] = *e;
+                        num_uniq++;
+                        continue;
+                }
+                struct roster_entry *uniq = &roster->entries_buf[num_uniq - 1];
+                if (uniq->file == ROSTER_NONE) {
+                        uniq->file = e->file;
+                }
+                if (uniq->s_file == ROSTER_NONE) {
+                        uniq->s_file = e->s_file;
+                }
+        }
+        roster->num_entries = num_uniq;
+        roster->entries = roster->entries_buf;
+        roster->strtab = roster->strtab_buf;
+        roster->url = roster->strtab + url;
+        roster->ext = roster->strtab + ext;
+}
+
+int roster_save(const struct roster *restrict roster,
+                const char *restrict path) {
+        struct index_header hdr = {
+                .magic = INDEX_MAGIC,
+                .roster_hash = roster->hash,
+                .roster_len = roster->len,
+                .num_entries = roster->num_entries,
+                .url = roster->url - roster->strtab,
+                .ext = roster->ext - roster->strtab,
+                .strtab_len = roster->strtab_len
+        };
+
+        /* write next to the old index and swap it in, so a reader never
+         * sees half of one */
+        size_t pathlen = strlen(path);
+        char *tmppath = malloc(pathlen + sizeof(".tmp"));
+        memcpy(tmppath, path, pathlen);
+        memcpy(tmppath + pathlen, ".tmp", sizeof(".tmp"));
+        FILE *fp = fopen(tmppath, "wb");
+        if (fp == NULL) {
+                free(tmppath);
+                return -1;
+        }
+        fwrite(&hdr, sizeof(hdr), 1, fp);
+        fwrite(roster->entries, sizeof(*roster->entries),
+               roster->num_entries, fp);
+        fwrite(roster->strtab, sizeof(*roster->strtab), roster->strtab_len,
+               fp);
+        int err_code = 0;
+        if ((fclose(fp) != 0) || (rename(tmppath, path) < 0)) {
+                unlink(tmppath);
+                err_code = -1;
+        }
+        free(tmppath);
+        return err_code;
+}
+
+int roster_load(struct roster *restrict roster,
+                const char *restrict path) {
+        roster_init(roster);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+                return -1;
+        }
+        struct stat st;
+        if ((fstat(fd, &st) < 0)
+            || ((size_t)st.st_size < sizeof(struct index_header))) {
+                close(fd);
+                return -1;
+        }
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+                return -1;
+        }
+        roster->map = map;
+        roster->maplen = st.st_size;
+
+        /* make sure the file is whole before trusting any offsets in it */
+        const struct index_header *hdr = map;
+        const size_t entsz = hdr->num_entries * sizeof(*roster->entries);
+        if ((memcmp(hdr->magic, INDEX_MAGIC, sizeof(hdr->magic)) != 0)
+            || (sizeof(*hdr) + entsz + hdr->strtab_len
+                != (size_t)st.st_size)
+            || (hdr->strtab_len == 0)
+            || (hdr->url >= hdr->strtab_len)
+            || (hdr->ext >= hdr->strtab_len)) {
+                roster_free(roster);
+                return -1;
+        }
+        roster->entries = (const void *)(hdr + 1);
+        roster->num_entries = hdr->num_entries;
+        roster->strtab = (const char *)roster->entries + entsz;
+        roster->strtab_len = hdr->strtab_len;
+        if (roster->strtab[roster->strtab_len - 1] != '\0') {
+                roster_free(roster);
+                return -1;
+        }
+        for (int i = 0; i < roster->num_entries; i++) {
+                const struct roster_entry *e = &roster->entries[i];
+                if (((e->file != ROSTER_NONE)
+                     && (e->file >= roster->strtab_len))
+                    || ((e->s_file != ROSTER_NONE)
+                        && (e->s_file >= roster->strtab_len))) {
+                        roster_free(roster);
+                        return -1;
+                }
+        }
+        roster->url = roster->strtab + hdr->url;
+        roster->ext = roster->strtab + hdr->ext;
+        roster->hash = hdr->roster_hash;
+        roster->len = hdr->roster_len;
+        return 0;
+}
+
+const struct roster_entry *roster_find(const struct roster *roster,
+                                       int id) {
+        const struct roster_entry key = {.id = id};
+        return bsearch(&key, roster->entries, roster->num_entries,
+                       sizeof(*roster->entries), idcmp);
+}
+
+int roster_diff(const struct roster *restrict old_roster,
+                const struct roster *restrict new_roster,
+                FILE *restrict out) {
+        int *added = malloc(new_roster->num_entries * sizeof(*added));
+        int *removed = malloc(old_roster->num_entries * sizeof(*removed));
+        int num_added = 0;
+        int num_removed = 0;
+        /* both are sorted, so walk them side by side */
+        int i = 0;
+        int j = 0;
+        while ((i < old_roster->num_entries) || (j < new_roster->num_entries)) {
+                if ((j == new_roster->num_entries)
+                    || ((i < old_roster->num_entries)
+                        && (old_roster->entries[i].id
+                            < new_roster->entries[j].id))) {
+                        removed[num_removed++] = old_roster->entries[i++].id;
+                } else if ((i == old_roster->num_entries)
+                           || (new_roster->entries[j].id
+                               < old_roster->entries[i].id)) {
+                        added[num_added++] = new_roster->entries[j++].id;
+                } else {
+                        i++;
+                        j++;
+                }
+        }
+        fprintf(out, "roster changed: %d ids added, %d removed\n",
+                num_added, num_removed);
+        print_ids(out, "added", added, num_added);
+        print_ids(out, "removed", removed, num_removed);
+        free(added);
+        free(removed);
+        return num_added + num_removed;
+}
+
+int roster_get_tracks(struct track *restrict tracks,
+                      int num_tracks,
+                      const struct roster *restrict roster,
+                      struct arena *restrict arena) {
+        const size_t extlen = strlen(roster->ext);
+        int real_num_tracks = 0;
+        for (int i = 0; i < num_tracks; i++) {
+                const struct roster_entry *e = roster_find(roster,
+                                                           tracks[i].id);
+                if (e == NULL) {
+                        continue;
+                }
+                uint32_t off = tracks[i].is_sourced ? e->s_file : e->file;
+                if (off == ROSTER_NONE) {
+                        continue;
+                }
+                /* copy the filename with the extension on the end */
+                const char *name = roster->strtab + off;
+                size_t namelen = strlen(name);
+                char *filename = arena_alloc(arena, namelen + extlen + 2);
+                memcpy(filename, name, namelen);
+                filename[namelen] = '.';
+                memcpy(filename + namelen + 1, roster->ext, extlen + 1);
+
+                tracks[real_num_tracks] = tracks[i];
+                tracks[real_num_tracks].filename = filename;
+                real_num_tracks++;
+        }
+        return real_num_tracks;
+}
+
+static int entrycmp(const void *a, const void *b) {
+        const struct roster_entry *av = a;
+        const struct roster_entry *bv = b;
+        if (av->id > bv->id) {
+                return 1;
+        } else if (av->id < bv->id) {
+                return -1;
+        } else if (entry_order(av) > entry_order(bv)) {
+                return 1;
+        } else if (entry_order(av) < entry_order(bv)) {
+                return -1;
+        } else {
+                return 0;
+        }
+}
+
+static uint32_t entry_order(const struct roster_entry *entry) {
+        /* the file is stored before the s_file; an entry with neither has
+         * nothing to give, so it can go last */
+        return (entry->file != ROSTER_NONE) ? entry->file : entry->s_file;
+}
+
+static int idcmp(const void *a, const void *b) {
+        const struct roster_entry *av = a;
+        const struct roster_entry *bv = b;
+        if (av->id > bv->id) {
+                return 1;
+        } else if (av->id < bv->id) {
+                return -1;
+        } else {
+                return 0;
+        }
+}
+
+static void print_ids(FILE *restrict out,
+                      const char *restrict label,
+                      const int *restrict ids,
+                      int num_ids) {
+        if (num_ids == 0) {
+                return;
+        }
+        fprintf(out, "%s ids:", label);
+        for (int i = 0; i < num_ids; i++) {
+                fprintf(out, "%s%d", (i == 0) ? " " : ",", ids[i]);
+        }
+        fputc('\n', out);
+}
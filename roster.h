@@ -0,0 +1,86 @@
+#ifndef ROSTER_H
+#define ROSTER_H
+
+#include "json-parse.h"
+#include "arena.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* the parts of the roster vip-pull uses, in a form that can be written to
+ * and mapped back from a binary index file; strings are unescaped and
+ * null-terminated in strtab */
+
+/* where the source versions of tracks are, relative to the roster's url */
+#define VIP_SRC_DIR      "source/"
+/* string offset of a missing field */
+#define ROSTER_NONE      UINT32_MAX
+
+struct roster_entry {
+        int32_t id;
+        uint32_t file;            // offset into strtab, or ROSTER_NONE
+        uint32_t s_file;          // offset into strtab, or ROSTER_NONE
+};
+struct roster {
+        const char *url;
+        const char *ext;
+        const struct roster_entry *entries; // sorted by id, no duplicates
+        int num_entries;
+        const char *strtab;
+        uint64_t hash;            // roster_hash of the roster json
+        uint64_t len;             // length of the roster json
+
+        /* storage; only one of map or the buffers is used */
+        void *map;                // index file, if loaded from one
+        size_t maplen;
+        struct roster_entry *entries_buf;
+        int max_entries;
+        char *strtab_buf;
+        size_t strtab_len;
+        size_t strtab_cap;
+};
+void roster_init(struct roster *roster);
+void roster_free(struct roster *roster);
+/* empties the roster but keeps its buffers for the next one built in it */
+void roster_reset(struct roster *roster);
+/* hashes the roster json */
+uint64_t roster_hash(const void *data,
+                     size_t len);
+
+/* building; strings are stored by reserving size bytes with roster_stralloc
+ * and writing a null-terminated string of at most size - 1 characters to the
+ * returned pointer, which stays valid until the next roster_stralloc */
+char *roster_stralloc(struct roster *restrict roster,
+                      size_t size,
+                      uint32_t *restrict off);
+void roster_add(struct roster *roster,
+                int id,
+                uint32_t file,
+                uint32_t s_file);
+/* sorts the entries and sets up the pointers; url and ext are strtab
+ * offsets */
+void roster_finish(struct roster *roster,
+                   uint32_t url,
+                   uint32_t ext);
+
+/* the index file */
+int roster_save(const struct roster *restrict roster,
+                const char *restrict path);
+int roster_load(struct roster *restrict roster,
+                const char *restrict path);
+
+const struct roster_entry *roster_find(const struct roster *roster,
+                                       int id);
+/* prints the ids added to and removed from old_roster in new_roster;
+ * returns the number of ids that differ */
+int roster_diff(const struct roster *restrict old_roster,
+                const struct roster *restrict new_roster,
+                FILE *restrict out);
+/* fills in the filenames, with the extension appended, of the tracks from
+ * init_tracks; works like get_all_tracks */
+int roster_get_tracks(struct track *restrict tracks,
+                      int num_tracks,
+                      const struct roster *restrict roster,
+                      struct arena *restrict arena);
+
+#endif /* !ROSTER_H */
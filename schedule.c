@@ -0,0 +1,95 @@
+#include "schedule.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* policy names, in enum schedule_policy order */
+static const char *const policy_names[] = {"small", "large", "id"};
+
+/* order items by weight, keeping items of the same weight in the order they
+ * were given */
+static int smallcmp(const void *a, const void *b);
+static int largecmp(const void *a, const void *b);
+
+int schedule_parse(enum schedule_policy *restrict policy,
+                   const char *restrict name) {
+        const int num_policies = sizeof(policy_names) / sizeof(*policy_names);
+        for (int i = 0; i < num_policies; i++) {
+                if (strcmp(name, policy_names[i]) == 0) {
+                        *policy = i;
+                        return 0;
+                }
+        }
+        return -1;
+}
+
+long long schedule_plan(struct schedule_item *restrict items,
+                        int num_items,
+                        long long *restrict lane_bytes,
+                        int num_lanes,
+                        enum schedule_policy policy) {
+        long long known_bytes = 0;
+        int num_known = 0;
+        for (int i = 0; i < num_items; i++) {
+                if (items[i].size >= 0) {
+                        known_bytes += items[i].size;
+                        num_known++;
+                }
+        }
+        const long long guess = (num_known > 0) ? known_bytes / num_known : 0;
+        for (int i = 0; i < num_items; i++) {
+                items[i].weight = (items[i].size >= 0) ? items[i].size
+                                                       : guess;
+        }
+
+        if (policy == SCHEDULE_SMALL) {
+                qsort(items, num_items, sizeof(*items), smallcmp);
+        } else if (policy == SCHEDULE_LARGE) {
+                qsort(items, num_items, sizeof(*items), largecmp);
+        }
+
+        /* there are only as many lanes as downloads at once, so a scan
+         * finds the emptiest one quickly enough */
+        for (int i = 0; i < num_lanes; i++) {
+                lane_bytes[i] = 0;
+        }
+        /* ties go to the lane after the last one used, so files of the
+         * same size (or of no known size) are dealt round */
+        int lane = num_lanes - 1;
+        for (int i = 0; i < num_items; i++) {
+                const int start = (lane + 1) % num_lanes;
+                lane = start;
+                for (int j = 1; j < num_lanes; j++) {
+                        const int next = (start + j) % num_lanes;
+                        if (lane_bytes[next] < lane_bytes[lane]) {
+                                lane = next;
+                        }
+                }
+                items[i].lane = lane;
+                lane_bytes[lane] += items[i].weight;
+        }
+        long long max_bytes = 0;
+        for (int i = 0; i < num_lanes; i++) {
+                if (lane_bytes[i] > max_bytes) {
+                        max_bytes = lane_bytes[i];
+                }
+        }
+        return max_bytes;
+}
+
+static int smallcmp(const void *a, const void *b) {
+        const struct schedule_item *av = a;
+        const struct schedule_item *bv = b;
+        if (av->weight != bv->weight) {
+                return (av->weight < bv->weight) ? -1 : 1;
+        }
+        return av->index - bv->index;
+}
+
+static int largecmp(const void *a, const void *b) {
+        const struct schedule_item *av = a;
+        const struct schedule_item *bv = b;
+        if (av->weight != bv->weight) {
+                return (av->weight > bv->weight) ? -1 : 1;
+        }
+        return av->index - bv->index;
+}
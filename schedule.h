@@ -0,0 +1,36 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+/* orders downloads so that a few large files don't hold up all the small
+ * ones behind them: in the order a policy picks, each file is dealt to
+ * whichever of a number of lanes (downloads running at once) has the fewest
+ * bytes so far. lanes are advisory: a downloader that starts each file as
+ * soon as any transfer finishes, like download_all, keeps to them only as
+ * long as every transfer gets the same share of the bandwidth */
+
+enum schedule_policy {
+        SCHEDULE_SMALL = 0,       // smallest files first
+        SCHEDULE_LARGE,           // largest first, which evens out the lanes
+                                  // best
+        SCHEDULE_ID               // by id, as without a schedule
+};
+struct schedule_item {
+        int index;                // which download it is
+        long long size;           // its length, or -1 if unknown
+        long long weight;         // size, or a guess at it if unknown
+        int lane;                 // lane it's dealt to, from 0
+};
+/* looks up a policy by its name; returns -1 if there's no such policy */
+int schedule_parse(enum schedule_policy *restrict policy,
+                   const char *restrict name);
+/* puts the items in the order to start them in and deals them out to
+ * num_lanes lanes. files of unknown size are taken to be of the average
+ * size of the rest. lane_bytes gets the number of bytes in each lane; returns
+ * the most bytes in any one lane */
+long long schedule_plan(struct schedule_item *restrict items,
+                        int num_items,
+                        long long *restrict lane_bytes,
+                        int num_lanes,
+                        enum schedule_policy policy);
+
+#endif /* !SCHEDULE_H */
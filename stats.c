@@ -0,0 +1,95 @@
+#include "stats.h"
+#include <time.h>
+#include <sys/resource.h>
+
+static double timespec_sec(const struct timespec *ts);
+
+void stats_clock_now(struct stats_clock *clock) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        clock->wall = timespec_sec(&ts);
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        clock->cpu = timespec_sec(&ts);
+}
+
+void stats_start(struct stats *stats) {
+        *stats = (struct stats){.num_phases = 0};
+        stats_clock_now(&stats->start);
+        stats->mark = stats->start;
+}
+
+double stats_phase(struct stats *restrict stats,
+                   const char *restrict name) {
+        struct stats_clock now;
+        stats_clock_now(&now);
+        const double wall = now.wall - stats->mark.wall;
+        if (stats->num_phases < STATS_MAX_PHASES) {
+                stats->phases[stats->num_phases] = (struct stats_phase){
+                        .name = name,
+                        .wall = wall,
+                        .cpu = now.cpu - stats->mark.cpu
+                };
+                stats->num_phases++;
+        }
+        stats->mark = now;
+        return wall;
+}
+
+void stats_print(const struct stats *restrict stats,
+                 bool as_json,
+                 FILE *restrict fp) {
+        /* the whole process, including the directory thread */
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        const double user = usage.ru_utime.tv_sec
+                            + usage.ru_utime.tv_usec / 1e6;
+        const double sys = usage.ru_stime.tv_sec
+                           + usage.ru_stime.tv_usec / 1e6;
+        const double total = stats->mark.wall - stats->start.wall;
+
+        if (as_json) {
+                fputs("{\"phases\":[", fp);
+                for (int i = 0; i < stats->num_phases; i++) {
+                        fprintf(fp, "%s{\"name\":\"%s\",\"wall\":%.6f,"
+                                "\"cpu\":%.6f}", (i == 0) ? "" : ",",
+                                stats->phases[i].name, stats->phases[i].wall,
+                                stats->phases[i].cpu);
+                }
+                fprintf(fp, "],\"wall\":%.6f,\"user\":%.6f,\"sys\":%.6f,"
+                        "\"max_rss_kb\":%ld,\"dir_read\":{\"wall\":%.6f,"
+                        "\"cpu\":%.6f},\"join_wait\":%.6f,"
+                        "\"roster_bytes\":%zu,\"drained_bytes\":%zu,"
+                        "\"fields\":%zu,\"tracks\":%zu,\"allocs\":%zu,"
+                        "\"dir_entries\":%zu}\n", total, user, sys,
+                        usage.ru_maxrss, stats->dir_wall, stats->dir_cpu,
+                        stats->join_wait, stats->roster_bytes,
+                        stats->drained_bytes, stats->num_fields,
+                        stats->num_tracks, stats->num_allocs,
+                        stats->dir_entries);
+                return;
+        }
+
+        fprintf(fp, "%-12s %10s %10s\n", "phase", "wall (s)", "cpu (s)");
+        for (int i = 0; i < stats->num_phases; i++) {
+                fprintf(fp, "%-12s %10.6f %10.6f\n", stats->phases[i].name,
+                        stats->phases[i].wall, stats->phases[i].cpu);
+        }
+        fprintf(fp, "%-12s %10.6f %10.6f (own thread)\n", "dir_read",
+                stats->dir_wall, stats->dir_cpu);
+        fprintf(fp, "total        %10.6f %10.6f user, %.6f sys\n", total,
+                user, sys);
+        fprintf(fp, "waited on dir_read   %.6f s\n"
+                "roster consumed      %zu bytes (%zu more drained)\n"
+                "fields parsed        %zu\n"
+                "tracks parsed        %zu\n"
+                "arena allocations    %zu\n"
+                "directory entries    %zu\n"
+                "peak rss             %ld KB\n",
+                stats->join_wait, stats->roster_bytes, stats->drained_bytes,
+                stats->num_fields, stats->num_tracks, stats->num_allocs,
+                stats->dir_entries, usage.ru_maxrss);
+}
+
+static double timespec_sec(const struct timespec *ts) {
+        return ts->tv_sec + ts->tv_nsec / 1e9;
+}
@@ -0,0 +1,50 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* timing and counts for a run, reported on request so slow runs can be
+ * pinned on a particular phase */
+
+#define STATS_MAX_PHASES 16
+
+/* a point in time by the wall clock and by the calling thread's cpu time */
+struct stats_clock {
+        double wall;
+        double cpu;
+};
+struct stats_phase {
+        const char *name;
+        double wall;              // seconds
+        double cpu;               // seconds of the main thread's cpu time
+};
+struct stats {
+        struct stats_clock start; // start of the run
+        struct stats_clock mark;  // end of the last phase
+        struct stats_phase phases[STATS_MAX_PHASES];
+        int num_phases;
+        /* filled in by the caller */
+        size_t roster_bytes;      // roster consumed by the parse or index
+        size_t drained_bytes;     // roster thrown away after the parse
+        size_t num_fields;
+        size_t num_tracks;
+        size_t num_allocs;
+        size_t dir_entries;
+        double dir_wall;          // time dir_read took in its own thread
+        double dir_cpu;
+        double join_wait;         // time main spent waiting on dir_read
+};
+void stats_clock_now(struct stats_clock *clock);
+void stats_start(struct stats *stats);
+/* ends the current phase, which began at the end of the last one, and
+ * returns the wall time it took */
+double stats_phase(struct stats *restrict stats,
+                   const char *restrict name);
+/* prints a human-readable report, or a single line of JSON */
+void stats_print(const struct stats *restrict stats,
+                 bool as_json,
+                 FILE *restrict fp);
+
+#endif /* !STATS_H */
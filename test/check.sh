@@ -0,0 +1,500 @@
+#!/usr/bin/bash
+
+# runs vip-pull against test/server.py, a stand-in for the vip server that
+# serves a made-up roster and tracks from a temporary directory; make check
+
+cd "$(dirname "$0")/.." || exit 1
+VIP_PULL=./vip-pull
+WORK=$(mktemp -d)
+SRV="$WORK/srv"
+LOG="$WORK/log"
+FAILED=0
+
+pass() {
+        echo "ok: $1"
+}
+fail() {
+        echo "FAIL: $1"
+        FAILED=1
+}
+# pass if the command succeeds, fail if it doesn't
+check() {
+        local what=$1
+        shift
+        if "$@"; then
+                pass "$what"
+        else
+                fail "$what"
+        fi
+}
+# true if every chosen track in dir is the same as on the server
+same_tracks() {
+        local dir=$1
+        shift
+        for name in "$@"; do
+                cmp -s "$SRV/$name" "$dir/${name#source/}" || return 1
+        done
+}
+
+mkdir -p "$SRV/source"
+python3 test/server.py "$SRV" "$LOG" "$WORK/port" &
+SERVER_PID=$!
+trap 'kill $SERVER_PID 2>/dev/null; rm -rf "$WORK"' EXIT
+for _ in $(seq 50); do
+        [ -f "$WORK/port" ] && break
+        sleep 0.1
+done
+if [ ! -f "$WORK/port" ]; then
+        echo "FAIL: the stand-in server didn't start"
+        exit 1
+fi
+URL="http://127.0.0.1:$(cat "$WORK/port")/"
+
+# tracks 1 to 6, with 3 also having a source version; their sizes are far
+# apart so a schedule has something to balance
+SIZES=(0 40000 3000 20000 1000 9000 5000)
+{
+        printf '{"url":"%s","ext":"m4a","tracks":[' "$URL"
+        for i in 1 2 3 4 5 6; do
+                [ "$i" -gt 1 ] && printf ','
+                printf '{"id":%d,"title":"t","file":"Game %d - Track %d"' \
+                       "$i" "$i" "$i"
+                [ "$i" -eq 3 ] && printf ',"s_file":"Src %d"' "$i"
+                printf '}'
+        done
+        printf ']}'
+} > "$SRV/roster.json"
+for i in 1 2 3 4 5 6; do
+        head -c "${SIZES[$i]}" /dev/urandom > "$SRV/Game $i - Track $i.m4a"
+done
+head -c 15000 /dev/urandom > "$SRV/source/Src 3.m4a"
+CHOSEN=1,2,3,4,5,6
+SOURCED=3
+TRACKS=("Game 1 - Track 1.m4a" "Game 2 - Track 2.m4a" "source/Src 3.m4a"
+        "Game 4 - Track 4.m4a" "Game 5 - Track 5.m4a" "Game 6 - Track 6.m4a")
+
+# -d: everything missing is downloaded, and only progress goes to stderr
+mkdir "$WORK/d"
+$VIP_PULL -d -j 2 "$WORK/d" "$CHOSEN" "$SOURCED" < "$SRV/roster.json" \
+          > "$WORK/d.out" 2> "$WORK/d.err"
+check "-d downloads every missing track" same_tracks "$WORK/d" "${TRACKS[@]}"
+check "-d prints nothing on stdout" test ! -s "$WORK/d.out"
+check "-d leaves no partial files" \
+      test -z "$(find "$WORK/d" -name '*.part*')"
+: > "$LOG"
+$VIP_PULL -d "$WORK/d" "$CHOSEN" "$SOURCED" < "$SRV/roster.json" 2> /dev/null
+check "-d has nothing to do the second time" test ! -s "$LOG"
+
+# an interrupted download is kept and picked up again with a Range request
+mkdir "$WORK/r"
+R_TRACK="Game 1 - Track 1.m4a"
+curl -s "${URL}_cut?bytes=12345"
+$VIP_PULL -d "$WORK/r" 1 "" < "$SRV/roster.json" > /dev/null 2>&1
+check "an interrupted download is kept as a partial file" \
+      test "$(stat -c %s "$WORK/r/$R_TRACK.part" 2> /dev/null)" = 12345
+curl -s "${URL}_cut?bytes=0"
+$VIP_PULL "$WORK/r" 1 "" < "$SRV/roster.json" > "$WORK/r.out" \
+          2> "$WORK/r.err"
+check "a partial file is still listed as missing" \
+      grep -q "^$URL$R_TRACK$" "$WORK/r.out"
+check "a partial file is noted as resumable" \
+      grep -q "^resumable: $WORK/r/$R_TRACK from byte 12345$" "$WORK/r.err"
+: > "$LOG"
+$VIP_PULL -d "$WORK/r" 1 "" < "$SRV/roster.json" 2> "$WORK/r.err"
+check "the partial file is resumed where it stopped" \
+      grep -q "^resuming: $R_TRACK from byte 12345$" "$WORK/r.err"
+check "only the rest is asked for" grep -q ' GET .* 206$' "$LOG"
+check "the resumed download is whole" same_tracks "$WORK/r" "$R_TRACK"
+
+# a file that changed since it was cut off is downloaded again in full
+rm "$WORK/r/$R_TRACK"
+curl -s "${URL}_cut?bytes=12345"
+$VIP_PULL -d "$WORK/r" 1 "" < "$SRV/roster.json" > /dev/null 2>&1
+curl -s "${URL}_cut?bytes=0"
+head -c 30000 /dev/urandom > "$SRV/$R_TRACK"
+: > "$LOG"
+$VIP_PULL -d "$WORK/r" 1 "" < "$SRV/roster.json" > /dev/null 2>&1
+check "a changed file is sent whole instead of resumed" \
+      grep -q ' GET .* 200$' "$LOG"
+check "the changed file replaces the partial one" \
+      same_tracks "$WORK/r" "$R_TRACK"
+
+# -w fetches the roster once, then only hears that it hasn't changed, and
+# picks up ids added to the exports while it runs
+mkdir "$WORK/w"
+echo 2,5 > "$WORK/chosen"
+: > "$LOG"
+timeout -s TERM 4 $VIP_PULL -d -w "${URL}roster.json" --interval=1 \
+        "$WORK/w" "@$WORK/chosen" "" > /dev/null 2> "$WORK/w.err" &
+WATCH_PID=$!
+sleep 2
+echo 2,5,6 > "$WORK/chosen"
+wait $WATCH_PID
+check "-w gets the roster once" \
+      test "$(grep -c ' GET /roster.json 200$' "$LOG")" = 1
+check "-w gets a 304 for an unchanged roster" \
+      grep -q ' GET /roster.json 304$' "$LOG"
+check "-w downloads the chosen tracks" \
+      same_tracks "$WORK/w" "Game 2 - Track 2.m4a" "Game 5 - Track 5.m4a"
+check "-w downloads tracks added to the exports" \
+      same_tracks "$WORK/w" "Game 6 - Track 6.m4a"
+check "-w downloads each track once" \
+      test "$(grep -c ' GET /Game' "$LOG")" = 3
+# -w tries a failed download again on the next poll, and downloads a track
+# again once its file is deleted, though neither the roster nor the exports
+# changed
+mkdir "$WORK/w2"
+W2_TRACK="Game 2 - Track 2.m4a"
+curl -s "${URL}_cut?bytes=12345"
+: > "$LOG"
+timeout -s TERM 5 $VIP_PULL -d -w "${URL}roster.json" --interval=1 \
+        "$WORK/w2" 1,2 "" > /dev/null 2> "$WORK/w2.err" &
+WATCH_PID=$!
+sleep 2.5
+rm "$WORK/w2/$W2_TRACK"
+wait $WATCH_PID
+curl -s "${URL}_cut?bytes=0"
+check "-w resumes a failed download on the next poll" \
+      grep -q "^resuming: $R_TRACK from byte 12345$" "$WORK/w2.err"
+check "-w downloads a track again once its file is deleted" \
+      test "$(grep -c " GET /${W2_TRACK// /%20} 200$" "$LOG")" = 2
+check "-w ends up with both tracks" \
+      same_tracks "$WORK/w2" "$R_TRACK" "$W2_TRACK"
+# without -d, a url is printed once while its track is missing, and again
+# if its file comes and goes
+mkdir "$WORK/w3"
+timeout -s TERM 5 $VIP_PULL -w "${URL}roster.json" --interval=1 \
+        "$WORK/w3" 2 "" > "$WORK/w3.out" 2> /dev/null &
+WATCH_PID=$!
+sleep 1.5
+cp "$SRV/$W2_TRACK" "$WORK/w3"
+sleep 1.5
+rm "$WORK/w3/$W2_TRACK"
+wait $WATCH_PID
+check "-w prints a url again once its file comes and goes" \
+      test "$(grep -c "^$URL$W2_TRACK$" "$WORK/w3.out")" = 2
+
+# --schedule asks for every size over -j connections, then deals the tracks
+# out to the lane with the fewest bytes, in the order of the policy
+echo 50000 > "$SRV/Game 1 - Track 1.m4a.size"
+echo 3000 > "$SRV/Game 2 - Track 2.m4a.size"
+echo 15000 > "$SRV/source/Src 3.m4a.size"
+echo 1000000 > "$SRV/Game 4 - Track 4.m4a.size"
+echo 9000 > "$SRV/Game 5 - Track 5.m4a.size"
+echo 5000 > "$SRV/Game 6 - Track 6.m4a.size"
+mkdir "$WORK/s"
+: > "$LOG"
+$VIP_PULL -j 2 --schedule "$WORK/s" "$CHOSEN" "$SOURCED" \
+          < "$SRV/roster.json" > "$WORK/s.out" 2> "$WORK/s.err"
+printf "%s\t$URL%s\n" 1 "Game 2 - Track 2.m4a" 2 "Game 6 - Track 6.m4a" \
+       1 "Game 5 - Track 5.m4a" 2 "source/Src 3.m4a" \
+       1 "Game 1 - Track 1.m4a" 2 "Game 4 - Track 4.m4a" > "$WORK/s.want"
+check "--schedule puts the smallest first and balances the lanes" \
+      cmp -s "$WORK/s.out" "$WORK/s.want"
+check "--schedule sums up the lanes" \
+      grep -q "6 tracks of 1082000 bytes over 2 lanes, at most 1020000" \
+      "$WORK/s.err"
+check "--schedule asks for each size once" \
+      test "$(grep -c ' HEAD ' "$LOG")" = 6
+check "--schedule reuses -j connections" \
+      test "$(grep ' HEAD ' "$LOG" | cut -d ' ' -f 1 | sort -u | wc -l)" -le 2
+$VIP_PULL -j 2 --schedule=large "$WORK/s" "$CHOSEN" "$SOURCED" \
+          < "$SRV/roster.json" > "$WORK/s.out" 2> /dev/null
+printf "%s\t$URL%s\n" 1 "Game 4 - Track 4.m4a" 2 "Game 1 - Track 1.m4a" \
+       2 "source/Src 3.m4a" 2 "Game 5 - Track 5.m4a" \
+       2 "Game 6 - Track 6.m4a" 2 "Game 2 - Track 2.m4a" > "$WORK/s.want"
+check "--schedule=large puts the largest first" \
+      cmp -s "$WORK/s.out" "$WORK/s.want"
+$VIP_PULL -d -j 2 --schedule --limit-rate=1M "$WORK/s" "$CHOSEN" \
+          "$SOURCED" < "$SRV/roster.json" > /dev/null 2>&1
+check "-d --schedule --limit-rate downloads every track" \
+      same_tracks "$WORK/s" "${TRACKS[@]}"
+
+# libvippull finds the same missing tracks as vip-pull, and the same again
+# after a rewind, against a list of names and on loading the roster again
+mkdir "$WORK/l"
+cp "$SRV/Game 2 - Track 2.m4a" "$SRV/Game 5 - Track 5.m4a" "$WORK/l"
+$VIP_PULL -f aria2 "$WORK/l" "$CHOSEN" "$SOURCED" < "$SRV/roster.json" \
+          2> /dev/null | grep -v '^  ' > "$WORK/l.want"
+./test/vippull-check "$SRV/roster.json" "$WORK/l" "$CHOSEN" "$SOURCED" \
+                     > "$WORK/l.out"
+check "libvippull gives the same tracks every way" test $? = 0
+check "libvippull finds the same tracks as vip-pull" \
+      cmp -s "$WORK/l.out" "$WORK/l.want"
+check "libvippull leaves out the tracks already there" \
+      test "$(wc -l < "$WORK/l.out")" = 4
+# and nothing but the vippull_* functions can be linked against
+check "libvippull.so only exports vippull_*" \
+      test -z "$(nm -D --defined-only libvippull.so | grep -v ' vippull_')"
+check "libvippull.a only exports vippull_*" \
+      test -z "$(nm -g --defined-only libvippull.a | grep -v ' vippull_' \
+                 | grep -v -e '^$' -e ':$')"
+
+# -i gives the same tracks as a plain parse, both when it builds the index
+# and when it maps it back, even where an id shows up more than once with
+# its files spread over the entries
+{
+        printf '{"url":"%s","ext":"m4a","tracks":[' "$URL"
+        printf '{"id":7,"title":"t"},{"id":7,"file":"Dup 7 A"},'
+        printf '{"id":7,"file":"Dup 7 B","s_file":"Src 7"},'
+        printf '{"id":8,"s_file":"Src 8 A"},{"id":8,"file":"Dup 8"},'
+        printf '{"id":8,"s_file":"Src 8 B"},{"id":9,"file":"Dup 9"},'
+        printf '{"id":2,"file":"Game 2 - Track 2"}]}'
+} > "$WORK/dup.json"
+mkdir "$WORK/i"
+$VIP_PULL "$WORK/i" 2,7,8,9 7 < "$WORK/dup.json" > "$WORK/i.want" \
+          2> /dev/null
+$VIP_PULL --index="$WORK/i.idx" "$WORK/i" 2,7,8,9 7 < "$WORK/dup.json" \
+          > "$WORK/i.out" 2> /dev/null
+check "-i builds an index that gives the same tracks as a plain parse" \
+      cmp -s "$WORK/i.out" "$WORK/i.want"
+check "-i keeps the first file and s_file of duplicate ids" \
+      grep -q "^${URL}source/Src 7.m4a$" "$WORK/i.out"
+IDX_STAMP=$(stat -c %y "$WORK/i.idx")
+$VIP_PULL --index="$WORK/i.idx" "$WORK/i" 2,7,8,9 7 < "$WORK/dup.json" \
+          > "$WORK/i.out" 2> "$WORK/i.err"
+check "-i maps an unchanged roster's index back" \
+      test "$(stat -c %y "$WORK/i.idx")" = "$IDX_STAMP"
+check "a mapped index gives the same tracks as a plain parse" \
+      cmp -s "$WORK/i.out" "$WORK/i.want"
+$VIP_PULL "$WORK/i" 2,7,8,9 8 < "$WORK/dup.json" > "$WORK/i.want" \
+          2> /dev/null
+$VIP_PULL --index="$WORK/i.idx" "$WORK/i" 2,7,8,9 8 < "$WORK/dup.json" \
+          > "$WORK/i.out" 2> /dev/null
+check "a mapped index keeps the s_file that comes after a file" \
+      cmp -s "$WORK/i.out" "$WORK/i.want"
+sed 's/{"id":9,"file":"Dup 9"},//' "$WORK/dup.json" > "$WORK/dup2.json"
+$VIP_PULL --index="$WORK/i.idx" "$WORK/i" 2,7,8,9 7 < "$WORK/dup2.json" \
+          > /dev/null 2> "$WORK/i.err"
+check "-i rebuilds the index and says which ids went when it changes" \
+      grep -q "^removed ids: 9$" "$WORK/i.err"
+
+# -m lists music-dir once, then goes by its manifest until music-dir changes
+mkdir "$WORK/m"
+MAN="$WORK/m.man"
+cp "$SRV/Game 2 - Track 2.m4a" "$SRV/Game 5 - Track 5.m4a" "$WORK/m"
+$VIP_PULL "$WORK/m" "$CHOSEN" "$SOURCED" < "$SRV/roster.json" \
+          > "$WORK/m.want" 2> /dev/null
+$VIP_PULL --manifest="$MAN" "$WORK/m" "$CHOSEN" "$SOURCED" \
+          < "$SRV/roster.json" > "$WORK/m.out" 2> /dev/null
+check "-m gives the same tracks as listing music-dir" \
+      cmp -s "$WORK/m.out" "$WORK/m.want"
+MAN_STAMP=$(stat -c %y "$MAN")
+$VIP_PULL --manifest="$MAN" "$WORK/m" "$CHOSEN" "$SOURCED" \
+          < "$SRV/roster.json" > "$WORK/m.out" 2> /dev/null
+check "-m doesn't list music-dir again while it's unchanged" \
+      test "$(stat -c %y "$MAN")" = "$MAN_STAMP"
+cp "$SRV/Game 4 - Track 4.m4a" "$WORK/m"
+$VIP_PULL "$WORK/m" "$CHOSEN" "$SOURCED" < "$SRV/roster.json" \
+          > "$WORK/m.want" 2> /dev/null
+$VIP_PULL --manifest="$MAN" "$WORK/m" "$CHOSEN" "$SOURCED" \
+          < "$SRV/roster.json" > "$WORK/m.out" 2> /dev/null
+check "-m lists music-dir again once it has changed" \
+      cmp -s "$WORK/m.out" "$WORK/m.want"
+# a file deleted by something else while -d runs isn't taken to be there
+{
+        sleep 1
+        rm "$WORK/m/Game 2 - Track 2.m4a"
+        cat "$SRV/roster.json"
+} | $VIP_PULL -d --manifest="$MAN" "$WORK/m" 1,2 "" > /dev/null 2>&1
+$VIP_PULL --manifest="$MAN" "$WORK/m" 1,2 "" < "$SRV/roster.json" \
+          > "$WORK/m.out" 2> /dev/null
+check "-m -d doesn't cover up a change made while it ran" \
+      grep -q "Game 2 - Track 2" "$WORK/m.out"
+
+# -b gives every directory the tracks a plain run on it would, and --plan
+# gives each of those urls once, followed by every directory missing it
+mkdir "$WORK/b1" "$WORK/b2"
+cp "$SRV/Game 2 - Track 2.m4a" "$SRV/Game 5 - Track 5.m4a" "$WORK/b2"
+printf '# two people\n%s\t%s\t%s\n\n%s\t%s\n' "$WORK/b1" 1,2,3 3 \
+       "$WORK/b2" 1,2,4,5 > "$WORK/jobs.tsv"
+: > "$WORK/b.want"
+: > "$WORK/plan.in"
+for job in "b1 1,2,3 3" "b2 1,2,4,5 "; do
+        read -r dir chosen sourced <<< "$job"
+        $VIP_PULL "$WORK/$dir" "$chosen" "$sourced" < "$SRV/roster.json" \
+                  2> /dev/null > "$WORK/$dir.out"
+        sed "s|^|$WORK/$dir\t|" "$WORK/$dir.out" >> "$WORK/b.want"
+        sed "s|\$|\t$WORK/$dir|" "$WORK/$dir.out" >> "$WORK/plan.in"
+done
+$VIP_PULL -b "$WORK/jobs.tsv" < "$SRV/roster.json" > "$WORK/b.out" \
+          2> /dev/null
+check "-b gives each directory the tracks of a plain run" \
+      cmp -s "$WORK/b.out" "$WORK/b.want"
+LC_ALL=C sort -s -t "$(printf '\t')" -k 1,1 "$WORK/plan.in" | awk -F '\t' '
+        $1 != url { if (NR > 1) print line; url = $1; line = $1 }
+        { line = line "\t" $2 }
+        END { if (NR > 0) print line }' > "$WORK/plan.want"
+$VIP_PULL -b "$WORK/jobs.tsv" --plan < "$SRV/roster.json" \
+          > "$WORK/plan.out" 2> /dev/null
+check "--plan gives each url once with every directory missing it" \
+      cmp -s "$WORK/plan.out" "$WORK/plan.want"
+check "--plan puts both directories after a url they're both missing" \
+      grep -q "Track 1.m4a	$WORK/b1	$WORK/b2$" "$WORK/plan.out"
+
+# -s prints the same tracks as a plain run, even where an id's first entry
+# has no file, and prints each one as soon as it's parsed
+for roster in "$SRV/roster.json" "$WORK/dup.json"; do
+        $VIP_PULL "$WORK/b2" 1,2,3,4,7,8,9 3,7 < "$roster" 2> /dev/null \
+                  | sort > "$WORK/st.want"
+        cat "$roster" | $VIP_PULL -s "$WORK/b2" 1,2,3,4,7,8,9 3,7 \
+                                  2> /dev/null | sort > "$WORK/st.out"
+        check "-s gives the same tracks as a plain run on ${roster##*/}" \
+              cmp -s "$WORK/st.out" "$WORK/st.want"
+done
+CUT=$(grep -bo '{"id":2' "$SRV/roster.json" | cut -d : -f 1)
+START=$(date +%s%N)
+{
+        head -c "$CUT" "$SRV/roster.json"
+        sleep 2
+        tail -c +"$((CUT + 1))" "$SRV/roster.json"
+} | $VIP_PULL -s "$WORK/b1" 1,6 "" 2> /dev/null | {
+        read -r _
+        echo $((($(date +%s%N) - START) / 1000000)) > "$WORK/st.ms"
+        cat > /dev/null
+}
+check "-s prints a track before the rest of the roster arrives" \
+      test "$(cat "$WORK/st.ms")" -lt 1500
+
+# a gzip, zlib or raw deflate roster gives the same tracks as the plain one,
+# redirected from a file or piped
+$VIP_PULL "$WORK/b2" "$CHOSEN" "$SOURCED" < "$SRV/roster.json" \
+          > "$WORK/z.want" 2> /dev/null
+gzip -c "$SRV/roster.json" > "$WORK/roster.gz"
+python3 -c 'import sys, zlib
+data = sys.stdin.buffer.read()
+sys.stdout.buffer.write(zlib.compress(data))
+d = zlib.compressobj(wbits=-15)
+open(sys.argv[1], "wb").write(d.compress(data) + d.flush())' \
+        "$WORK/roster.deflate" < "$SRV/roster.json" > "$WORK/roster.zlib"
+for roster in roster.gz roster.zlib; do
+        $VIP_PULL "$WORK/b2" "$CHOSEN" "$SOURCED" < "$WORK/$roster" \
+                  > "$WORK/z.out" 2> /dev/null
+        check "a redirected $roster gives the same tracks as plain json" \
+              cmp -s "$WORK/z.out" "$WORK/z.want"
+        cat "$WORK/$roster" | $VIP_PULL -z "$WORK/b2" "$CHOSEN" "$SOURCED" \
+                                        > "$WORK/z.out" 2> /dev/null
+        check "a piped $roster gives the same tracks as plain json" \
+              cmp -s "$WORK/z.out" "$WORK/z.want"
+done
+$VIP_PULL -zdeflate "$WORK/b2" "$CHOSEN" "$SOURCED" \
+          < "$WORK/roster.deflate" > "$WORK/z.out" 2> /dev/null
+check "-zdeflate gives the same tracks as plain json" \
+      cmp -s "$WORK/z.out" "$WORK/z.want"
+$VIP_PULL -z "$WORK/b2" "$CHOSEN" "$SOURCED" < "$SRV/roster.json" \
+          > "$WORK/z.out" 2> /dev/null
+check "-z fails on plain json" test $? != 0 -a ! -s "$WORK/z.out"
+
+# a roster of several MB redirected from a file is split up and parsed on
+# -t threads, which gives the same tracks as parsing it on one thread, also
+# with ids repeated across the splits and "},{" inside strings
+python3 -c 'import sys
+tracks = []
+for i in range(120000):
+    title = "t \\\"%d\\\"" % i + ("},{" if i % 1000 == 0 else "")
+    track = "{\"id\":%d,\"title\":\"%s\"" % (i % 100000, title)
+    if i % 5 != 1:
+        track += ",\"file\":\"G %d - T %d\"" % (i, i)
+    if i % 3 == 0:
+        track += ",\"s_file\":\"S %d\"" % i
+    tracks.append(track + "}")
+print("{\"url\":\"%s\",\"ext\":\"m4a\",\"tracks\":[%s]}"
+      % (sys.argv[1], ",\n".join(tracks)))' "$URL" > "$WORK/big.json"
+seq 0 7 99999 | paste -s -d , > "$WORK/big.chosen"
+seq 0 21 99999 | paste -s -d , > "$WORK/big.sourced"
+$VIP_PULL -t 1 "$WORK/b1" "@$WORK/big.chosen" "@$WORK/big.sourced" \
+          < "$WORK/big.json" > "$WORK/big.want" 2> /dev/null
+$VIP_PULL -t 4 "$WORK/b1" "@$WORK/big.chosen" "@$WORK/big.sourced" \
+          < "$WORK/big.json" > "$WORK/big.out" 2> /dev/null
+check "-t 4 gives the same tracks as -t 1 on a big roster" \
+      cmp -s "$WORK/big.out" "$WORK/big.want"
+cat "$WORK/big.json" | $VIP_PULL -t 4 "$WORK/b1" "@$WORK/big.chosen" \
+                                 "@$WORK/big.sourced" > "$WORK/big.out" \
+                                 2> /dev/null
+check "a split roster gives the same tracks as one parsed as it's piped" \
+      cmp -s "$WORK/big.out" "$WORK/big.want"
+
+# -r finds tracks anywhere under music-dir, the same as a plain run on a
+# directory holding just the files it should count
+mkdir -p "$WORK/rt/a/b" "$WORK/rt/skip" "$WORK/rf1" "$WORK/rf2"
+for i in 1 6; do
+        cp "$SRV/Game $i - Track $i.m4a" "$WORK/rt/a"
+done
+cp "$SRV/Game 4 - Track 4.m4a" "$WORK/rt/a/b"
+cp "$SRV/Game 2 - Track 2.m4a" "$WORK/rt/skip"
+cp "$SRV/Game 5 - Track 5.m4a" "$WORK/rt"
+for i in 1 2 4 5 6; do
+        touch "$WORK/rf1/Game $i - Track $i.m4a"
+done
+for i in 1 5; do
+        touch "$WORK/rf2/Game $i - Track $i.m4a"
+done
+$VIP_PULL "$WORK/rf1" "$CHOSEN" "$SOURCED" < "$SRV/roster.json" \
+          > "$WORK/rf.want" 2> /dev/null
+$VIP_PULL -r "$WORK/rt" "$CHOSEN" "$SOURCED" < "$SRV/roster.json" \
+          > "$WORK/rf.out" 2> /dev/null
+check "-r counts the files in every subdirectory" \
+      cmp -s "$WORK/rf.out" "$WORK/rf.want"
+$VIP_PULL "$WORK/rf2" "$CHOSEN" "$SOURCED" < "$SRV/roster.json" \
+          > "$WORK/rf.want" 2> /dev/null
+$VIP_PULL -r --include='*Track [1-5].m4a' --exclude=skip --exclude='* 4.*' \
+          "$WORK/rt" "$CHOSEN" "$SOURCED" < "$SRV/roster.json" \
+          > "$WORK/rf.out" 2> /dev/null
+check "-r --include --exclude only count the files they let through" \
+      cmp -s "$WORK/rf.out" "$WORK/rf.want"
+
+# only the keys a track needs are picked out, whatever else is around them:
+# near misses, escapes, quoted ids, and every other kind of value
+cat > "$WORK/keys.json" <<EOF
+{"version": 3, "name": "with \"url\":\"http://wrong/\" in it",
+ "url" : "$URL" , "ext":"m4a", "tracks" : [
+ { "idx": 1, "i": 2, "id" : 1 , "fil": "x", "files": "x", "File": "x",
+   "file" : "A \"quoted\" \\\\ name" },
+ {"s_fil":"x","id":"2","s_file":"S\/2","file":"B 2","xfile":"x"},
+ {"id":3,"title":"with } and { and \"file\":\"x\"","file":"C 3","n":null},
+ {"ext":"x","url":"x","id": 4,"file":"D 4","f":-1.5e+3,"t":true}
+]}
+EOF
+printf '{"url":"%s","ext":"m4a","tracks":[%s,%s,%s,%s]}' "$URL" \
+       '{"id":1,"file":"A \"quoted\" \\ name"}' \
+       '{"id":2,"file":"B 2","s_file":"S/2"}' '{"id":3,"file":"C 3"}' \
+       '{"id":4,"file":"D 4"}' > "$WORK/keys.plain.json"
+$VIP_PULL "$WORK/b1" 1,2,3,4 2 < "$WORK/keys.plain.json" > "$WORK/k.want" \
+          2> /dev/null
+$VIP_PULL "$WORK/b1" 1,2,3,4 2 < "$WORK/keys.json" > "$WORK/k.out" \
+          2> /dev/null
+check "odd keys and values give the same tracks as plain ones" \
+      cmp -s "$WORK/k.out" "$WORK/k.want"
+check "odd keys and values still give every track" \
+      test "$(wc -l < "$WORK/k.out")" = 4
+$VIP_PULL --index="$WORK/k.idx" "$WORK/b1" 1,2,3,4 2 < "$WORK/keys.json" \
+          > "$WORK/k.out" 2> /dev/null
+check "-i picks out the same keys" cmp -s "$WORK/k.out" "$WORK/k.want"
+
+# --verify counts a file cut short or too small as missing, the same as a
+# plain run on the directory without it, and -d --verify downloads it again
+mkdir "$WORK/v" "$WORK/vp"
+$VIP_PULL -d --verify=100 "$WORK/v" "$CHOSEN" "$SOURCED" \
+          < "$SRV/roster.json" > /dev/null 2>&1
+check "-d --verify records the length of each download" \
+      test -s "$WORK/v.vip-lengths"
+truncate -s 5000 "$WORK/v/Game 1 - Track 1.m4a"
+truncate -s 50 "$WORK/v/Game 6 - Track 6.m4a"
+for i in 2 4 5; do
+        touch "$WORK/vp/Game $i - Track $i.m4a"
+done
+touch "$WORK/vp/Src 3.m4a"
+$VIP_PULL "$WORK/vp" "$CHOSEN" "$SOURCED" < "$SRV/roster.json" \
+          > "$WORK/v.want" 2> /dev/null
+$VIP_PULL --verify=100 "$WORK/v" "$CHOSEN" "$SOURCED" \
+          < "$SRV/roster.json" > "$WORK/v.out" 2> "$WORK/v.err"
+check "--verify gives the tracks of a plain run without the bad files" \
+      cmp -s "$WORK/v.out" "$WORK/v.want"
+check "--verify names each bad file" \
+      test "$(grep -c -e 'Track 1.m4a' -e 'Track 6.m4a' "$WORK/v.err")" = 2
+$VIP_PULL -d --verify=100 "$WORK/v" "$CHOSEN" "$SOURCED" \
+          < "$SRV/roster.json" > /dev/null 2>&1
+check "-d --verify downloads the bad files again" \
+      same_tracks "$WORK/v" "${TRACKS[@]}"
+
+exit $FAILED
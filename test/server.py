@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+# stand-in for the vip server, for make check: serves the files under a
+# directory over keep-alive http/1.1 and logs every request, one per line, as
+# "client-port method path status". files have an ETag, which gets a 304
+# back from If-None-Match, and can be resumed with Range and If-Range. a GET
+# of /_cut?bytes=N makes every later whole file stop after N bytes, as if the
+# connection dropped, until it's asked for again with bytes=0. a HEAD for a
+# file with a NAME.size file next to it reports the size in that instead, so
+# schedules can be tried on made-up sizes
+import hashlib
+import http.server
+import os
+import sys
+import urllib.parse
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def log_message(self, fmt, *args):
+        pass
+
+    def log(self, status):
+        with open(self.server.log_path, 'a') as log:
+            log.write('%d %s %s %d\n' % (self.client_address[1], self.command,
+                                         self.path, status))
+
+    def do_GET(self):
+        self.serve(True)
+
+    def do_HEAD(self):
+        self.serve(False)
+
+    def serve(self, has_body):
+        url = urllib.parse.urlparse(self.path)
+        if url.path == '/_cut':
+            query = urllib.parse.parse_qs(url.query)
+            self.server.cut = int(query['bytes'][0])
+            self.send_response(204)
+            self.end_headers()
+            self.log(204)
+            return
+        path = urllib.parse.unquote(url.path)
+        path = os.path.join(self.server.root, path.lstrip('/'))
+        if not os.path.isfile(path):
+            self.send_response(404)
+            self.send_header('Content-Length', '0')
+            self.end_headers()
+            self.log(404)
+            return
+        with open(path, 'rb') as f:
+            data = f.read()
+        etag = '"%s"' % hashlib.md5(data).hexdigest()[:16]
+        if self.headers.get('If-None-Match') == etag:
+            self.send_response(304)
+            self.send_header('ETag', etag)
+            self.end_headers()
+            self.log(304)
+            return
+
+        # a range is only served if the file is the one it was started on
+        start = 0
+        status = 200
+        byte_range = self.headers.get('Range')
+        if_range = self.headers.get('If-Range')
+        if byte_range and (if_range is None or if_range == etag):
+            start = int(byte_range.split('=')[1].split('-')[0])
+            if start >= len(data):
+                self.send_response(416)
+                self.send_header('Content-Range', 'bytes */%d' % len(data))
+                self.send_header('Content-Length', '0')
+                self.end_headers()
+                self.log(416)
+                return
+            status = 206
+        self.send_response(status)
+        self.send_header('ETag', etag)
+        if status == 206:
+            self.send_header('Content-Range', 'bytes %d-%d/%d'
+                             % (start, len(data) - 1, len(data)))
+        length = len(data) - start
+        if not has_body and os.path.isfile(path + '.size'):
+            with open(path + '.size') as f:
+                length = int(f.read())
+        self.send_header('Content-Length', str(length))
+        self.end_headers()
+        self.log(status)
+        if not has_body:
+            return
+        if status == 200 and 0 < self.server.cut < len(data):
+            self.wfile.write(data[:self.server.cut])
+            self.wfile.flush()
+            self.close_connection = True
+            return
+        self.wfile.write(data[start:])
+
+
+def main():
+    root, log_path, port_path = sys.argv[1:4]
+    server = http.server.ThreadingHTTPServer(('127.0.0.1', 0), Handler)
+    server.root = root
+    server.log_path = log_path
+    server.cut = 0
+    # written last, so the port file existing means the server is up
+    with open(port_path + '.tmp', 'w') as f:
+        f.write('%d\n' % server.server_address[1])
+    os.rename(port_path + '.tmp', port_path)
+    server.serve_forever()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,209 @@
+#include "vippull.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+
+/* drives libvippull the way a program embedding it would, through nothing
+ * but vippull.h, for make check:
+ *   vippull-check roster-file music-dir "chosen ids" "sourced ids"
+ * prints the escaped url of every chosen track missing from music-dir, and
+ * fails if going through the results again, diffing against the same names
+ * given as a list, or loading the same roster again gives anything else */
+
+/* reads the whole file at path into memory */
+static char *read_file(const char *restrict path,
+                       size_t *restrict len);
+/* reads comma-separated ids */
+static int *parse_ids(const char *restrict str,
+                      int *restrict num_ids);
+/* lists the names in dirpath; returns how many there are, or -1 */
+static int list_dir(char ***restrict names,
+                    const char *restrict dirpath);
+/* goes through the results, checking them against the urls of an earlier
+ * pass, or saving them there if there wasn't one */
+static int check_results(struct vippull *restrict vp,
+                         char **restrict urls,
+                         int num_urls,
+                         bool is_first);
+
+int main(int argc, char **argv) {
+        if (argc != 5) {
+                fputs("usage: vippull-check roster-file music-dir "
+                      "\"chosen ids\" \"sourced ids\"\n", stderr);
+                return 1;
+        }
+        size_t len;
+        char *data = read_file(argv[1], &len);
+        int num_chosen;
+        int num_sourced;
+        int *chosen = parse_ids(argv[3], &num_chosen);
+        int *sourced = parse_ids(argv[4], &num_sourced);
+        if ((data == NULL) || (chosen == NULL) || (sourced == NULL)) {
+                fputs("failed to read the arguments\n", stderr);
+                return 1;
+        }
+
+        struct vippull *vp = vippull_new(0);
+        int err_code = 0;
+        char **urls = NULL;
+        char **names = NULL;
+        int num_names = 0;
+        int num_missing = 0;
+        if ((vp == NULL) || (vippull_load_roster(vp, data, len) < 0)
+            || (vippull_load_exports(vp, chosen, num_chosen, sourced,
+                                     num_sourced) < 0)) {
+                fputs("failed to load the roster or exports\n", stderr);
+                err_code = 1;
+                goto cleanup;
+        }
+        num_missing = vippull_diff_dir(vp, argv[2], false);
+        if (num_missing < 0) {
+                fprintf(stderr, "failed to diff %s\n", argv[2]);
+                err_code = 1;
+                goto cleanup;
+        }
+        urls = calloc(num_missing + 1, sizeof(*urls));
+        if ((urls == NULL)
+            || (check_results(vp, urls, num_missing, true) < 0)) {
+                err_code = 1;
+                goto cleanup;
+        }
+        for (int i = 0; i < num_missing; i++) {
+                puts(urls[i]);
+        }
+
+        /* the same results again, from each way of getting them */
+        vippull_rewind(vp);
+        if (check_results(vp, urls, num_missing, false) < 0) {
+                fputs("results differ after a rewind\n", stderr);
+                err_code = 1;
+        }
+        num_names = list_dir(&names, argv[2]);
+        if ((num_names < 0)
+            || (vippull_diff_names(vp, (const char *const *)names,
+                                   num_names) != num_missing)
+            || (check_results(vp, urls, num_missing, false) < 0)) {
+                fputs("results differ against a list of names\n", stderr);
+                err_code = 1;
+        }
+        if ((vippull_load_roster(vp, data, len) != 0)
+            || (vippull_diff_dir(vp, argv[2], false) != num_missing)
+            || (check_results(vp, urls, num_missing, false) < 0)) {
+                fputs("results differ after loading the roster again\n",
+                      stderr);
+                err_code = 1;
+        }
+
+cleanup:
+        if (urls != NULL) {
+                for (int i = 0; i < num_missing; i++) {
+                        free(urls[i]);
+                }
+        }
+        free(urls);
+        for (int i = 0; i < num_names; i++) {
+                free(names[i]);
+        }
+        free(names);
+        vippull_free(vp);
+        free(data);
+        free(chosen);
+        free(sourced);
+        return err_code;
+}
+
+static char *read_file(const char *restrict path,
+                       size_t *restrict len) {
+        FILE *fp = fopen(path, "rb");
+        if (fp == NULL) {
+                return NULL;
+        }
+        size_t cap = 4096;
+        char *data = malloc(cap);
+        *len = 0;
+        size_t n;
+        while ((data != NULL)
+               && ((n = fread(data + *len, 1, cap - *len, fp)) > 0)) {
+                *len += n;
+                if (*len == cap) {
+                        cap <<= 1;
+                        char *tmp = realloc(data, cap);
+                        if (tmp == NULL) {
+                                free(data);
+                        }
+                        data = tmp;
+                }
+        }
+        fclose(fp);
+        return data;
+}
+
+static int *parse_ids(const char *restrict str,
+                      int *restrict num_ids) {
+        int *ids = malloc((strlen(str) / 2 + 1) * sizeof(*ids));
+        if (ids == NULL) {
+                return NULL;
+        }
+        *num_ids = 0;
+        while (*str != '\0') {
+                char *end;
+                ids[*num_ids] = strtol(str, &end, 10);
+                if (end == str) {
+                        str++;
+                        continue;
+                }
+                (*num_ids)++;
+                str = end;
+        }
+        return ids;
+}
+
+static int list_dir(char ***restrict names,
+                    const char *restrict dirpath) {
+        DIR *d = opendir(dirpath);
+        if (d == NULL) {
+                return -1;
+        }
+        int num_names = 0;
+        int max_names = 0;
+        struct dirent *ent;
+        while ((ent = readdir(d)) != NULL) {
+                if (num_names >= max_names) {
+                        max_names = (max_names == 0) ? 64 : max_names << 1;
+                        char **tmp = realloc(*names,
+                                             max_names * sizeof(*tmp));
+                        if (tmp == NULL) {
+                                break;
+                        }
+                        *names = tmp;
+                }
+                (*names)[num_names] = strdup(ent->d_name);
+                if ((*names)[num_names] == NULL) {
+                        break;
+                }
+                num_names++;
+        }
+        closedir(d);
+        return (ent == NULL) ? num_names : -1;
+}
+
+static int check_results(struct vippull *restrict vp,
+                         char **restrict urls,
+                         int num_urls,
+                         bool is_first) {
+        struct vippull_result result;
+        int i = 0;
+        while (vippull_next(vp, &result)) {
+                if (i >= num_urls) {
+                        return -1;
+                }
+                if (is_first) {
+                        urls[i] = strdup(result.url);
+                } else if (strcmp(urls[i], result.url) != 0) {
+                        return -1;
+                }
+                i++;
+        }
+        return (i == num_urls) ? 0 : -1;
+}
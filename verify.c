@@ -0,0 +1,480 @@
+#define _GNU_SOURCE
+#include "verify.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/* statx requests kept in flight at once */
+#define VERIFY_RING_ENTRIES 1024
+/* files each pool task looks up when io_uring can't be used */
+#define VERIFY_CHUNK     256
+
+/* files being looked up; names are relative to dirfd */
+struct verify_batch {
+        int dirfd;
+        const char **names;
+        struct statx *stx;
+        int *errs;                // 0, or the errno of each lookup
+        int num_files;
+};
+/* one pool task's share of a batch */
+struct verify_chunk {
+        struct verify_batch *batch;
+        int start;
+        int end;
+        struct pool_task task;
+};
+
+/* looks up every file in the batch through an io_uring; returns -1 if the
+ * kernel doesn't support it, in which case nothing was looked up */
+static int stat_uring(struct verify_batch *batch);
+/* looks up every file in the batch with statx calls on the pool */
+static void stat_pool(struct verify_batch *restrict batch,
+                      struct pool *restrict pool);
+static void *thrd_stat_chunk(void *verify_chunk);
+static const struct verify_length *find_length(
+                const struct verify_lengths *restrict lengths,
+                const char *restrict name);
+static int lengthcmp(const void *a, const void *b);
+/* orders lengths by name, then by the line they were on */
+static int lengthordercmp(const void *a, const void *b);
+
+int verify_lengths_load(struct verify_lengths *restrict lengths,
+                        const char *restrict path,
+                        struct arena *restrict arena) {
+        *lengths = (struct verify_lengths){.entries = NULL};
+        FILE *fp = fopen(path, "r");
+        if (fp == NULL) {
+                return (errno == ENOENT) ? 0 : -1;
+        }
+        /* each line is a length, a tab and a filename */
+        int err_code = 0;
+        int max_entries = 0;
+        char *line = NULL;
+        size_t linecap = 0;
+        ssize_t linelen;
+        while ((err_code == 0)
+               && ((linelen = getline(&line, &linecap, fp)) > 0)) {
+                if (line[linelen - 1] == '\n') {
+                        line[--linelen] = '\0';
+                }
+                char *tab = strchr(line, '\t');
+                if ((tab == NULL) || (tab[1] == '\0')) {
+                        continue;
+                }
+                /* make space if needed; the old list is left in the arena */
+                if (lengths->num_entries >= max_entries) {
+                        max_entries = (max_entries == 0) ? 256
+                                                         : max_entries << 1;
+                        struct verify_length *tmp = arena_alloc(
+                                        arena, max_entries * sizeof(*tmp));
+                        if (tmp == NULL) {
+                                err_code = -1;
+                                break;
+                        }
+                        if (lengths->num_entries > 0) {
+                                memcpy(tmp, lengths->entries,
+                                       lengths->num_entries * sizeof(*tmp));
+                        }
+                        lengths->entries = tmp;
+                }
+                const size_t namesz = linelen - (tab + 1 - line) + 1;
+                char *name = arena_alloc(arena, namesz);
+                if (name == NULL) {
+                        err_code = -1;
+                        break;
+                }
+                memcpy(name, tab + 1, namesz);
+                struct verify_length *entry
+                        = &lengths->entries[lengths->num_entries];
+                *entry = (struct verify_length){
+                        .name = name,
+                        .length = strtoll(line, NULL, 10),
+                        .order = lengths->num_entries
+                };
+                lengths->num_entries++;
+        }
+        free(line);
+        fclose(fp);
+        if (err_code < 0) {
+                *lengths = (struct verify_lengths){.entries = NULL};
+                return -1;
+        }
+
+        /* a file downloaded again is recorded again; only the last one
+         * counts */
+        qsort(lengths->entries, lengths->num_entries,
+              sizeof(*lengths->entries), lengthordercmp);
+        int num_uniq = 0;
+        for (int i = 0; i < lengths->num_entries; i++) {
+                if ((num_uniq > 0)
+                    && (strcmp(lengths->entries[i].name,
+                               lengths->entries[num_uniq - 1].name) == 0)) {
+                        num_uniq--;
+                }
+                lengths->entries[num_uniq] = lengths->entries[i];
+                num_uniq++;
+        }
+        lengths->num_entries = num_uniq;
+        return 0;
+}
+
+int verify_lengths_save(const char *restrict path,
+                        const struct verify_lengths *restrict lengths,
+                        const struct verify_length *restrict added,
+                        int num_added) {
+        /* the recorded lengths of files downloaded again are dropped, so
+         * the record only ever has a line per file */
+        bool *is_replaced = calloc(lengths->num_entries + 1,
+                                   sizeof(*is_replaced));
+        if (is_replaced == NULL) {
+                return -1;
+        }
+        for (int i = 0; i < num_added; i++) {
+                const struct verify_length *recorded
+                        = find_length(lengths, added[i].name);
+                if (recorded != NULL) {
+                        is_replaced[recorded - lengths->entries] = true;
+                }
+        }
+        if (num_added == 0) {
+                free(is_replaced);
+                return 0;
+        }
+
+        /* written beside the record, then moved over it */
+        const size_t pathlen = strlen(path);
+        char *tmppath = malloc(pathlen + sizeof(".tmp"));
+        if (tmppath == NULL) {
+                free(is_replaced);
+                return -1;
+        }
+        memcpy(tmppath, path, pathlen);
+        memcpy(tmppath + pathlen, ".tmp", sizeof(".tmp"));
+        FILE *fp = fopen(tmppath, "w");
+        if (fp == NULL) {
+                free(tmppath);
+                free(is_replaced);
+                return -1;
+        }
+        for (int i = 0; i < lengths->num_entries; i++) {
+                if (!is_replaced[i]) {
+                        fprintf(fp, "%lld\t%s\n", lengths->entries[i].length,
+                                lengths->entries[i].name);
+                }
+        }
+        for (int i = 0; i < num_added; i++) {
+                fprintf(fp, "%lld\t%s\n", added[i].length, added[i].name);
+        }
+        free(is_replaced);
+        if ((fclose(fp) != 0) || (rename(tmppath, path) < 0)) {
+                unlink(tmppath);
+                free(tmppath);
+                return -1;
+        }
+        free(tmppath);
+        return 0;
+}
+
+int verify_missing(const struct dir_namelist *restrict dnl,
+                   struct track *restrict tracks,
+                   int num_tracks,
+                   long long min_size,
+                   const struct verify_lengths *restrict lengths,
+                   struct pool *restrict pool) {
+        if (num_tracks == 0) {
+                return 0;
+        }
+        /* the tracks that look present are the ones to check */
+        bool *is_missing = malloc(num_tracks * sizeof(*is_missing));
+        struct verify_batch batch = {
+                .dirfd = open(dnl->dirpath, O_RDONLY | O_DIRECTORY
+                                            | O_CLOEXEC),
+                .names = malloc(num_tracks * sizeof(*batch.names)),
+                .stx = malloc(num_tracks * sizeof(*batch.stx)),
+                .errs = malloc(num_tracks * sizeof(*batch.errs)),
+                .num_files = 0
+        };
+        if ((is_missing == NULL) || (batch.dirfd < 0) || (batch.names == NULL)
+            || (batch.stx == NULL) || (batch.errs == NULL)) {
+                fprintf(stderr, "failed to verify files in %s\n",
+                        dnl->dirpath);
+                if (batch.dirfd >= 0) {
+                        close(batch.dirfd);
+                }
+                free(is_missing);
+                free(batch.names);
+                free(batch.stx);
+                free(batch.errs);
+                return dir_missing(dnl, tracks, num_tracks);
+        }
+        for (int i = 0; i < num_tracks; i++) {
+                is_missing[i] = !dir_has(dnl, tracks[i].filename);
+                if (!is_missing[i]) {
+                        batch.names[batch.num_files] = tracks[i].filename;
+                        batch.num_files++;
+                }
+        }
+
+        if ((batch.num_files > 0) && (stat_uring(&batch) < 0)) {
+                stat_pool(&batch, pool);
+        }
+
+        /* the lookups are in the same order as the present tracks */
+        int num_files = 0;
+        int num_flagged = 0;
+        for (int i = 0; i < num_tracks; i++) {
+                if (is_missing[i]) {
+                        continue;
+                }
+                const struct statx *stx = &batch.stx[num_files];
+                const int err = batch.errs[num_files];
+                num_files++;
+                const char *name = tracks[i].filename;
+                const struct verify_length *recorded = find_length(lengths,
+                                                                   name);
+                if (err != 0) {
+                        fprintf(stderr, "failed to check %s: %s\n", name,
+                                strerror(err));
+                } else if (!S_ISREG(stx->stx_mode)) {
+                        fprintf(stderr, "%s isn't a regular file\n", name);
+                } else if ((long long)stx->stx_size < min_size) {
+                        fprintf(stderr, "%s is only %llu bytes\n", name,
+                                (unsigned long long)stx->stx_size);
+                } else if ((recorded != NULL)
+                           && ((long long)stx->stx_size != recorded->length)) {
+                        fprintf(stderr, "%s is %llu bytes instead of %lld\n",
+                                name, (unsigned long long)stx->stx_size,
+                                recorded->length);
+                } else {
+                        continue;
+                }
+                is_missing[i] = true;
+                num_flagged++;
+        }
+        if (num_flagged > 0) {
+                fprintf(stderr, "%d of %d files in %s failed verification\n",
+                        num_flagged, batch.num_files, dnl->dirpath);
+        }
+
+        int num_missing = 0;
+        for (int i = 0; i < num_tracks; i++) {
+                if (is_missing[i]) {
+                        tracks[num_missing] = tracks[i];
+                        num_missing++;
+                }
+        }
+        close(batch.dirfd);
+        free(is_missing);
+        free(batch.names);
+        free(batch.stx);
+        free(batch.errs);
+        return num_missing;
+}
+
+static int stat_uring(struct verify_batch *batch) {
+        /* no liburing; the rings are set up by hand */
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        const int ring_fd = syscall(__NR_io_uring_setup, VERIFY_RING_ENTRIES,
+                                    &params);
+        if (ring_fd < 0) {
+                return -1;
+        }
+        size_t sq_len = params.sq_off.array
+                        + params.sq_entries * sizeof(unsigned);
+        size_t cq_len = params.cq_off.cqes
+                        + params.cq_entries * sizeof(struct io_uring_cqe);
+        const bool is_single = (params.features & IORING_FEAT_SINGLE_MMAP);
+        if (is_single) {
+                sq_len = cq_len = (sq_len > cq_len) ? sq_len : cq_len;
+        }
+        const size_t sqes_len = params.sq_entries
+                                * sizeof(struct io_uring_sqe);
+        char *sq = mmap(NULL, sq_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring_fd,
+                        IORING_OFF_SQ_RING);
+        char *cq = is_single ? sq
+                             : mmap(NULL, cq_len, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_POPULATE, ring_fd,
+                                    IORING_OFF_CQ_RING);
+        struct io_uring_sqe *sqes = mmap(NULL, sqes_len,
+                                         PROT_READ | PROT_WRITE,
+                                         MAP_SHARED | MAP_POPULATE, ring_fd,
+                                         IORING_OFF_SQES);
+        int err_code = 0;
+        if ((sq == MAP_FAILED) || (cq == MAP_FAILED) || (sqes == MAP_FAILED)) {
+                err_code = -1;
+                goto cleanup;
+        }
+
+        unsigned *sq_tail = (unsigned *)(sq + params.sq_off.tail);
+        const unsigned sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+        unsigned *sq_array = (unsigned *)(sq + params.sq_off.array);
+        unsigned *cq_head = (unsigned *)(cq + params.cq_off.head);
+        unsigned *cq_tail = (unsigned *)(cq + params.cq_off.tail);
+        const unsigned cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+        struct io_uring_cqe *cqes = (struct io_uring_cqe *)
+                                    (cq + params.cq_off.cqes);
+
+        /* keep the ring full, so the kernel always has lookups to work on
+         * while completions are picked up */
+        int num_queued = 0;
+        int num_done = 0;
+        unsigned num_unsubmitted = 0;
+        unsigned num_in_flight = 0;
+        bool has_failed = false;
+        /* once submitting fails, the ring can't be closed until the lookups
+         * the kernel already has are done: they write into the batch, which
+         * the fallback reuses */
+        while ((num_in_flight > num_unsubmitted)
+               || (!has_failed && (num_done < batch->num_files))) {
+                unsigned tail = *sq_tail;
+                while (!has_failed && (num_queued < batch->num_files)
+                       && (num_in_flight < params.sq_entries)) {
+                        const unsigned slot = tail & sq_mask;
+                        struct io_uring_sqe *sqe = &sqes[slot];
+                        memset(sqe, 0, sizeof(*sqe));
+                        sqe->opcode = IORING_OP_STATX;
+                        sqe->fd = batch->dirfd;
+                        sqe->addr = (uintptr_t)batch->names[num_queued];
+                        sqe->len = STATX_TYPE | STATX_SIZE;
+                        sqe->off = (uintptr_t)&batch->stx[num_queued];
+                        sqe->statx_flags = AT_STATX_SYNC_AS_STAT;
+                        sqe->user_data = num_queued;
+                        sq_array[slot] = slot;
+                        tail++;
+                        num_queued++;
+                        num_in_flight++;
+                        num_unsubmitted++;
+                }
+                __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+
+                const int ret = syscall(__NR_io_uring_enter, ring_fd,
+                                        has_failed ? 0 : num_unsubmitted, 1,
+                                        IORING_ENTER_GETEVENTS, NULL, 0);
+                if (ret < 0) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        if (has_failed) {
+                                /* not even waiting works; nothing more can
+                                 * be done */
+                                break;
+                        }
+                        has_failed = true;
+                        err_code = -1;
+                        continue;
+                }
+                if (!has_failed) {
+                        num_unsubmitted -= ret;
+                }
+
+                unsigned head = *cq_head;
+                const unsigned ctail = __atomic_load_n(cq_tail,
+                                                       __ATOMIC_ACQUIRE);
+                for (; head != ctail; head++) {
+                        const struct io_uring_cqe *cqe = &cqes[head & cq_mask];
+                        /* kernels from before statx was added to io_uring
+                         * reject it */
+                        if (cqe->res == -EINVAL) {
+                                err_code = -1;
+                        }
+                        batch->errs[cqe->user_data] = (cqe->res < 0)
+                                                      ? -cqe->res : 0;
+                        num_done++;
+                        num_in_flight--;
+                }
+                __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        }
+
+cleanup:
+        if (sqes != MAP_FAILED) {
+                munmap(sqes, sqes_len);
+        }
+        if (!is_single && (cq != MAP_FAILED)) {
+                munmap(cq, cq_len);
+        }
+        if (sq != MAP_FAILED) {
+                munmap(sq, sq_len);
+        }
+        close(ring_fd);
+        return err_code;
+}
+
+static void stat_pool(struct verify_batch *restrict batch,
+                      struct pool *restrict pool) {
+        const int num_chunks = (batch->num_files + VERIFY_CHUNK - 1)
+                               / VERIFY_CHUNK;
+        struct verify_chunk *chunks = malloc(num_chunks * sizeof(*chunks));
+        if (chunks == NULL) {
+                struct verify_chunk whole = {
+                        .batch = batch,
+                        .start = 0,
+                        .end = batch->num_files
+                };
+                thrd_stat_chunk(&whole);
+                return;
+        }
+        for (int i = 0; i < num_chunks; i++) {
+                chunks[i] = (struct verify_chunk){
+                        .batch = batch,
+                        .start = i * VERIFY_CHUNK,
+                        .end = (i + 1 < num_chunks) ? (i + 1) * VERIFY_CHUNK
+                                                    : batch->num_files
+                };
+                pool_submit(pool, &chunks[i].task, thrd_stat_chunk,
+                            &chunks[i]);
+        }
+        for (int i = 0; i < num_chunks; i++) {
+                pool_wait(pool, &chunks[i].task);
+        }
+        free(chunks);
+}
+
+static void *thrd_stat_chunk(void *verify_chunk) {
+        struct verify_chunk *chunk = verify_chunk;
+        struct verify_batch *batch = chunk->batch;
+        for (int i = chunk->start; i < chunk->end; i++) {
+                batch->errs[i] = (statx(batch->dirfd, batch->names[i],
+                                        AT_STATX_SYNC_AS_STAT,
+                                        STATX_TYPE | STATX_SIZE,
+                                        &batch->stx[i]) < 0) ? errno : 0;
+        }
+        return NULL;
+}
+
+static const struct verify_length *find_length(
+                const struct verify_lengths *restrict lengths,
+                const char *restrict name) {
+        if (lengths == NULL) {
+                return NULL;
+        }
+        const struct verify_length key = {.name = name};
+        return bsearch(&key, lengths->entries, lengths->num_entries,
+                       sizeof(*lengths->entries), lengthcmp);
+}
+
+static int lengthcmp(const void *a, const void *b) {
+        const struct verify_length *av = a;
+        const struct verify_length *bv = b;
+        return strcmp(av->name, bv->name);
+}
+
+static int lengthordercmp(const void *a, const void *b) {
+        const struct verify_length *av = a;
+        const struct verify_length *bv = b;
+        int result = strcmp(av->name, bv->name);
+        if (result != 0) {
+                return result;
+        }
+        return av->order - bv->order;
+}
@@ -0,0 +1,45 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include "json-parse.h"
+#include "arena.h"
+#include "dir.h"
+#include "pool.h"
+
+/* checks that the files of tracks already in the music directory are
+ * whole. their sizes are looked up with statx in large io_uring batches, or
+ * on the pool where io_uring isn't available, and files that are too small
+ * or not the size they were downloaded at count as missing */
+
+/* the size a file had when it was downloaded */
+struct verify_length {
+        const char *name;
+        long long length;
+        int order;                // line it was on; later lines win
+};
+struct verify_lengths {
+        struct verify_length *entries; // sorted by name, one per name
+        int num_entries;
+};
+/* loads the lengths recorded at path, allocated from the arena; a record
+ * that doesn't exist yet is empty, as is one that couldn't be read */
+int verify_lengths_load(struct verify_lengths *restrict lengths,
+                        const char *restrict path,
+                        struct arena *restrict arena);
+/* rewrites the record at path with the lengths loaded from it and those
+ * added since, which replace any recorded for the same file */
+int verify_lengths_save(const char *restrict path,
+                        const struct verify_lengths *restrict lengths,
+                        const struct verify_length *restrict added,
+                        int num_added);
+/* works like dir_missing, except that tracks whose files are in the
+ * directory but smaller than min_size, or of a different length than
+ * recorded, are also moved to the front */
+int verify_missing(const struct dir_namelist *restrict dnl,
+                   struct track *restrict tracks,
+                   int num_tracks,
+                   long long min_size,
+                   const struct verify_lengths *restrict lengths,
+                   struct pool *restrict pool);
+
+#endif /* !VERIFY_H */
@@ -1,106 +1,438 @@
-#include "json-parse.h"
+#include "vippull.h"
+#include "arena.h"
+#include "download.h"
+#include "stats.h"
+#include "batch.h"
+#include "watch.h"
+#include "format.h"
+#include "schedule.h"
 #include <stdio.h>
 #include <unistd.h>
-#include <dirent.h>
-#include <pthread.h>
+#include <getopt.h>
 #include <stdlib.h>
-#include <assert.h>
 #include <string.h>
 
 #define PROG_NAME        "vip-pull"
-#define VIP_SRC_DIR      "source/"
+#define DEFAULT_JOBS     4
+#define INDEX_SUFFIX     ".vip-index"
+#define MANIFEST_SUFFIX  ".vip-manifest"
+#define LENGTHS_SUFFIX   ".vip-lengths"
+#define STATS_ENV        "VIP_STATS"
+#define DEFAULT_INTERVAL 600
+#define DEFAULT_MIN_SIZE 1024
+#define USAGE \
+        "should have the form:\n" \
+        PROG_NAME" [options] music-dir \"chosen export\" " \
+        "\"source export\"\n" \
+        PROG_NAME" [options] -b batch-file\n" \
+        PROG_NAME" [options] -w roster-url music-dir \"chosen export\" " \
+        "\"source export\"\n" \
+        "options:\n" \
+        "  -d, --download        download missing tracks into music-dir\n" \
+        "                        instead of printing their urls\n" \
+        "  -j, --jobs=N          number of downloads to run at once " \
+        "(default 4)\n" \
+        "  -i, --index[=F]       keep a binary index of the roster in F\n" \
+        "                        (default music-dir" INDEX_SUFFIX ") and " \
+        "skip\n" \
+        "                        parsing when the roster hasn't changed\n" \
+        "  -m, --manifest[=F]    keep the names in music-dir in F (default\n" \
+        "                        music-dir" MANIFEST_SUFFIX ") and only " \
+        "list\n" \
+        "                        music-dir again when it has changed\n" \
+        "      --stats[=json]    print timings and counts for each phase " \
+        "to\n" \
+        "                        stderr, as JSON if asked (or set " \
+        STATS_ENV "\n" \
+        "                        to 1 or json)\n" \
+        "  -s, --stream          list music-dir first, then print each url " \
+        "as\n" \
+        "                        soon as its track is parsed\n" \
+        "  -b, --batch=F         compare every music-dir in F against one\n" \
+        "                        parse of the roster; F has a music-dir,\n" \
+        "                        chosen export and source export per " \
+        "line,\n" \
+        "                        separated by tabs. urls are printed " \
+        "after\n" \
+        "                        their music-dir and a tab\n" \
+        "      --plan            with -b, print each url once, followed " \
+        "by\n" \
+        "                        every music-dir missing it\n" \
+        "  -w, --watch=URL       keep running, fetching the roster from " \
+        "URL\n" \
+        "                        when it changes and handling tracks " \
+        "as\n" \
+        "                        they're added to the roster or exports\n" \
+        "      --interval=N      with -w, seconds between roster checks\n" \
+        "                        (default 600)\n" \
+        "  -t, --threads=N       number of threads for parsing and listing\n" \
+        "                        directories (default one per cpu)\n" \
+        "  -r, --recursive       also look for tracks in every " \
+        "subdirectory\n" \
+        "                        of music-dir, which are read in parallel\n" \
+        "      --include=P       with -r, only count files matching the " \
+        "shell\n" \
+        "                        pattern P; may be given more than once\n" \
+        "      --exclude=P       with -r, skip files and directories " \
+        "matching\n" \
+        "                        P; may be given more than once\n" \
+        "      --verify[=N]      check the size of every track already " \
+        "in\n" \
+        "                        music-dir and get it again if it's under " \
+        "N\n" \
+        "                        bytes (default 1024) or isn't the length " \
+        "it\n" \
+        "                        was downloaded at; with -d, lengths are\n" \
+        "                        recorded in music-dir" LENGTHS_SUFFIX "\n" \
+        "      --schedule[=P]    ask the server for each track's size " \
+        "and\n" \
+        "                        order them so -j downloads at once take " \
+        "as\n" \
+        "                        long as each other, by P: small (the " \
+        "smallest\n" \
+        "                        first; default), large or id; printed " \
+        "urls\n" \
+        "                        come after their lane and a tab\n" \
+        "      --limit-rate=R    with -d, download at most R bytes a " \
+        "second\n" \
+        "                        in all; R may end in k, M or G\n" \
+        "  -f, --format=F        how to print urls: urls (one per line), " \
+        "curl\n" \
+        "                        (a curl --config file), aria2 (an aria2c\n" \
+        "                        --input-file) or null (NUL-separated " \
+        "path\n" \
+        "                        and url pairs, for xargs -0 -n 2 curl -o)\n" \
+        "  -z, --compressed[=deflate]\n" \
+        "                        the roster is gzip or zlib data (which is\n" \
+        "                        detected anyway), or raw deflate if " \
+        "asked\n"
 
-struct dir_namelist {
-        const char *dirpath;      // assigned prior to dir_read call
-        char **namelist;          // assigned by dir_read call
-        int num_names;            // assigned by dir_read call
+enum stats_format {
+        STATS_NONE = 0,
+        STATS_TEXT,
+        STATS_JSON
 };
-static void *dir_read(void *dir_namelist);
-static int mystrcmp(const void *a, const void *b) {
-        int result = strcmp(*(char **)a, *(char **)b);
-        /*
-        printf("a: %s\n"
-               "b: %s\n"
-               "result: %d\n",
-               *(char **)a, *(char **)b, result);
-        */
-        return result;
-}
+struct options {
+        bool download;            // download instead of printing urls
+        int jobs;                 // concurrent downloads
+        bool use_index;           // keep a roster index
+        const char *index_path;   // NULL for the default path
+        bool use_manifest;        // keep a directory manifest
+        const char *manifest_path; // NULL for the default path
+        enum stats_format stats;  // how to report stats, if at all
+        bool stream;              // print urls while parsing the roster
+        const char *batch_path;   // batch file, or NULL
+        bool plan;                // print a deduplicated plan in batch mode
+        const char *watch_url;    // roster url to watch, or NULL
+        int interval;             // seconds between roster checks
+        enum vippull_codec codec; // how the roster on stdin is encoded
+        int threads;              // pool threads; 0 for one per cpu
+        enum url_format format;   // how urls are printed
+        bool recursive;           // list subdirectories of music-dirs too
+        const char **include;     // with -r, files must match one of these
+        int num_include;
+        const char **exclude;     // with -r, what matches these is skipped
+        int num_exclude;
+        const char **patterns;    // holds both lists; include from the
+                                  // front, exclude from the back
+        bool verify;              // check the sizes of files already there
+        long long min_size;       // smallest size a file can be, verified
+        bool schedule;            // order downloads by their sizes
+        enum schedule_policy policy; // how to order them
+        long long max_rate;       // bytes a second for all downloads, or 0
+};
+static int parse_options(struct options *restrict opts,
+                         int argc,
+                         char **restrict argv);
+/* sets up the listing of a music directory as the options say */
+static void set_dir_config(struct vippull_dir_config *restrict config,
+                           const struct options *restrict opts,
+                           const char *restrict dirpath,
+                           struct arena *restrict arena);
+/* on_missing callback for --stream */
+struct stream_args {
+        const struct vippull *vp;
+        const char *dirpath;
+        enum url_format format;
+};
+static void stream_track(const struct vippull_result *result,
+                         void *stream_args);
+/* copies the path and url of result, which only last until the next one,
+ * into the arena */
+static int keep_result(struct vippull_result *restrict dst,
+                       const struct vippull_result *restrict result,
+                       struct arena *restrict arena);
+/* compares every job in the batch file against one parse of the roster */
+static int run_batch(const struct options *restrict opts,
+                     struct vippull *restrict vp,
+                     struct arena *restrict arena,
+                     struct stats *restrict stats);
+/* a url missing from a batch job's directory */
+struct batch_url {
+        const char *url;
+        const char *dirpath;
+        int job;                  // keeps the jobs in order within a url
+};
+static int batch_urlcmp(const void *a, const void *b);
+/* fills in the counts kept elsewhere and prints the stats */
+static void print_stats(struct stats *restrict stats,
+                        enum stats_format format,
+                        const struct vippull *restrict vp,
+                        const struct arena *restrict arena);
+/* asks for the size of every download and puts them in the order to start
+ * them in; when they aren't being downloaded, prints them in that order */
+static void schedule_downloads(const struct options *restrict opts,
+                               struct download *restrict dls,
+                               int num_dls,
+                               const struct vippull_result *restrict results,
+                               const char *restrict download_url,
+                               const char *restrict dirpath,
+                               struct arena *restrict arena);
+/* reads a number of bytes, which may end in k, M or G */
+static int parse_rate(long long *restrict rate,
+                      const char *restrict str);
+/* path of a file next to the music directory, named after it */
+static char *sibling_path(const char *restrict dirpath,
+                          const char *restrict suffix,
+                          struct arena *restrict arena);
 
+/* long options without a short form */
+enum long_opts {
+        OPT_STATS = 256,
+        OPT_PLAN,
+        OPT_INTERVAL,
+        OPT_INCLUDE,
+        OPT_EXCLUDE,
+        OPT_VERIFY,
+        OPT_SCHEDULE,
+        OPT_LIMIT_RATE
+};
+/* positional arguments, after options */
 enum args {
-        ARGV_DIR = 1,
+        ARGV_DIR = 0,
         ARGV_CHOSEN,
-        ARGV_SOURCED
+        ARGV_SOURCED,
+        NUM_ARGS
 };
 int main(int argc, char **argv) {
         int err_code = 0;
-        if (argc < 4) {
+        struct stats stats;
+        stats_start(&stats);
+        struct options opts;
+        int argind = parse_options(&opts, argc, argv);
+        if ((argind < 0)
+            || ((opts.batch_path == NULL) && (argc - argind < NUM_ARGS))
+            || ((opts.batch_path != NULL) && (argc != argind))) {
                 fputs("error: invalid arguments\n"
-                      "should have the form:\n"
-                      PROG_NAME" music-dir \"chosen export\" "
-                      "\"source export\"\n\n",
+                      USAGE "\n",
                       stderr);
+                free(opts.patterns);
                 return -1;
         }
+        argv += argind;
+        /* the roster comes from the url rather than stdin */
+        if (opts.watch_url != NULL) {
+                const struct watch_config config = {
+                        .roster_url = opts.watch_url,
+                        .dirpath = argv[ARGV_DIR],
+                        .chosen = argv[ARGV_CHOSEN],
+                        .sourced = argv[ARGV_SOURCED],
+                        .interval = opts.interval,
+                        .download = opts.download,
+                        .jobs = opts.jobs,
+                        .max_rate = opts.max_rate,
+                        .threads = opts.threads,
+                        .format = opts.format
+                };
+                return watch_run(&config);
+        }
         if (isatty(STDIN_FILENO)) {
                 fputs("error: input should be VIP JSON redirected\n\n",
                       stderr);
+                free(opts.patterns);
+                return -1;
+        }
+
+        /* threads for the directory listing and the parse */
+        struct vippull *vp = vippull_new(opts.threads);
+        if (vp == NULL) {
+                fputs("error: out of memory\n\n", stderr);
+                free(opts.patterns);
                 return -1;
         }
+        /* everything that lives until the end of the run */
+        struct arena arena;
+        arena_init(&arena);
 
-        /* call thread to populate a list of all directory entries */
-        pthread_t thrd;
-        struct dir_namelist dnl = {.dirpath = argv[ARGV_DIR]};
-        pthread_create(&thrd, NULL, dir_read, &dnl);
+        if (opts.batch_path != NULL) {
+                err_code = run_batch(&opts, vp, &arena, &stats);
+                fflush(stdout);
+                vippull_drain(vp);
+                if (opts.stats != STATS_NONE) {
+                        print_stats(&stats, opts.stats, vp, &arena);
+                }
+                vippull_free(vp);
+                arena_free(&arena);
+                free(opts.patterns);
+                return err_code;
+        }
 
-        /* get url and ext */
-        char *download_url;
-        char *file_ext;
-        err_code = get_url_ext(&download_url, &file_ext, stdin);
-        if (err_code < 0) {
-                pthread_join(thrd, NULL);
-                fputs("failed to parse download url or file extension\n",
-                      stderr);
+        /* populate a list of all directory entries on the pool */
+        const char *dirpath = argv[ARGV_DIR];
+        struct vippull_dir_config dir_config;
+        set_dir_config(&dir_config, &opts, dirpath, &arena);
+        struct vippull_dir *dir = vippull_dir_open(vp, dirpath, &dir_config);
+        if (dir == NULL) {
+                fputs("out of memory\n", stderr);
+                err_code = -1;
                 goto cleanup;
         }
+        stats_phase(&stats, "setup");
 
-        /* get tracks */
-        struct track *tracks;
-        int num_tracks;
-        num_tracks = get_all_tracks(&tracks, argv[ARGV_CHOSEN],
-                                    argv[ARGV_SOURCED], stdin);
-
-        /* join thread to retrieve list of directory entries */
-        pthread_join(thrd, NULL);
-        if (dnl.num_names == 0) {
-                fprintf(stderr, "failed to read directory %s\n", dnl.dirpath);
+        /* set up the chosen tracks */
+        if (vippull_load_export_strs(vp, argv[ARGV_CHOSEN],
+                                     argv[ARGV_SOURCED]) < 0) {
                 err_code = -1;
                 goto cleanup;
         }
+        stats_phase(&stats, "exports");
 
-        /* add extension to strings */
-        const size_t extlen = strlen(file_ext);
-        for (int i = 0; i < num_tracks; i++) {
-                size_t tracklen = strlen(tracks[i].filename);
-                tracks[i].filename = realloc(tracks[i].filename,
-                                             (tracklen + extlen + 2)
-                                             * sizeof(*tracks[i].filename));
-                tracks[i].filename[tracklen] = '.';
-                memcpy(tracks[i].filename + tracklen + 1,
-                       file_ext, extlen + 1);
+        /* to print urls as tracks are parsed, the directory has to be known
+         * before the roster is read */
+        if (opts.stream) {
+                const int num_names = vippull_dir_wait(vp, dir);
+                stats.join_wait = stats_phase(&stats, "dir_join");
+                if (num_names < 0) {
+                        fprintf(stderr, "failed to read directory %s\n",
+                                dirpath);
+                        err_code = -1;
+                        goto cleanup;
+                }
         }
 
-        /* compare to directory entries and print un-downloaded files */
-        for (int i = 0; i < num_tracks; i++) {
-                if (bsearch(&tracks[i].filename, dnl.namelist,
-                            dnl.num_names, sizeof(*dnl.namelist),
-                            mystrcmp) == NULL) {
-                        fputs(download_url, stdout);
-                        if (tracks[i].is_sourced) {
-                                fputs(VIP_SRC_DIR, stdout);
+        /* get url, ext and tracks, either from the index or the json */
+        struct stream_args stream = {
+                .vp = vp,
+                .dirpath = dirpath,
+                .format = opts.format
+        };
+        struct vippull_read_config read_config = {
+                .codec = opts.codec,
+                .is_whole = false,
+                .index_path = NULL,
+                .stream_dir = opts.stream ? dir : NULL,
+                .on_missing = stream_track,
+                .arg = &stream
+        };
+        if (opts.use_index) {
+                read_config.index_path = (opts.index_path != NULL)
+                                         ? opts.index_path
+                                         : sibling_path(dirpath,
+                                                        INDEX_SUFFIX, &arena);
+        }
+        err_code = vippull_read_roster(vp, STDIN_FILENO, &read_config);
+        stats_phase(&stats, "roster");
+        if (err_code < 0) {
+                goto cleanup;
+        }
+        /* say so if the rest of the roster wasn't needed */
+        struct vippull_stats vstats;
+        vippull_get_stats(vp, &vstats);
+        if (vstats.is_cut_short) {
+                fprintf(stderr, "all chosen tracks found; stopped parsing "
+                        "roster at byte %zu", vstats.roster_bytes);
+                if (vstats.roster_len > 0) {
+                        fprintf(stderr, " of %zu", vstats.roster_len);
+                }
+                fputc('\n', stderr);
+        }
+
+        /* join thread to retrieve list of directory entries */
+        if (!opts.stream) {
+                const int num_names = vippull_dir_wait(vp, dir);
+                stats.join_wait = stats_phase(&stats, "dir_join");
+                if (num_names < 0) {
+                        fprintf(stderr, "failed to read directory %s\n",
+                                dirpath);
+                        err_code = -1;
+                        goto cleanup;
+                }
+        }
+
+        /* compare to directory entries and print or queue un-downloaded
+         * files */
+        const char *download_url = vippull_download_url(vp);
+        const int num_missing = vippull_diff(vp, dir);
+        if (num_missing < 0) {
+                fputs("out of memory\n", stderr);
+                err_code = -1;
+                goto cleanup;
+        }
+        stats_phase(&stats, "diff");
+        /* a schedule needs the urls to ask for the sizes, even if it's only
+         * printed */
+        struct vippull_result *results = NULL;
+        struct download *dls = NULL;
+        int num_dls = 0;
+        if ((opts.download || opts.schedule) && (num_missing > 0)) {
+                results = arena_alloc(&arena, num_missing * sizeof(*results));
+                dls = arena_alloc(&arena, num_missing * sizeof(*dls));
+                if ((results == NULL) || (dls == NULL)) {
+                        fputs("out of memory\n", stderr);
+                        err_code = -1;
+                        goto cleanup;
+                }
+        }
+        struct vippull_result result;
+        while (vippull_next(vp, &result)) {
+                if (!opts.download && !opts.schedule) {
+                        /* streamed urls have been printed already */
+                        if (!opts.stream) {
+                                format_track(stdout, opts.format,
+                                             download_url, dirpath, &result);
                         }
-                        puts(tracks[i].filename);
+                        continue;
+                }
+                if (keep_result(&results[num_dls], &result, &arena) < 0) {
+                        fputs("out of memory\n", stderr);
+                        err_code = -1;
+                        goto cleanup;
+                }
+                dls[num_dls] = (struct download){
+                        .url = results[num_dls].url,
+                        .filename = results[num_dls].filename
+                };
+                num_dls++;
+        }
+        if (opts.schedule) {
+                schedule_downloads(&opts, dls, num_dls, results, download_url,
+                                   dirpath, &arena);
+        }
+        stats_phase(&stats, "output");
+        if (opts.download) {
+                fflush(stdout);
+                /* only what's downloaded may go into the manifest's new
+                 * stamp */
+                vippull_dir_check(dir);
+                int num_failed = download_all(dirpath, dls, num_dls,
+                                              opts.jobs, opts.max_rate);
+                if (num_failed != 0) {
+                        fprintf(stderr, "%d of %d downloads failed\n",
+                                (num_failed < 0) ? num_dls : num_failed,
+                                num_dls);
+                        err_code = -1;
                 }
+                /* record what's been downloaded, and how long it is,
+                 * instead of listing and checking the directory again next
+                 * time */
+                for (int i = 0; i < num_dls; i++) {
+                        if (dls[i].is_done) {
+                                vippull_dir_add(dir, dls[i].filename,
+                                                dls[i].length);
+                        }
+                }
+                vippull_dir_save(dir);
+                stats_phase(&stats, "download");
         }
 
         /*
@@ -127,33 +459,652 @@ int main(int argc, char **argv) {
         */
 
 cleanup:
+        /* let whatever is piping the roster in finish writing it */
+        fflush(stdout);
+        vippull_drain(vp);
+        if (opts.stats != STATS_NONE) {
+                print_stats(&stats, opts.stats, vp, &arena);
+        }
+
         /* free stuff */
-        for (int i = 0; i < dnl.num_names; i++) {
-                free(dnl.namelist[i]);
+        vippull_dir_close(vp, dir);
+        vippull_free(vp);
+        arena_free(&arena);
+        free(opts.patterns);
+
+        return err_code;
+}
+
+static int parse_options(struct options *restrict opts,
+                         int argc,
+                         char **restrict argv) {
+        static const struct option longopts[] = {
+                {"download", no_argument, NULL, 'd'},
+                {"jobs", required_argument, NULL, 'j'},
+                {"index", optional_argument, NULL, 'i'},
+                {"manifest", optional_argument, NULL, 'm'},
+                {"stats", optional_argument, NULL, OPT_STATS},
+                {"stream", no_argument, NULL, 's'},
+                {"batch", required_argument, NULL, 'b'},
+                {"plan", no_argument, NULL, OPT_PLAN},
+                {"watch", required_argument, NULL, 'w'},
+                {"interval", required_argument, NULL, OPT_INTERVAL},
+                {"compressed", optional_argument, NULL, 'z'},
+                {"threads", required_argument, NULL, 't'},
+                {"format", required_argument, NULL, 'f'},
+                {"recursive", no_argument, NULL, 'r'},
+                {"include", required_argument, NULL, OPT_INCLUDE},
+                {"exclude", required_argument, NULL, OPT_EXCLUDE},
+                {"verify", optional_argument, NULL, OPT_VERIFY},
+                {"schedule", optional_argument, NULL, OPT_SCHEDULE},
+                {"limit-rate", required_argument, NULL, OPT_LIMIT_RATE},
+                {NULL, 0, NULL, 0}
+        };
+        *opts = (struct options){
+                .download = false,
+                .jobs = DEFAULT_JOBS,
+                .use_index = false,
+                .index_path = NULL,
+                .use_manifest = false,
+                .manifest_path = NULL,
+                .stats = STATS_NONE,
+                .stream = false,
+                .batch_path = NULL,
+                .plan = false,
+                .watch_url = NULL,
+                .interval = DEFAULT_INTERVAL,
+                .codec = VIPPULL_AUTO,
+                .threads = 0,
+                .format = FORMAT_URLS,
+                .recursive = false,
+                .num_include = 0,
+                .num_exclude = 0,
+                .patterns = NULL,
+                .verify = false,
+                .min_size = DEFAULT_MIN_SIZE,
+                .schedule = false,
+                .policy = SCHEDULE_SMALL,
+                .max_rate = 0
+        };
+        /* the environment is a fallback for when the arguments can't be
+         * changed, e.g. when run from pull.sh */
+        const char *stats_env = getenv(STATS_ENV);
+        if ((stats_env != NULL) && (*stats_env != '\0')
+            && (strcmp(stats_env, "0") != 0)) {
+                opts->stats = (strcmp(stats_env, "json") == 0) ? STATS_JSON
+                                                                : STATS_TEXT;
         }
-        free(dnl.namelist);
-        for (int i = 0; i < num_tracks; i++) {
-                free(tracks[i].filename);
+
+        int opt;
+        while ((opt = getopt_long(argc, argv, "dj:i::m::sb:w:z::t:f:r",
+                                  longopts, NULL)) != -1) {
+                switch (opt) {
+                case 'd':
+                        opts->download = true;
+                        break;
+                case 'j':
+                        opts->jobs = atoi(optarg);
+                        if (opts->jobs < 1) {
+                                fprintf(stderr, "error: invalid job count "
+                                        "%s\n", optarg);
+                                return -1;
+                        }
+                        break;
+                case 'i':
+                        opts->use_index = true;
+                        opts->index_path = optarg;
+                        break;
+                case 'm':
+                        opts->use_manifest = true;
+                        opts->manifest_path = optarg;
+                        break;
+                case OPT_STATS:
+                        if ((optarg == NULL)
+                            || (strcmp(optarg, "text") == 0)) {
+                                opts->stats = STATS_TEXT;
+                        } else if (strcmp(optarg, "json") == 0) {
+                                opts->stats = STATS_JSON;
+                        } else {
+                                fprintf(stderr, "error: invalid stats format "
+                                        "%s\n", optarg);
+                                return -1;
+                        }
+                        break;
+                case 's':
+                        opts->stream = true;
+                        break;
+                case 'b':
+                        opts->batch_path = optarg;
+                        break;
+                case OPT_PLAN:
+                        opts->plan = true;
+                        break;
+                case 'w':
+                        opts->watch_url = optarg;
+                        break;
+                case 'z':
+                        if (optarg == NULL) {
+                                opts->codec = VIPPULL_GZIP;
+                        } else if (strcmp(optarg, "deflate") == 0) {
+                                opts->codec = VIPPULL_DEFLATE;
+                        } else {
+                                fprintf(stderr, "error: invalid compression "
+                                        "%s\n", optarg);
+                                return -1;
+                        }
+                        break;
+                case 't':
+                        opts->threads = atoi(optarg);
+                        if (opts->threads < 1) {
+                                fprintf(stderr, "error: invalid thread count "
+                                        "%s\n", optarg);
+                                return -1;
+                        }
+                        break;
+                case 'f':
+                        if (format_parse(&opts->format, optarg) < 0) {
+                                fprintf(stderr, "error: invalid format %s\n",
+                                        optarg);
+                                return -1;
+                        }
+                        break;
+                case 'r':
+                        opts->recursive = true;
+                        break;
+                case OPT_INCLUDE:
+                case OPT_EXCLUDE:
+                        /* there can't be more patterns than arguments */
+                        if (opts->patterns == NULL) {
+                                opts->patterns = malloc(
+                                        argc * sizeof(*opts->patterns));
+                                if (opts->patterns == NULL) {
+                                        return -1;
+                                }
+                                opts->include = opts->patterns;
+                                opts->exclude = opts->patterns + argc;
+                        }
+                        if (opt == OPT_INCLUDE) {
+                                opts->include[opts->num_include] = optarg;
+                                opts->num_include++;
+                        } else {
+                                opts->exclude--;
+                                opts->exclude[0] = optarg;
+                                opts->num_exclude++;
+                        }
+                        break;
+                case OPT_VERIFY:
+                        opts->verify = true;
+                        if (optarg != NULL) {
+                                char *end;
+                                opts->min_size = strtoll(optarg, &end, 10);
+                                if ((*end != '\0') || (opts->min_size < 0)) {
+                                        fprintf(stderr, "error: invalid "
+                                                "size %s\n", optarg);
+                                        return -1;
+                                }
+                        }
+                        break;
+                case OPT_SCHEDULE:
+                        opts->schedule = true;
+                        if ((optarg != NULL)
+                            && (schedule_parse(&opts->policy, optarg) < 0)) {
+                                fprintf(stderr, "error: invalid schedule %s\n",
+                                        optarg);
+                                return -1;
+                        }
+                        break;
+                case OPT_LIMIT_RATE:
+                        if (parse_rate(&opts->max_rate, optarg) < 0) {
+                                fprintf(stderr, "error: invalid rate %s\n",
+                                        optarg);
+                                return -1;
+                        }
+                        break;
+                case OPT_INTERVAL:
+                        opts->interval = atoi(optarg);
+                        if (opts->interval < 1) {
+                                fprintf(stderr, "error: invalid interval "
+                                        "%s\n", optarg);
+                                return -1;
+                        }
+                        break;
+                default:
+                        return -1;
+                }
+        }
+
+        /* watching keeps its own state between checks */
+        if ((opts->watch_url != NULL)
+            && (opts->stream || opts->use_index || opts->use_manifest
+                || (opts->batch_path != NULL)
+                || (opts->codec != VIPPULL_AUTO))) {
+                fputs("error: -w can't be used with -s, -i, -m, -b or -z\n",
+                      stderr);
+                return -1;
+        }
+        /* a manifest is only stamped with the top level's times, and
+         * watching only follows the top level */
+        if (opts->recursive
+            && (opts->use_manifest || (opts->watch_url != NULL))) {
+                fputs("error: -r can't be used with -m or -w\n", stderr);
+                return -1;
+        }
+        /* files are looked up by name in music-dir itself, and streamed
+         * urls are out before the files are checked */
+        if (opts->verify
+            && (opts->recursive || opts->stream
+                || (opts->watch_url != NULL))) {
+                fputs("error: --verify can't be used with -r, -s or -w\n",
+                      stderr);
+                return -1;
+        }
+        /* the urls have to be known before they can be put in order */
+        if (opts->schedule
+            && (opts->stream || (opts->batch_path != NULL)
+                || (opts->watch_url != NULL))) {
+                fputs("error: --schedule can't be used with -s, -b or -w\n",
+                      stderr);
+                return -1;
+        }
+        if ((opts->max_rate > 0) && !opts->download) {
+                fputs("error: --limit-rate needs -d\n", stderr);
+                return -1;
+        }
+        if (!opts->recursive
+            && ((opts->num_include > 0) || (opts->num_exclude > 0))) {
+                fputs("error: --include and --exclude need -r\n", stderr);
+                return -1;
+        }
+        if ((opts->format != FORMAT_URLS)
+            && (opts->download || opts->plan)) {
+                fputs("error: -f can't be used with -d or --plan\n", stderr);
+                return -1;
+        }
+        if (opts->stream && (opts->download || (opts->batch_path != NULL))) {
+                fputs("error: -s only works when printing the urls for a "
+                      "single music-dir\n", stderr);
+                return -1;
+        }
+        /* a batch has many directories, so they can't share these */
+        if (opts->batch_path != NULL) {
+                if (opts->download) {
+                        fputs("error: -d can't be used with -b; use --plan "
+                              "to get each url once\n", stderr);
+                        return -1;
+                }
+                if (opts->manifest_path != NULL) {
+                        fputs("error: -m can't be given a file with -b\n",
+                              stderr);
+                        return -1;
+                }
+        } else if (opts->plan) {
+                fputs("error: --plan needs -b\n", stderr);
+                return -1;
+        }
+        return optind;
+}
+
+static void set_dir_config(struct vippull_dir_config *restrict config,
+                           const struct options *restrict opts,
+                           const char *restrict dirpath,
+                           struct arena *restrict arena) {
+        *config = (struct vippull_dir_config){
+                .is_recursive = opts->recursive,
+                .include = opts->include,
+                .num_include = opts->num_include,
+                .exclude = opts->exclude,
+                .num_exclude = opts->num_exclude,
+                .manifest_path = NULL,
+                .verify = opts->verify,
+                .min_size = opts->min_size,
+                .lengths_path = NULL
+        };
+        if (opts->use_manifest) {
+                config->manifest_path = (opts->manifest_path != NULL)
+                                        ? opts->manifest_path
+                                        : sibling_path(dirpath,
+                                                       MANIFEST_SUFFIX,
+                                                       arena);
+        }
+        if (opts->verify) {
+                config->lengths_path = sibling_path(dirpath, LENGTHS_SUFFIX,
+                                                    arena);
+        }
+}
+
+static void stream_track(const struct vippull_result *result,
+                         void *stream_args) {
+        const struct stream_args *args = stream_args;
+        /* whatever reads the urls can start on this one right away */
+        format_track(stdout, args->format, vippull_download_url(args->vp),
+                     args->dirpath, result);
+        fflush(stdout);
+}
+
+static int keep_result(struct vippull_result *restrict dst,
+                       const struct vippull_result *restrict result,
+                       struct arena *restrict arena) {
+        const size_t pathlen = strlen(result->path) + 1;
+        const size_t urllen = strlen(result->url) + 1;
+        char *path = arena_alloc(arena, pathlen + urllen);
+        if (path == NULL) {
+                return -1;
+        }
+        memcpy(path, result->path, pathlen);
+        memcpy(path + pathlen, result->url, urllen);
+        *dst = *result;
+        dst->path = path;
+        dst->url = path + pathlen;
+        return 0;
+}
+
+static int run_batch(const struct options *restrict opts,
+                     struct vippull *restrict vp,
+                     struct arena *restrict arena,
+                     struct stats *restrict stats) {
+        struct batch_job *jobs;
+        int num_jobs = batch_read(&jobs, opts->batch_path, arena);
+        if (num_jobs <= 0) {
+                if (num_jobs == 0) {
+                        fprintf(stderr, "no jobs in batch file %s\n",
+                                opts->batch_path);
+                }
+                return -1;
+        }
+
+        /* list every directory at once while the roster is parsed */
+        struct vippull_dir **dirs = arena_alloc(arena,
+                                                num_jobs * sizeof(*dirs));
+        if (dirs == NULL) {
+                fputs("out of memory\n", stderr);
+                return -1;
+        }
+        for (int i = 0; i < num_jobs; i++) {
+                struct vippull_dir_config config;
+                set_dir_config(&config, opts, jobs[i].dirpath, arena);
+                dirs[i] = vippull_dir_open(vp, jobs[i].dirpath, &config);
+        }
+        stats_phase(stats, "setup");
+
+        /* one parse of the roster serves every job */
+        struct vippull_read_config read_config = {
+                .codec = opts->codec,
+                .is_whole = true,
+                .index_path = NULL,
+                .stream_dir = NULL
+        };
+        if (opts->use_index) {
+                read_config.index_path = (opts->index_path != NULL)
+                                         ? opts->index_path
+                                         : sibling_path(opts->batch_path,
+                                                        INDEX_SUFFIX, arena);
+        }
+        int err_code = vippull_read_roster(vp, STDIN_FILENO, &read_config);
+        stats_phase(stats, "roster");
+
+        for (int i = 0; i < num_jobs; i++) {
+                if (dirs[i] != NULL) {
+                        vippull_dir_wait(vp, dirs[i]);
+                }
+        }
+        stats->join_wait = stats_phase(stats, "dir_join");
+        if (err_code < 0) {
+                goto cleanup;
+        }
+
+        /* compare each job's chosen tracks against its own directory */
+        struct batch_url *urls = NULL;
+        int num_urls = 0;
+        int max_urls = 0;
+        const char *download_url = vippull_download_url(vp);
+        const size_t urllen = strlen(download_url);
+        for (int i = 0; i < num_jobs; i++) {
+                if ((dirs[i] == NULL) || (vippull_dir_wait(vp, dirs[i]) < 0)) {
+                        fprintf(stderr, "failed to read directory %s\n",
+                                jobs[i].dirpath);
+                        err_code = -1;
+                        continue;
+                }
+                if ((vippull_load_export_strs(vp, jobs[i].chosen,
+                                              jobs[i].sourced) < 0)
+                    || (vippull_diff(vp, dirs[i]) < 0)) {
+                        err_code = -1;
+                        continue;
+                }
+                struct vippull_result result;
+                while (vippull_next(vp, &result)) {
+                        if (opts->plan || (opts->format == FORMAT_URLS)) {
+                                format_note_partial(jobs[i].dirpath,
+                                                    result.filename);
+                        }
+                        /* every other format names the directory in its
+                         * entries already */
+                        if (!opts->plan && (opts->format == FORMAT_URLS)) {
+                                printf("%s\t%s%s\n", jobs[i].dirpath,
+                                       download_url, result.path);
+                                continue;
+                        } else if (!opts->plan) {
+                                format_track(stdout, opts->format,
+                                             download_url, jobs[i].dirpath,
+                                             &result);
+                                continue;
+                        }
+                        /* make space if needed; the old list is left in
+                         * the arena */
+                        if (num_urls >= max_urls) {
+                                max_urls = (max_urls == 0) ? 256
+                                                           : max_urls << 1;
+                                struct batch_url *tmp = arena_alloc(
+                                                arena,
+                                                max_urls * sizeof(*tmp));
+                                if (tmp == NULL) {
+                                        fputs("out of memory\n", stderr);
+                                        err_code = -1;
+                                        goto cleanup;
+                                }
+                                if (num_urls > 0) {
+                                        memcpy(tmp, urls,
+                                               num_urls * sizeof(*tmp));
+                                }
+                                urls = tmp;
+                        }
+                        const size_t pathlen = strlen(result.path);
+                        char *url = arena_alloc(arena, urllen + pathlen + 1);
+                        if (url == NULL) {
+                                fputs("out of memory\n", stderr);
+                                err_code = -1;
+                                goto cleanup;
+                        }
+                        memcpy(url, download_url, urllen);
+                        memcpy(url + urllen, result.path, pathlen + 1);
+                        urls[num_urls] = (struct batch_url){
+                                .url = url,
+                                .dirpath = jobs[i].dirpath,
+                                .job = i
+                        };
+                        num_urls++;
+                }
+        }
+        stats_phase(stats, "diff");
+
+        /* each url once, with every directory that needs it */
+        qsort(urls, num_urls, sizeof(*urls), batch_urlcmp);
+        for (int i = 0; i < num_urls; i++) {
+                if ((i == 0) || (strcmp(urls[i].url, urls[i - 1].url) != 0)) {
+                        if (i > 0) {
+                                putchar('\n');
+                        }
+                        fputs(urls[i].url, stdout);
+                }
+                putchar('\t');
+                fputs(urls[i].dirpath, stdout);
+        }
+        if (num_urls > 0) {
+                putchar('\n');
         }
-        free(tracks);
-        free(download_url);
-        free(file_ext);
+        stats_phase(stats, "output");
 
+cleanup:
+        for (int i = 0; i < num_jobs; i++) {
+                vippull_dir_close(vp, dirs[i]);
+        }
         return err_code;
 }
 
-static void *dir_read(void *dir_namelist) {
-        struct dir_namelist *dnl = dir_namelist;
-        struct dirent **namelist;
-        dnl->num_names = scandir(dnl->dirpath, &namelist,
-                                 NULL, alphasort);
-        dnl->namelist = malloc(dnl->num_names * sizeof(*dnl->namelist));
-        for (int i = 0; i < dnl->num_names; i++) {
-                size_t strsz = strlen(namelist[i]->d_name) + 1;
-                dnl->namelist[i] = malloc(strsz);
-                memcpy(dnl->namelist[i], namelist[i]->d_name, strsz);
-                free(namelist[i]);
-        }
-        free(namelist);
-        return NULL;
+static int batch_urlcmp(const void *a, const void *b) {
+        const struct batch_url *av = a;
+        const struct batch_url *bv = b;
+        int result = strcmp(av->url, bv->url);
+        if (result != 0) {
+                return result;
+        }
+        return av->job - bv->job;
+}
+
+static void print_stats(struct stats *restrict stats,
+                        enum stats_format format,
+                        const struct vippull *restrict vp,
+                        const struct arena *restrict arena) {
+        stats_phase(stats, "drain");
+        struct vippull_stats vstats;
+        vippull_get_stats(vp, &vstats);
+        stats->roster_bytes = vstats.roster_bytes;
+        stats->drained_bytes = vstats.drained_bytes;
+        stats->num_fields = vstats.num_fields;
+        stats->num_tracks = vstats.num_tracks;
+        stats->num_allocs = vstats.num_allocs + arena->num_allocs;
+        stats->dir_entries = vstats.dir_entries;
+        stats->dir_wall = vstats.dir_wall;
+        stats->dir_cpu = vstats.dir_cpu;
+        stats_print(stats, format == STATS_JSON, stderr);
+}
+
+static void schedule_downloads(const struct options *restrict opts,
+                               struct download *restrict dls,
+                               int num_dls,
+                               const struct vippull_result *restrict results,
+                               const char *restrict download_url,
+                               const char *restrict dirpath,
+                               struct arena *restrict arena) {
+        if (num_dls == 0) {
+                return;
+        }
+        /* the sizes are asked for over as many connections as there will
+         * be downloads */
+        const int num_unknown = download_probe(dls, num_dls, opts->jobs);
+        if (num_unknown < 0) {
+                fputs("failed to ask for the sizes of tracks\n", stderr);
+        }
+        struct schedule_item *items = arena_alloc(arena, num_dls
+                                                  * sizeof(*items));
+        long long *lane_bytes = arena_alloc(arena, opts->jobs
+                                            * sizeof(*lane_bytes));
+        struct download *ordered = opts->download
+                                   ? arena_alloc(arena, num_dls
+                                                 * sizeof(*ordered))
+                                   : NULL;
+        if ((items == NULL) || (lane_bytes == NULL)
+            || (opts->download && (ordered == NULL))) {
+                /* the tracks still go out, just by id */
+                fputs("out of memory; not scheduling downloads\n", stderr);
+                if (!opts->download) {
+                        for (int i = 0; i < num_dls; i++) {
+                                format_track(stdout, opts->format,
+                                             download_url, dirpath,
+                                             &results[i]);
+                        }
+                }
+                return;
+        }
+        for (int i = 0; i < num_dls; i++) {
+                items[i] = (struct schedule_item){
+                        .index = i,
+                        .size = dls[i].size
+                };
+        }
+        const long long max_bytes = schedule_plan(items, num_dls, lane_bytes,
+                                                  opts->jobs, opts->policy);
+
+        long long total_bytes = 0;
+        for (int i = 0; i < opts->jobs; i++) {
+                total_bytes += lane_bytes[i];
+        }
+        fprintf(stderr, "scheduled %d tracks of %lld bytes over %d lanes, "
+                "at most %lld bytes in one", num_dls, total_bytes,
+                opts->jobs, max_bytes);
+        if (num_unknown > 0) {
+                fprintf(stderr, "; %d sizes guessed", num_unknown);
+        }
+        /* each lane gets its share of the rate */
+        if (opts->max_rate > 0) {
+                fprintf(stderr, "; about %llds at %lld bytes/s",
+                        max_bytes * opts->jobs / opts->max_rate,
+                        opts->max_rate);
+        }
+        fputc('\n', stderr);
+
+        if (!opts->download) {
+                for (int i = 0; i < num_dls; i++) {
+                        if (opts->format == FORMAT_URLS) {
+                                printf("%d\t", items[i].lane + 1);
+                        }
+                        format_track(stdout, opts->format, download_url,
+                                     dirpath, &results[items[i].index]);
+                }
+                return;
+        }
+        /* download_all starts them in this order, each as soon as any
+         * transfer finishes. the lanes are only advisory: they're what each
+         * transfer would get if they all went at the same speed, which they
+         * rarely do */
+        for (int i = 0; i < num_dls; i++) {
+                ordered[i] = dls[items[i].index];
+        }
+        memcpy(dls, ordered, num_dls * sizeof(*dls));
+}
+
+static int parse_rate(long long *restrict rate,
+                      const char *restrict str) {
+        char *end;
+        *rate = strtoll(str, &end, 10);
+        if ((end == str) || (*rate < 1)) {
+                return -1;
+        }
+        /* binary multiples, like curl's --limit-rate */
+        switch (*end) {
+        case 'G':
+        case 'g':
+                *rate <<= 10;
+                /* fall through */
+        case 'M':
+        case 'm':
+                *rate <<= 10;
+                /* fall through */
+        case 'K':
+        case 'k':
+                *rate <<= 10;
+                end++;
+                break;
+        default:
+                break;
+        }
+        return (*end == '\0') ? 0 : -1;
+}
+
+static char *sibling_path(const char *restrict dirpath,
+                          const char *restrict suffix,
+                          struct arena *restrict arena) {
+        /* files about the directory sit next to it, not in it */
+        char *realdir = realpath(dirpath, NULL);
+        const char *dir = (realdir != NULL) ? realdir : dirpath;
+        size_t dirlen = strlen(dir);
+        while ((dirlen > 1) && (dir[dirlen - 1] == '/')) {
+                dirlen--;
+        }
+        size_t suffixlen = strlen(suffix);
+        char *path = arena_alloc(arena, dirlen + suffixlen + 1);
+        memcpy(path, dir, dirlen);
+        memcpy(path + dirlen, suffix, suffixlen + 1);
+        free(realdir);
+        return path;
 }
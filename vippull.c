@@ -0,0 +1,746 @@
+#include "vippull.h"
+#include "json-parse.h"
+#include "json-buf.h"
+#include "roster.h"
+#include "dir.h"
+#include "verify.h"
+#include "nameset.h"
+#include "idset.h"
+#include "arena.h"
+#include "pool.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct vippull {
+        struct pool pool;
+        /* the roster */
+        struct roster roster;     // every track, if has_roster
+        bool has_roster;
+        const char *download_url; // of the last roster read, or NULL
+        struct json_buf jb;       // roster being read from a file
+        bool has_jb;              // descriptor, until it's drained
+        struct arena read_arena;  // url, ext and filenames of a read that
+                                  // only parsed the chosen tracks
+        struct track *found;      // the chosen tracks that read found
+        int num_found;
+        bool has_found;
+        /* the exports */
+        struct arena arena;       // chosen and its set
+        struct idset chosen_set;
+        struct track *chosen;     // by slot in chosen_set, no filenames
+        int num_chosen;
+        bool has_exports;
+        /* the last diff */
+        struct arena diff_arena;  // filenames of missing
+        struct track *missing;
+        int num_missing;
+        int max_missing;
+        int next;                 // index of the next result
+        struct nameset names;     // names vippull_diff_names was given
+        char *buf;                // path and url of the current result
+        size_t buf_cap;
+        struct vippull_stats stats;
+};
+struct vippull_dir {
+        struct dir_namelist dnl;
+        struct dir_filter filter;
+        struct pool_task task;    // dir_read, until is_joined
+        bool is_joined;
+        bool verify;
+        long long min_size;
+        const char *lengths_path; // NULL if lengths aren't recorded
+        struct verify_lengths lengths; // recorded so far, in dnl's arena
+        struct verify_length *added; // given to vippull_dir_add since
+        int num_added;
+        int max_added;
+};
+/* get_all_tracks callback for reads with an on_missing */
+struct stream_args {
+        struct vippull *vp;
+        const struct vippull_read_config *config;
+};
+
+/* the codecs are json_buf's, under their public names */
+static enum json_buf_codec codec_of(enum vippull_codec codec);
+/* forgets the roster and the last diff, before reading another one */
+static void roster_start(struct vippull *vp);
+/* parses every track in the roster */
+static int read_whole(struct vippull *vp);
+/* gets the roster from the index at index_path if the roster is the one it
+ * was built from; otherwise parses the roster and rebuilds the index */
+static int read_index(struct vippull *restrict vp,
+                      const char *restrict index_path);
+/* parses the chosen tracks, stopping once they're all found */
+static int read_chosen(struct vippull *restrict vp,
+                       const struct vippull_read_config *restrict config);
+static void stream_track(const struct track *track,
+                         void *stream_args);
+/* waits for the listing, unless that's already been done, and loads the
+ * lengths recorded for it; returns -1 if it can't be read */
+static int dir_join(struct vippull *restrict vp,
+                    struct vippull_dir *restrict dir);
+/* copies the chosen tracks into missing and fills in their filenames from
+ * the roster; returns how many the roster has, or -1 */
+static int diff_start(struct vippull *vp);
+/* fills in result for track, with its path and url in the context's
+ * buffer */
+static int make_result(struct vippull *restrict vp,
+                       struct vippull_result *restrict result,
+                       const struct track *restrict track);
+/* writes str to dst with everything but unreserved characters and '/'
+ * percent-escaped; dst needs room for 3 * strlen(str) + 1 characters.
+ * returns a pointer to the null terminator written */
+static char *url_escape(char *restrict dst,
+                        const char *restrict str);
+
+struct vippull *vippull_new(int num_threads) {
+        struct vippull *vp = malloc(sizeof(*vp));
+        if (vp == NULL) {
+                return NULL;
+        }
+        *vp = (struct vippull){.has_roster = false};
+        pool_init(&vp->pool, num_threads);
+        roster_init(&vp->roster);
+        arena_init(&vp->read_arena);
+        arena_init(&vp->arena);
+        arena_init(&vp->diff_arena);
+        nameset_init(&vp->names);
+        return vp;
+}
+
+void vippull_free(struct vippull *vp) {
+        if (vp == NULL) {
+                return;
+        }
+        pool_free(&vp->pool);
+        if (vp->has_jb) {
+                json_buf_close(&vp->jb);
+        }
+        roster_free(&vp->roster);
+        arena_free(&vp->read_arena);
+        arena_free(&vp->arena);
+        arena_free(&vp->diff_arena);
+        nameset_free(&vp->names);
+        free(vp->missing);
+        free(vp->buf);
+        free(vp);
+}
+
+int vippull_load_roster(struct vippull *restrict vp,
+                        const void *restrict data,
+                        size_t len) {
+        /* a sync that polls usually gets the same roster again */
+        const uint64_t hash = roster_hash(data, len);
+        if (vp->has_roster && (vp->roster.hash == hash)
+            && (vp->roster.len == len)) {
+                return 0;
+        }
+
+        roster_start(vp);
+        struct json_buf jb;
+        if (json_buf_open_mem(&jb, data, len, JSON_BUF_AUTO) < 0) {
+                return -1;
+        }
+        /* the url and ext are copied out of the read arena into the
+         * roster */
+        arena_reset(&vp->read_arena);
+        int err_code = get_roster(&vp->roster, &vp->pool, &vp->read_arena,
+                                  &jb);
+        vp->stats.roster_bytes = json_buf_offset(&jb);
+        vp->stats.roster_len = len;
+        vp->stats.num_fields = jb.num_fields;
+        vp->stats.num_tracks = jb.num_tracks;
+        json_buf_close(&jb);
+        if (err_code < 0) {
+                roster_reset(&vp->roster);
+                return -1;
+        }
+        vp->roster.hash = hash;
+        vp->roster.len = len;
+        vp->has_roster = true;
+        vp->download_url = vp->roster.url;
+        vp->stats.num_ids = vp->roster.num_entries;
+        return 1;
+}
+
+int vippull_read_roster(struct vippull *restrict vp,
+                        int fd,
+                        const struct vippull_read_config *restrict config) {
+        roster_start(vp);
+        if (json_buf_open(&vp->jb, fd, codec_of(config->codec)) < 0) {
+                fputs("failed to set up input buffer\n", stderr);
+                return -1;
+        }
+        vp->has_jb = true;
+
+        /* only the chosen tracks can be picked out of the roster, so
+         * without exports the whole of it is needed */
+        int err_code;
+        if (config->index_path != NULL) {
+                err_code = read_index(vp, config->index_path);
+        } else if (config->is_whole || !vp->has_exports) {
+                err_code = read_whole(vp);
+        } else {
+                err_code = read_chosen(vp, config);
+        }
+        vp->stats.roster_bytes = json_buf_offset(&vp->jb);
+        vp->stats.roster_len = vp->jb.is_mapped ? vp->jb.len : 0;
+        vp->stats.is_cut_short = !json_buf_at_end(&vp->jb);
+        vp->stats.num_fields = vp->jb.num_fields;
+        vp->stats.num_tracks = vp->jb.num_tracks;
+        /* the input stays open for vippull_drain */
+        if ((err_code < 0) || vp->jb.has_error) {
+                vp->has_roster = false;
+                vp->has_found = false;
+                vp->download_url = NULL;
+                return -1;
+        }
+        if (vp->has_roster) {
+                vp->stats.num_ids = vp->roster.num_entries;
+        }
+
+        /* a whole roster has to be parsed before anything is known to be
+         * missing */
+        if (vp->has_roster && (config->stream_dir != NULL)
+            && (config->on_missing != NULL) && vp->has_exports) {
+                if (vippull_diff(vp, config->stream_dir) < 0) {
+                        return -1;
+                }
+                struct vippull_result result;
+                while (vippull_next(vp, &result)) {
+                        config->on_missing(&result, config->arg);
+                }
+                vippull_rewind(vp);
+        }
+        return 0;
+}
+
+size_t vippull_drain(struct vippull *vp) {
+        if (!vp->has_jb) {
+                return 0;
+        }
+        const size_t num_bytes = json_buf_drain(&vp->jb);
+        json_buf_close(&vp->jb);
+        vp->has_jb = false;
+        vp->stats.drained_bytes += num_bytes;
+        return num_bytes;
+}
+
+const char *vippull_download_url(const struct vippull *vp) {
+        return vp->download_url;
+}
+
+int vippull_load_exports(struct vippull *restrict vp,
+                         const int *restrict chosen,
+                         int num_chosen,
+                         const int *restrict sourced,
+                         int num_sourced) {
+        arena_reset(&vp->arena);
+        vp->has_exports = false;
+        vp->has_found = false;
+        vp->num_missing = 0;
+        vp->next = 0;
+
+        /* same as init_tracks, without the strings */
+        struct idset sourced_set;
+        idset_build(&vp->chosen_set, chosen, num_chosen, &vp->arena);
+        idset_build(&sourced_set, sourced, num_sourced, &vp->arena);
+        vp->num_chosen = vp->chosen_set.num_ids;
+        vp->chosen = arena_alloc(&vp->arena,
+                                 vp->num_chosen * sizeof(*vp->chosen));
+        if (vp->chosen == NULL) {
+                return -1;
+        }
+        for (int i = 0; i < vp->num_chosen; i++) {
+                const int id = vp->chosen_set.ids[i];
+                vp->chosen[i] = (struct track){
+                        .filename = NULL,
+                        .id = id,
+                        .is_sourced = idset_contains(&sourced_set, id)
+                };
+        }
+        vp->has_exports = true;
+        return 0;
+}
+
+int vippull_load_export_strs(struct vippull *restrict vp,
+                             const char *restrict chosen,
+                             const char *restrict sourced) {
+        arena_reset(&vp->arena);
+        vp->has_exports = false;
+        vp->has_found = false;
+        vp->num_missing = 0;
+        vp->next = 0;
+        vp->num_chosen = init_tracks(&vp->chosen, &vp->chosen_set, chosen,
+                                     sourced, &vp->pool, &vp->arena);
+        if (vp->num_chosen < 0) {
+                vp->num_chosen = 0;
+                return -1;
+        }
+        vp->has_exports = true;
+        return 0;
+}
+
+struct vippull_dir *vippull_dir_open(
+                struct vippull *restrict vp,
+                const char *restrict dirpath,
+                const struct vippull_dir_config *restrict config) {
+        struct vippull_dir *dir = malloc(sizeof(*dir));
+        if (dir == NULL) {
+                return NULL;
+        }
+        const struct vippull_dir_config top_level = {.is_recursive = false};
+        if (config == NULL) {
+                config = &top_level;
+        }
+        *dir = (struct vippull_dir){
+                .filter = {
+                        .include = config->include,
+                        .num_include = config->num_include,
+                        .exclude = config->exclude,
+                        .num_exclude = config->num_exclude
+                },
+                .is_joined = false,
+                .verify = config->verify,
+                .min_size = config->min_size,
+                .lengths_path = config->verify ? config->lengths_path : NULL,
+                .added = NULL
+        };
+        dir->dnl = (struct dir_namelist){
+                .dirpath = dirpath,
+                .manifest_path = config->manifest_path,
+                .is_recursive = config->is_recursive,
+                .filter = &dir->filter,
+                .pool = &vp->pool
+        };
+        pool_submit(&vp->pool, &dir->task, dir_read, &dir->dnl);
+        return dir;
+}
+
+int vippull_dir_wait(struct vippull *restrict vp,
+                     struct vippull_dir *restrict dir) {
+        if (dir_join(vp, dir) < 0) {
+                return -1;
+        }
+        return dir->dnl.num_names;
+}
+
+bool vippull_dir_check(struct vippull_dir *dir) {
+        if (!dir->is_joined || (dir->dnl.num_names == 0)) {
+                return false;
+        }
+        return (dir->dnl.manifest_path == NULL)
+               || manifest_check(&dir->dnl.manifest);
+}
+
+int vippull_dir_add(struct vippull_dir *restrict dir,
+                    const char *restrict filename,
+                    long long length) {
+        if (!dir->is_joined || (dir->dnl.num_names == 0)) {
+                return -1;
+        }
+        if ((dir->dnl.manifest_path != NULL)
+            && (manifest_add(&dir->dnl.manifest, filename) < 0)) {
+                return -1;
+        }
+        if (dir->lengths_path == NULL) {
+                return 0;
+        }
+        if (dir->num_added >= dir->max_added) {
+                int max_added = (dir->max_added == 0) ? 64
+                                                      : dir->max_added << 1;
+                struct verify_length *tmp = realloc(dir->added, max_added
+                                                    * sizeof(*tmp));
+                if (tmp == NULL) {
+                        return -1;
+                }
+                dir->added = tmp;
+                dir->max_added = max_added;
+        }
+        const size_t size = strlen(filename) + 1;
+        char *name = arena_alloc(&dir->dnl.arena, size);
+        if (name == NULL) {
+                return -1;
+        }
+        memcpy(name, filename, size);
+        dir->added[dir->num_added] = (struct verify_length){
+                .name = name,
+                .length = length,
+                .order = dir->num_added
+        };
+        dir->num_added++;
+        return 0;
+}
+
+int vippull_dir_save(struct vippull_dir *dir) {
+        if (!dir->is_joined || (dir->dnl.num_names == 0)) {
+                return -1;
+        }
+        int err_code = 0;
+        /* record what's been added instead of listing the directory again
+         * next time */
+        if ((dir->dnl.manifest_path != NULL)
+            && (manifest_save(&dir->dnl.manifest) < 0)) {
+                fprintf(stderr, "failed to write manifest %s\n",
+                        dir->dnl.manifest_path);
+                err_code = -1;
+        }
+        /* and how long each file is, to check it against later */
+        if ((dir->lengths_path != NULL)
+            && (verify_lengths_save(dir->lengths_path, &dir->lengths,
+                                    dir->added, dir->num_added) < 0)) {
+                fprintf(stderr, "failed to write lengths %s\n",
+                        dir->lengths_path);
+                err_code = -1;
+        }
+        return err_code;
+}
+
+void vippull_dir_close(struct vippull *restrict vp,
+                       struct vippull_dir *restrict dir) {
+        if (dir == NULL) {
+                return;
+        }
+        /* the listing can't be left running on what's freed */
+        if (!dir->is_joined) {
+                pool_wait(&vp->pool, &dir->task);
+        }
+        dir_free(&dir->dnl);
+        arena_free(&dir->dnl.arena);
+        free(dir->added);
+        free(dir);
+}
+
+int vippull_diff(struct vippull *restrict vp,
+                 struct vippull_dir *restrict dir) {
+        /* the filenames are looked up while the directory is still being
+         * listed, if it is */
+        int num_missing = diff_start(vp);
+        if ((num_missing < 0) || (dir_join(vp, dir) < 0)) {
+                vp->num_missing = 0;
+                return -1;
+        }
+        if (dir->verify) {
+                num_missing = verify_missing(&dir->dnl, vp->missing,
+                                             num_missing, dir->min_size,
+                                             &dir->lengths, &vp->pool);
+        } else {
+                num_missing = dir_missing(&dir->dnl, vp->missing,
+                                          num_missing);
+        }
+        vp->num_missing = (num_missing > 0) ? num_missing : 0;
+        return num_missing;
+}
+
+int vippull_diff_dir(struct vippull *restrict vp,
+                     const char *restrict dirpath,
+                     bool is_recursive) {
+        const struct vippull_dir_config config = {
+                .is_recursive = is_recursive
+        };
+        struct vippull_dir *dir = vippull_dir_open(vp, dirpath, &config);
+        if (dir == NULL) {
+                return -1;
+        }
+        const int num_missing = vippull_diff(vp, dir);
+        vippull_dir_close(vp, dir);
+        return num_missing;
+}
+
+int vippull_diff_names(struct vippull *restrict vp,
+                       const char *const *restrict names,
+                       int num_names) {
+        nameset_reset(&vp->names);
+        for (int i = 0; i < num_names; i++) {
+                if (nameset_add(&vp->names, names[i], strlen(names[i]))
+                    < 0) {
+                        vp->num_missing = 0;
+                        return -1;
+                }
+        }
+        int num_tracks = diff_start(vp);
+        if (num_tracks < 0) {
+                return -1;
+        }
+        int num_missing = 0;
+        for (int i = 0; i < num_tracks; i++) {
+                if (!nameset_contains(&vp->names, vp->missing[i].filename)) {
+                        vp->missing[num_missing] = vp->missing[i];
+                        num_missing++;
+                }
+        }
+        vp->num_missing = num_missing;
+        return num_missing;
+}
+
+bool vippull_next(struct vippull *restrict vp,
+                  struct vippull_result *restrict result) {
+        if (vp->next >= vp->num_missing) {
+                return false;
+        }
+        const struct track *track = &vp->missing[vp->next];
+        vp->next++;
+        return (make_result(vp, result, track) == 0);
+}
+
+void vippull_rewind(struct vippull *vp) {
+        vp->next = 0;
+}
+
+void vippull_get_stats(const struct vippull *restrict vp,
+                       struct vippull_stats *restrict stats) {
+        *stats = vp->stats;
+        stats->num_allocs = vp->read_arena.num_allocs + vp->arena.num_allocs
+                            + vp->diff_arena.num_allocs;
+}
+
+static enum json_buf_codec codec_of(enum vippull_codec codec) {
+        switch (codec) {
+        case VIPPULL_PLAIN:
+                return JSON_BUF_PLAIN;
+        case VIPPULL_GZIP:
+                return JSON_BUF_GZIP;
+        case VIPPULL_DEFLATE:
+                return JSON_BUF_DEFLATE;
+        default:
+                return JSON_BUF_AUTO;
+        }
+}
+
+static void roster_start(struct vippull *vp) {
+        if (vp->has_jb) {
+                json_buf_close(&vp->jb);
+                vp->has_jb = false;
+        }
+        vp->has_roster = false;
+        vp->has_found = false;
+        vp->download_url = NULL;
+        vp->num_missing = 0;
+        vp->next = 0;
+        vp->stats.roster_bytes = 0;
+        vp->stats.roster_len = 0;
+        vp->stats.is_cut_short = false;
+        vp->stats.drained_bytes = 0;
+        vp->stats.num_ids = 0;
+        vp->stats.num_fields = 0;
+        vp->stats.num_tracks = 0;
+}
+
+static int read_whole(struct vippull *vp) {
+        arena_reset(&vp->read_arena);
+        if (get_roster(&vp->roster, &vp->pool, &vp->read_arena,
+                       &vp->jb) < 0) {
+                roster_reset(&vp->roster);
+                fputs("failed to parse roster\n", stderr);
+                return -1;
+        }
+        vp->has_roster = true;
+        vp->download_url = vp->roster.url;
+        return 0;
+}
+
+static int read_index(struct vippull *restrict vp,
+                      const char *restrict index_path) {
+        /* the whole roster is needed to tell whether it changed */
+        struct json_buf *jb = &vp->jb;
+        if (json_buf_slurp(jb) < 0) {
+                fputs("failed to parse roster\n", stderr);
+                return -1;
+        }
+        const size_t len = jb->len - jb->pos;
+        const uint64_t hash = roster_hash(jb->data + jb->pos, len);
+
+        struct roster old_roster;
+        bool has_old = (roster_load(&old_roster, index_path) == 0);
+        if (has_old && (old_roster.hash == hash) && (old_roster.len == len)) {
+                roster_free(&vp->roster);
+                vp->roster = old_roster;
+                vp->has_roster = true;
+                vp->download_url = vp->roster.url;
+                jb->pos = jb->len;
+                return 0;
+        }
+
+        if (read_whole(vp) < 0) {
+                if (has_old) {
+                        roster_free(&old_roster);
+                }
+                return -1;
+        }
+        vp->roster.hash = hash;
+        vp->roster.len = len;
+        if (has_old) {
+                roster_diff(&old_roster, &vp->roster, stderr);
+                roster_free(&old_roster);
+        }
+        if (roster_save(&vp->roster, index_path) < 0) {
+                fprintf(stderr, "failed to write roster index %s\n",
+                        index_path);
+        }
+        return 0;
+}
+
+static int read_chosen(struct vippull *restrict vp,
+                       const struct vippull_read_config *restrict config) {
+        arena_reset(&vp->read_arena);
+        char *url;
+        char *file_ext;
+        if (get_url_ext(&url, &file_ext, &vp->read_arena, &vp->jb) < 0) {
+                fputs("failed to parse download url or file extension\n",
+                      stderr);
+                return -1;
+        }
+        vp->download_url = url;
+        vp->found = arena_alloc(&vp->read_arena,
+                                vp->num_chosen * sizeof(*vp->found));
+        if ((vp->found == NULL) && (vp->num_chosen > 0)) {
+                fputs("out of memory\n", stderr);
+                return -1;
+        }
+        if (vp->num_chosen > 0) {
+                memcpy(vp->found, vp->chosen,
+                       vp->num_chosen * sizeof(*vp->found));
+        }
+
+        /* to report tracks as they're parsed, the directory has to be known
+         * before the roster is read */
+        const bool is_streamed = (config->stream_dir != NULL)
+                                 && (config->on_missing != NULL);
+        if (is_streamed && (dir_join(vp, config->stream_dir) < 0)) {
+                return -1;
+        }
+        struct stream_args stream = {
+                .vp = vp,
+                .config = config
+        };
+        vp->num_found = get_all_tracks(vp->found, &vp->chosen_set, file_ext,
+                                       is_streamed ? stream_track : NULL,
+                                       &stream, &vp->pool, &vp->read_arena,
+                                       &vp->jb);
+        vp->has_found = true;
+        return 0;
+}
+
+static void stream_track(const struct track *track,
+                         void *stream_args) {
+        const struct stream_args *args = stream_args;
+        if (dir_has(&args->config->stream_dir->dnl, track->filename)) {
+                return;
+        }
+        /* whatever handles the results can start on this one right away */
+        struct vippull_result result;
+        if (make_result(args->vp, &result, track) == 0) {
+                args->config->on_missing(&result, args->config->arg);
+        }
+}
+
+static int dir_join(struct vippull *restrict vp,
+                    struct vippull_dir *restrict dir) {
+        struct dir_namelist *dnl = &dir->dnl;
+        if (!dir->is_joined) {
+                pool_wait(&vp->pool, &dir->task);
+                dir->is_joined = true;
+                vp->stats.dir_entries += dnl->num_names;
+                if (dnl->elapsed.wall > vp->stats.dir_wall) {
+                        vp->stats.dir_wall = dnl->elapsed.wall;
+                }
+                vp->stats.dir_cpu += dnl->elapsed.cpu;
+
+                dir->lengths = (struct verify_lengths){.num_entries = 0};
+                if ((dir->lengths_path != NULL) && (dnl->num_names != 0)
+                    && (verify_lengths_load(&dir->lengths, dir->lengths_path,
+                                            &dnl->arena) < 0)) {
+                        /* and leave it be rather than write over it */
+                        fprintf(stderr, "failed to read lengths %s\n",
+                                dir->lengths_path);
+                        dir->lengths_path = NULL;
+                }
+        }
+        return (dnl->num_names == 0) ? -1 : 0;
+}
+
+static int diff_start(struct vippull *vp) {
+        vp->num_missing = 0;
+        vp->next = 0;
+        if (!vp->has_exports || (!vp->has_roster && !vp->has_found)) {
+                return -1;
+        }
+        const int num_tracks = vp->has_roster ? vp->num_chosen
+                                              : vp->num_found;
+        if (num_tracks > vp->max_missing) {
+                struct track *tmp = realloc(vp->missing, num_tracks
+                                            * sizeof(*tmp));
+                if (tmp == NULL) {
+                        return -1;
+                }
+                vp->missing = tmp;
+                vp->max_missing = num_tracks;
+        }
+        if (num_tracks == 0) {
+                return 0;
+        }
+        /* a read of just the chosen tracks has found their filenames
+         * already */
+        if (!vp->has_roster) {
+                memcpy(vp->missing, vp->found,
+                       num_tracks * sizeof(*vp->missing));
+                return num_tracks;
+        }
+        memcpy(vp->missing, vp->chosen, num_tracks * sizeof(*vp->missing));
+        arena_reset(&vp->diff_arena);
+        return roster_get_tracks(vp->missing, num_tracks, &vp->roster,
+                                 &vp->diff_arena);
+}
+
+static int make_result(struct vippull *restrict vp,
+                       struct vippull_result *restrict result,
+                       const struct track *restrict track) {
+        const char *src_dir = track->is_sourced ? VIP_SRC_DIR : "";
+        const size_t dirlen = strlen(src_dir);
+        const size_t filelen = strlen(track->filename);
+        const size_t urllen = strlen(vp->download_url);
+        /* the path, then the url with the path escaped */
+        const size_t size = dirlen + filelen + 1
+                            + urllen + 3 * (dirlen + filelen) + 1;
+        if (size > vp->buf_cap) {
+                char *tmp = realloc(vp->buf, size * sizeof(*tmp));
+                if (tmp == NULL) {
+                        return -1;
+                }
+                vp->buf = tmp;
+                vp->buf_cap = size;
+        }
+        char *path = vp->buf;
+        memcpy(path, src_dir, dirlen);
+        memcpy(path + dirlen, track->filename, filelen + 1);
+        char *url = path + dirlen + filelen + 1;
+        memcpy(url, vp->download_url, urllen);
+        url_escape(url + urllen, path);
+        *result = (struct vippull_result){
+                .id = track->id,
+                .is_sourced = track->is_sourced,
+                .filename = track->filename,
+                .path = path,
+                .url = url
+        };
+        return 0;
+}
+
+static char *url_escape(char *restrict dst,
+                        const char *restrict str) {
+        static const char hex[] = "0123456789ABCDEF";
+        for (; *str != '\0'; str++) {
+                unsigned char ch = *str;
+                if (isalnum(ch) || (strchr("-._~/", ch) != NULL)) {
+                        *dst++ = ch;
+                } else {
+                        *dst++ = '%';
+                        *dst++ = hex[ch >> 4];
+                        *dst++ = hex[ch & 0xf];
+                }
+        }
+        *dst = '\0';
+        return dst;
+}
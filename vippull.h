@@ -0,0 +1,173 @@
+#ifndef VIPPULL_H
+#define VIPPULL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* what vip-pull does, for programs that sync from inside one process: load
+ * a roster from memory or a file descriptor, load the exports, diff them
+ * against a directory or a set of names, then go through the tracks that
+ * are missing. all state is in the context, so contexts can be used from
+ * different threads at once, and its buffers are kept between calls so
+ * repeated syncs allocate next to nothing. vip-pull itself is built on
+ * this */
+
+/* what the shared library exports; everything else in it is hidden */
+#define VIPPULL_API      __attribute__((visibility("default")))
+
+struct vippull;
+/* a music directory, listed in the background from when it's opened */
+struct vippull_dir;
+
+/* how a roster read from a file descriptor is encoded */
+enum vippull_codec {
+        VIPPULL_AUTO = 0,         // compressed if it starts like gzip or zlib
+        VIPPULL_PLAIN,
+        VIPPULL_GZIP,             // gzip or zlib
+        VIPPULL_DEFLATE           // raw deflate, or zlib
+};
+/* a track missing from the directory */
+struct vippull_result {
+        int id;
+        bool is_sourced;
+        const char *filename;     // with the extension; valid until the next
+                                  // load or diff
+        const char *path;         // where it is under the download url, not
+                                  // escaped; valid until the next result
+        const char *url;          // escaped download url; valid until the
+                                  // next result
+};
+/* called with each missing track as soon as it's known */
+typedef void vippull_result_fn(const struct vippull_result *result,
+                               void *arg);
+struct vippull_read_config {
+        enum vippull_codec codec;
+        bool is_whole;            // parse every track, so that any exports
+                                  // can be diffed against it later; other
+                                  // reads only parse the chosen tracks and
+                                  // stop once they're all found
+        const char *index_path;   // keep a binary index of the roster here
+                                  // and skip parsing it when it hasn't
+                                  // changed, or NULL; implies is_whole
+        struct vippull_dir *stream_dir; // if not NULL, on_missing is called
+        vippull_result_fn *on_missing;  // with each chosen track missing
+        void *arg;                      // from it as soon as it's parsed
+};
+struct vippull_dir_config {
+        bool is_recursive;        // also look in every subdirectory
+        const char *const *include; // with is_recursive, only count files
+        int num_include;            // matching one of these shell patterns,
+                                    // if there are any
+        const char *const *exclude; // with is_recursive, skip files and
+        int num_exclude;            // directories matching any of these
+        const char *manifest_path; // keep the names in the directory here
+                                   // and only list it again once it has
+                                   // changed, or NULL; not with is_recursive
+        bool verify;              // count files that are too small, or not
+                                  // the length recorded, as missing
+        long long min_size;       // with verify, the smallest a file can be
+        const char *lengths_path; // with verify, where vippull_dir_add
+                                  // records lengths, or NULL
+};
+/* counts for the last roster read and every directory waited for */
+struct vippull_stats {
+        size_t roster_bytes;      // roster parsed, or hashed for the index
+        size_t roster_len;        // whole roster, if known up front, or 0
+        bool is_cut_short;        // parsing stopped once every chosen track
+                                  // was found
+        size_t drained_bytes;     // roster thrown away by vippull_drain
+        int num_ids;              // distinct ids, if the roster was whole
+        size_t num_fields;
+        size_t num_tracks;
+        size_t num_allocs;
+        size_t dir_entries;
+        double dir_wall;          // longest any directory took to list
+        double dir_cpu;           // cpu time all of them took
+};
+
+/* starts num_threads threads, or one per online cpu if num_threads < 1;
+ * returns NULL if out of memory */
+VIPPULL_API struct vippull *vippull_new(int num_threads);
+VIPPULL_API void vippull_free(struct vippull *vp);
+
+/* parses the roster in data, plain json or gzip or zlib compressed; data
+ * isn't needed once this returns. returns 1 if it was parsed, 0 if it's the
+ * roster loaded last time, which isn't parsed again, or -1 if it can't be
+ * parsed */
+VIPPULL_API int vippull_load_roster(struct vippull *restrict vp,
+                                    const void *restrict data,
+                                    size_t len);
+/* reads the roster from fd, as config says; whatever of it isn't needed is
+ * left unread until vippull_drain. on_missing is called for whole rosters
+ * too, once they're parsed. returns -1 if it can't be parsed */
+VIPPULL_API int vippull_read_roster(
+                struct vippull *restrict vp,
+                int fd,
+                const struct vippull_read_config *restrict config);
+/* reads and throws away the rest of the roster being read from a file
+ * descriptor, so whatever is writing it doesn't get SIGPIPE; returns the
+ * number of bytes thrown away */
+VIPPULL_API size_t vippull_drain(struct vippull *vp);
+/* url the tracks of the last roster loaded are under, or NULL */
+VIPPULL_API const char *vippull_download_url(const struct vippull *vp);
+
+/* sets the chosen and sourced ids, in any order and with duplicates */
+VIPPULL_API int vippull_load_exports(struct vippull *restrict vp,
+                                     const int *restrict chosen,
+                                     int num_chosen,
+                                     const int *restrict sourced,
+                                     int num_sourced);
+/* sets them from export strings of comma or whitespace separated ids, or
+ * "@path" to read one from a file; returns -1 if one can't be read */
+VIPPULL_API int vippull_load_export_strs(struct vippull *restrict vp,
+                                         const char *restrict chosen,
+                                         const char *restrict sourced);
+
+/* starts listing dirpath on the context's threads; config is copied, but
+ * the strings it points to have to last until vippull_dir_close. NULL for
+ * config lists just the top level. returns NULL if out of memory */
+VIPPULL_API struct vippull_dir *vippull_dir_open(
+                struct vippull *restrict vp,
+                const char *restrict dirpath,
+                const struct vippull_dir_config *restrict config);
+/* waits for the listing; returns the number of names in the directory, or
+ * -1 if it can't be read */
+VIPPULL_API int vippull_dir_wait(struct vippull *restrict vp,
+                                 struct vippull_dir *restrict dir);
+/* checks that the directory hasn't changed since it was listed, for a
+ * manifest; called right before putting files in it */
+VIPPULL_API bool vippull_dir_check(struct vippull_dir *dir);
+/* records a file of length bytes just put in the directory */
+VIPPULL_API int vippull_dir_add(struct vippull_dir *restrict dir,
+                                const char *restrict filename,
+                                long long length);
+/* writes the manifest and lengths back, if anything was added */
+VIPPULL_API int vippull_dir_save(struct vippull_dir *dir);
+VIPPULL_API void vippull_dir_close(struct vippull *restrict vp,
+                                   struct vippull_dir *restrict dir);
+
+/* finds the chosen tracks whose files aren't in the directory; returns how
+ * many there are, or -1 if nothing has been loaded or the directory can't
+ * be read */
+VIPPULL_API int vippull_diff(struct vippull *restrict vp,
+                             struct vippull_dir *restrict dir);
+/* works like vippull_diff, against dirpath, or anywhere under it if
+ * is_recursive */
+VIPPULL_API int vippull_diff_dir(struct vippull *restrict vp,
+                                 const char *restrict dirpath,
+                                 bool is_recursive);
+/* works like vippull_diff, against names instead of a directory */
+VIPPULL_API int vippull_diff_names(struct vippull *restrict vp,
+                                   const char *const *restrict names,
+                                   int num_names);
+/* gets the next track missing in the last diff; returns false after the
+ * last one */
+VIPPULL_API bool vippull_next(struct vippull *restrict vp,
+                              struct vippull_result *restrict result);
+/* goes back to the first result of the last diff */
+VIPPULL_API void vippull_rewind(struct vippull *vp);
+
+VIPPULL_API void vippull_get_stats(const struct vippull *restrict vp,
+                                   struct vippull_stats *restrict stats);
+
+#endif /* !VIPPULL_H */
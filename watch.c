@@ -0,0 +1,554 @@
+#include "watch.h"
+#include "vippull.h"
+#include "nameset.h"
+#include "download.h"
+#include "arena.h"
+#include "format.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <curl/curl.h>
+
+/* what's known about the roster on the server */
+struct remote_roster {
+        CURL *easy;               // reused so the connection stays open
+        char etag[128];           // for If-None-Match, or ""
+        char modified[64];        // for If-Modified-Since, or ""
+        bool has_roster;          // one has been loaded
+};
+/* validators from the response to a fetch */
+struct fetch {
+        char etag[128];
+        char modified[64];
+};
+/* the music directory, kept current by inotify */
+struct watched_dir {
+        const char *path;
+        int fd;                   // inotify instance
+        struct nameset names;
+        const char **list;        // the names in names, for a diff
+        int max_list;
+        bool needs_rescan;        // something was removed, or events lost
+        bool has_changed;         // names came or went since the last pass
+};
+/* an export string and, if it's read from a file, that file's state */
+struct export_src {
+        const char *str;
+        bool is_read;
+        struct timespec mtime;
+        off_t size;
+};
+/* names of the missing tracks whose urls have been printed, so they're
+ * printed once while they stay missing; a name is forgotten once it's no
+ * longer missing, so it's printed again if its file goes away */
+struct printed_names {
+        struct nameset names;     // printed and still missing
+        struct nameset next;      // what names becomes after a pass
+};
+
+/* set by SIGINT or SIGTERM */
+static volatile sig_atomic_t stop;
+static void on_signal(int sig);
+
+/* fetches the roster into the context unless the server says it hasn't
+ * changed; returns 1 if there's a new roster, 0 if not, -1 on error */
+static int roster_fetch(struct remote_roster *restrict remote,
+                        const char *restrict url,
+                        struct vippull *restrict vp);
+/* loads the fetched roster in fp into the context */
+static int roster_load_file(struct vippull *restrict vp,
+                            FILE *restrict fp);
+static int roster_load_file(struct vippull *restrict vp,
+                            FILE *restrict fp) {
+        struct stat st;
+        int fd = fileno(fp);
+        if ((fstat(fd, &st) < 0) || (st.st_size == 0)) {
+                return -1;
+        }
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+                return -1;
+        }
+        int err_code = vippull_load_roster(vp, data, st.st_size);
+        munmap(data, st.st_size);
+        return err_code;
+}
+
+static size_t fetch_header(char *buf,
+                           size_t size,
+                           size_t nitems,
+                           void *fetch);
+/* copies a header value, without surrounding whitespace, into dst */
+static void value_copy(char *restrict dst,
+                       size_t size,
+                       const char *restrict val,
+                       size_t len);
+/* sets up inotify on the directory and lists it */
+static int dir_watch(struct watched_dir *restrict dir,
+                     const char *restrict path);
+static int dir_rescan(struct watched_dir *dir);
+/* applies whatever inotify has queued up */
+static void dir_events(struct watched_dir *dir);
+/* lists the names in the directory's set; returns how many there are, or -1
+ * if out of memory */
+static int dir_list(struct watched_dir *dir);
+/* true for the partial files downloads are written to, which come and go
+ * with every download and are never tracks */
+static bool is_partial(const char *name);
+/* true the first time, and then whenever an export file has changed */
+static bool export_changed(struct export_src *src);
+/* downloads the chosen tracks that aren't in the directory, or prints the
+ * ones that haven't been printed yet; returns how many downloads failed, or
+ * -1 on error */
+static int process(const struct watch_config *restrict config,
+                   struct vippull *restrict vp,
+                   struct watched_dir *restrict dir,
+                   struct printed_names *restrict printed);
+/* milliseconds from now until t */
+static int ms_until(const struct timespec *t);
+
+int watch_run(const struct watch_config *config) {
+        /* a second signal kills it outright, e.g. in the middle of a
+         * download */
+        struct sigaction sa = {
+                .sa_handler = on_signal,
+                .sa_flags = SA_RESETHAND
+        };
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+
+        if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+                return -1;
+        }
+        struct remote_roster remote = {
+                .easy = curl_easy_init(),
+                .has_roster = false
+        };
+        struct vippull *vp = vippull_new(config->threads);
+        struct watched_dir dir;
+        if ((vp == NULL) || (dir_watch(&dir, config->dirpath) < 0)) {
+                fprintf(stderr, "failed to watch directory %s\n",
+                        config->dirpath);
+                vippull_free(vp);
+                curl_easy_cleanup(remote.easy);
+                curl_global_cleanup();
+                return -1;
+        }
+        struct export_src chosen = {.str = config->chosen};
+        struct export_src sourced = {.str = config->sourced};
+        bool has_exports = false;
+        struct printed_names printed;
+        nameset_init(&printed.names);
+        nameset_init(&printed.next);
+        /* set when a pass didn't get everything, so the next poll tries
+         * again even if nothing has changed */
+        bool needs_retry = false;
+
+        struct timespec next_poll;
+        clock_gettime(CLOCK_MONOTONIC, &next_poll);
+        while (!stop) {
+                /* keep up with the directory until it's time to poll */
+                struct pollfd pfd = {.fd = dir.fd, .events = POLLIN};
+                int ret = poll(&pfd, 1, ms_until(&next_poll));
+                if (ret < 0) {
+                        if (errno != EINTR) {
+                                perror("poll");
+                                break;
+                        }
+                        continue;
+                } else if (ret > 0) {
+                        dir_events(&dir);
+                        continue;
+                }
+                clock_gettime(CLOCK_MONOTONIC, &next_poll);
+                next_poll.tv_sec += config->interval;
+
+                int fetched = roster_fetch(&remote, config->roster_url, vp);
+                /* both have to be checked so each notes its new state */
+                bool exports_changed = export_changed(&chosen);
+                exports_changed |= export_changed(&sourced);
+                if (exports_changed) {
+                        has_exports = (vippull_load_export_strs(
+                                        vp, config->chosen,
+                                        config->sourced) == 0);
+                }
+                /* a file that went away is missing again, and one that
+                 * turned up is no longer printed */
+                if (!remote.has_roster || !has_exports
+                    || ((fetched <= 0) && !exports_changed
+                        && !dir.has_changed && !needs_retry)) {
+                        continue;
+                }
+                if (fetched > 0) {
+                        struct vippull_stats stats;
+                        vippull_get_stats(vp, &stats);
+                        fprintf(stderr, "roster updated: %d tracks\n",
+                                stats.num_ids);
+                }
+                if (exports_changed) {
+                        fputs("exports updated\n", stderr);
+                }
+                needs_retry = (process(config, vp, &dir, &printed) != 0);
+        }
+
+        vippull_free(vp);
+        nameset_free(&printed.names);
+        nameset_free(&printed.next);
+        nameset_free(&dir.names);
+        free(dir.list);
+        close(dir.fd);
+        curl_easy_cleanup(remote.easy);
+        curl_global_cleanup();
+        return 0;
+}
+
+static void on_signal(int sig) {
+        (void)sig;
+        stop = 1;
+}
+
+static int roster_fetch(struct remote_roster *restrict remote,
+                        const char *restrict url,
+                        struct vippull *restrict vp) {
+        if (remote->easy == NULL) {
+                return -1;
+        }
+        /* a regular file, so the json can be mapped like any other */
+        FILE *fp = tmpfile();
+        if (fp == NULL) {
+                perror("tmpfile");
+                return -1;
+        }
+        struct curl_slist *headers = NULL;
+        char header[sizeof(remote->etag) + sizeof(remote->modified) + 32];
+        if (remote->etag[0] != '\0') {
+                snprintf(header, sizeof(header), "If-None-Match: %s",
+                         remote->etag);
+                headers = curl_slist_append(headers, header);
+        }
+        if (remote->modified[0] != '\0') {
+                snprintf(header, sizeof(header), "If-Modified-Since: %s",
+                         remote->modified);
+                headers = curl_slist_append(headers, header);
+        }
+
+        struct fetch fetch = {.etag = "", .modified = ""};
+        curl_easy_reset(remote->easy);
+        curl_easy_setopt(remote->easy, CURLOPT_URL, url);
+        curl_easy_setopt(remote->easy, CURLOPT_WRITEDATA, fp);
+        curl_easy_setopt(remote->easy, CURLOPT_HEADERFUNCTION, fetch_header);
+        curl_easy_setopt(remote->easy, CURLOPT_HEADERDATA, &fetch);
+        curl_easy_setopt(remote->easy, CURLOPT_HTTPHEADER, headers);
+        curl_easy_setopt(remote->easy, CURLOPT_ACCEPT_ENCODING, "");
+        curl_easy_setopt(remote->easy, CURLOPT_FAILONERROR, 1L);
+        curl_easy_setopt(remote->easy, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(remote->easy, CURLOPT_NOSIGNAL, 1L);
+        CURLcode result = curl_easy_perform(remote->easy);
+        long code = 0;
+        curl_easy_getinfo(remote->easy, CURLINFO_RESPONSE_CODE, &code);
+        curl_slist_free_all(headers);
+        if ((result != CURLE_OK) || (fflush(fp) != 0)) {
+                fprintf(stderr, "failed to fetch roster %s: %s\n", url,
+                        curl_easy_strerror(result));
+                fclose(fp);
+                return -1;
+        }
+        if (code == 304) {
+                fclose(fp);
+                return 0;
+        }
+
+        /* servers that don't send validators send the same roster again,
+         * which the context knows not to parse twice */
+        int err_code = roster_load_file(vp, fp);
+        fclose(fp);
+        if (err_code < 0) {
+                fprintf(stderr, "failed to parse roster %s\n", url);
+                remote->has_roster = false;
+        } else {
+                remote->has_roster = true;
+        }
+
+        if (err_code >= 0) {
+                strcpy(remote->etag, fetch.etag);
+                strcpy(remote->modified, fetch.modified);
+        }
+        return err_code;
+}
+
+static size_t fetch_header(char *buf,
+                           size_t size,
+                           size_t nitems,
+                           void *fetch) {
+        struct fetch *f = fetch;
+        const size_t len = size * nitems;
+        if ((len >= 5) && (strncasecmp(buf, "ETag:", 5) == 0)) {
+                value_copy(f->etag, sizeof(f->etag), buf + 5, len - 5);
+        } else if ((len >= 14) && (strncasecmp(buf, "Last-Modified:", 14)
+                                   == 0)) {
+                value_copy(f->modified, sizeof(f->modified), buf + 14,
+                           len - 14);
+        }
+        return len;
+}
+
+static void value_copy(char *restrict dst,
+                       size_t size,
+                       const char *restrict val,
+                       size_t len) {
+        while ((len > 0) && isspace((unsigned char)*val)) {
+                val++;
+                len--;
+        }
+        while ((len > 0) && isspace((unsigned char)val[len - 1])) {
+                len--;
+        }
+        if (len >= size) {
+                len = size - 1;
+        }
+        memcpy(dst, val, len);
+        dst[len] = '\0';
+}
+
+static int dir_watch(struct watched_dir *restrict dir,
+                     const char *restrict path) {
+        dir->path = path;
+        nameset_init(&dir->names);
+        dir->list = NULL;
+        dir->max_list = 0;
+        dir->has_changed = false;
+        dir->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (dir->fd < 0) {
+                return -1;
+        }
+        if (dir_rescan(dir) < 0) {
+                close(dir->fd);
+                nameset_free(&dir->names);
+                return -1;
+        }
+        return 0;
+}
+
+static int dir_rescan(struct watched_dir *dir) {
+        /* watching first means nothing created during the listing is
+         * missed; adding the same watch again just returns it */
+        if (inotify_add_watch(dir->fd, dir->path,
+                              IN_CREATE | IN_MOVED_TO | IN_DELETE
+                              | IN_MOVED_FROM | IN_DELETE_SELF | IN_MOVE_SELF
+                              | IN_ONLYDIR) < 0) {
+                return -1;
+        }
+        DIR *d = opendir(dir->path);
+        if (d == NULL) {
+                return -1;
+        }
+        nameset_free(&dir->names);
+        nameset_init(&dir->names);
+        struct dirent *ent;
+        while ((ent = readdir(d)) != NULL) {
+                if (!is_partial(ent->d_name)) {
+                        nameset_add(&dir->names, ent->d_name,
+                                    strlen(ent->d_name));
+                }
+        }
+        closedir(d);
+        dir->needs_rescan = false;
+        return 0;
+}
+
+static void dir_events(struct watched_dir *dir) {
+        char buf[4096]
+                __attribute__((aligned(__alignof__(struct inotify_event))));
+        ssize_t n;
+        while ((n = read(dir->fd, buf, sizeof(buf))) > 0) {
+                const struct inotify_event *ev;
+                for (char *p = buf; p < buf + n;
+                     p += sizeof(*ev) + ev->len) {
+                        ev = (const struct inotify_event *)p;
+                        /* a download renames its partial file into place
+                         * and deletes the metadata, which mustn't cost a
+                         * rescan */
+                        if ((ev->len > 0) && is_partial(ev->name)) {
+                                continue;
+                        }
+                        if ((ev->mask & (IN_CREATE | IN_MOVED_TO))
+                            && (ev->len > 0)) {
+                                nameset_add(&dir->names, ev->name,
+                                            strlen(ev->name));
+                                dir->has_changed = true;
+                        } else if (ev->mask & (IN_DELETE | IN_MOVED_FROM
+                                               | IN_DELETE_SELF
+                                               | IN_MOVE_SELF | IN_IGNORED
+                                               | IN_Q_OVERFLOW)) {
+                                /* the set can't drop names, and removals
+                                 * are rare, so just list it again later */
+                                dir->needs_rescan = true;
+                                dir->has_changed = true;
+                        }
+                }
+        }
+}
+
+static bool is_partial(const char *name) {
+        const size_t len = strlen(name);
+        const size_t partlen = sizeof(DOWNLOAD_PART_SUFFIX) - 1;
+        const size_t metalen = sizeof(DOWNLOAD_META_SUFFIX) - 1;
+        return ((len > partlen)
+                && (strcmp(name + len - partlen, DOWNLOAD_PART_SUFFIX) == 0))
+               || ((len > metalen)
+                   && (strcmp(name + len - metalen,
+                              DOWNLOAD_META_SUFFIX) == 0));
+}
+
+static bool export_changed(struct export_src *src) {
+        const bool is_first = !src->is_read;
+        src->is_read = true;
+        struct stat st;
+        if ((src->str[0] != '@') || (stat(src->str + 1, &st) < 0)) {
+                return is_first;
+        }
+        const bool has_changed = (st.st_size != src->size)
+                                 || (st.st_mtim.tv_sec != src->mtime.tv_sec)
+                                 || (st.st_mtim.tv_nsec
+                                     != src->mtime.tv_nsec);
+        src->size = st.st_size;
+        src->mtime = st.st_mtim;
+        return is_first || has_changed;
+}
+
+static int process(const struct watch_config *restrict config,
+                   struct vippull *restrict vp,
+                   struct watched_dir *restrict dir,
+                   struct printed_names *restrict printed) {
+        if (dir->needs_rescan && (dir_rescan(dir) < 0)) {
+                fprintf(stderr, "failed to read directory %s\n", dir->path);
+                return -1;
+        }
+        dir->has_changed = false;
+        const int num_names = dir_list(dir);
+        if ((num_names < 0)
+            || (vippull_diff_names(vp, dir->list, num_names) < 0)) {
+                return -1;
+        }
+
+        struct arena arena;
+        arena_init(&arena);
+        struct download *dls = NULL;
+        int num_dls = 0;
+        int max_dls = 0;
+        int err_code = 0;
+        const char *download_url = vippull_download_url(vp);
+        nameset_reset(&printed->next);
+        struct vippull_result result;
+        while (vippull_next(vp, &result)) {
+                if (!config->download) {
+                        if (!nameset_contains(&printed->names,
+                                              result.filename)) {
+                                format_track(stdout, config->format,
+                                             download_url, dir->path,
+                                             &result);
+                        }
+                        if (nameset_add(&printed->next, result.filename,
+                                        strlen(result.filename)) < 0) {
+                                err_code = -1;
+                        }
+                        continue;
+                }
+                /* make space if needed; the old list is left in the
+                 * arena */
+                if (num_dls >= max_dls) {
+                        max_dls = (max_dls == 0) ? 64 : max_dls << 1;
+                        struct download *tmp = arena_alloc(
+                                        &arena, max_dls * sizeof(*tmp));
+                        if (tmp == NULL) {
+                                err_code = -1;
+                                break;
+                        }
+                        if (num_dls > 0) {
+                                memcpy(tmp, dls, num_dls * sizeof(*tmp));
+                        }
+                        dls = tmp;
+                }
+                /* the url only lasts until the next result */
+                const size_t size = strlen(result.url) + 1;
+                char *url = arena_alloc(&arena, size);
+                if (url == NULL) {
+                        err_code = -1;
+                        break;
+                }
+                memcpy(url, result.url, size);
+                dls[num_dls] = (struct download){
+                        .url = url,
+                        .filename = result.filename
+                };
+                num_dls++;
+        }
+        fflush(stdout);
+        if (!config->download) {
+                /* what wasn't missing this time is forgotten */
+                struct nameset tmp = printed->names;
+                printed->names = printed->next;
+                printed->next = tmp;
+        }
+
+        /* whatever failed is still missing from the directory, so it's
+         * tried again on the next poll */
+        if (num_dls > 0) {
+                const int num_failed = download_all(dir->path, dls, num_dls,
+                                                    config->jobs,
+                                                    config->max_rate);
+                for (int i = 0; i < num_dls; i++) {
+                        if (dls[i].is_done) {
+                                nameset_add(&dir->names, dls[i].filename,
+                                            strlen(dls[i].filename));
+                        }
+                }
+                if ((err_code == 0) && (num_failed != 0)) {
+                        err_code = num_failed;
+                }
+                fflush(stdout);
+        }
+        arena_free(&arena);
+        return err_code;
+}
+
+static int dir_list(struct watched_dir *dir) {
+        if ((int)dir->names.num_names > dir->max_list) {
+                const char **tmp = realloc(dir->list, dir->names.num_names
+                                           * sizeof(*tmp));
+                if (tmp == NULL) {
+                        return -1;
+                }
+                dir->list = tmp;
+                dir->max_list = dir->names.num_names;
+        }
+        /* the pool is every name in the set, one after another */
+        int num_names = 0;
+        for (size_t off = 0; off < dir->names.pool_len;
+             off += strlen(dir->names.pool + off) + 1) {
+                dir->list[num_names] = dir->names.pool + off;
+                num_names++;
+        }
+        return num_names;
+}
+
+static int ms_until(const struct timespec *t) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long ms = (t->tv_sec - now.tv_sec) * 1000LL
+                       + (t->tv_nsec - now.tv_nsec) / 1000000;
+        return (ms < 0) ? 0 : (ms > INT32_MAX) ? INT32_MAX : (int)ms;
+}
@@ -0,0 +1,29 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "format.h"
+#include <stdbool.h>
+
+/* long-running mode: the roster is fetched from its url every so often,
+ * but only acted on when the server says it changed (or the exports did,
+ * or a file went away, or a download failed last time), and the music
+ * directory is kept up to date with inotify instead of being listed again.
+ * chosen tracks missing from it are downloaded, or have their urls printed
+ * once for as long as they stay missing */
+
+struct watch_config {
+        const char *roster_url;
+        const char *dirpath;
+        const char *chosen;       // export strings, or "@path"
+        const char *sourced;
+        int interval;             // seconds between polls of the roster
+        bool download;            // download instead of printing urls
+        int jobs;                 // concurrent downloads
+        long long max_rate;       // bytes a second for all downloads, or 0
+        int threads;              // pool threads; 0 for one per cpu
+        enum url_format format;   // how urls are printed
+};
+/* runs until SIGINT or SIGTERM; returns -1 if it couldn't start */
+int watch_run(const struct watch_config *config);
+
+#endif /* !WATCH_H */